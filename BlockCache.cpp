@@ -0,0 +1,236 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "BlockCache.h"
+#include "Debugger.h"
+
+BlockCache::BlockCache()
+{
+    this->flush();
+}
+
+void BlockCache::flush()
+{
+    for(int i = 0; i < RAM_SIZE; i++)
+    {
+        this->index[i] = -1;
+    }
+
+    for(int i = 0; i < RAM_SIZE / 32; i++)
+    {
+        this->covered[i] = 0;
+    }
+
+    this->blocks.clear();
+    this->freeBlocks.clear();
+}
+
+const BlockCache::Block &BlockCache::lookup(const Chip8 &cpu)
+{
+    unsigned short start = cpu.PC & (RAM_SIZE - 1);
+    short slot = this->index[start];
+
+    if(slot >= 0)
+        return this->blocks[slot];
+
+    return this->decode(cpu, start);
+}
+
+/**
+* Fused records. The first instruction's x and kk stay where they were
+* decoded, the second's register and byte go in y and nnn. LD I, DRW keeps
+* nnn from the LD I and x, y and n from the DRW.
+*/
+static void execLDA_DRW(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.LDA(ins.nnn);
+
+    //the second instruction runs a cycle later, as it would on its own
+    ++cpu.cycles;
+    cpu.DRW(ins.x, ins.y, ins.n);
+}
+
+static void execADD7_SE3(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.ADD7(ins.x, ins.kk);
+    ++cpu.cycles;
+    cpu.SE3(ins.y, ins.nnn);
+}
+
+static void execADD7_SNE4(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.ADD7(ins.x, ins.kk);
+    ++cpu.cycles;
+    cpu.SNE4(ins.y, ins.nnn);
+}
+
+static void execLD6_LD6(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.LD6(ins.x, ins.kk);
+    ++cpu.cycles;
+    cpu.LD6(ins.y, ins.nnn);
+}
+
+bool BlockCache::fuse(Chip8::Instruction &first, const Chip8::Instruction &second)
+{
+    void (*handler)(Chip8 &, const Chip8::Instruction &) = NULL;
+
+    switch((first.opcode & 0xF000) | (second.opcode & 0xF000) >> 4)
+    {
+        case 0xAD00:
+            first.handler = execLDA_DRW;
+            first.x = second.x;
+            first.y = second.y;
+            first.n = second.n;
+            return true;
+
+        case 0x7300: handler = execADD7_SE3; break;
+        case 0x7400: handler = execADD7_SNE4; break;
+        case 0x6600: handler = execLD6_LD6; break;
+
+        default:
+            return false;
+    }
+
+    first.handler = handler;
+    first.y = second.x;
+    first.nnn = second.kk;
+    return true;
+}
+
+bool BlockCache::endsBlock(unsigned short opcode)
+{
+    switch(opcode & 0xF000)
+    {
+        //CLS only clears the display, RET returns
+        case 0x0000:
+            return opcode != 0x00E0;
+
+        //JP, CALL, SE, SNE, SE
+        case 0x1000:
+        case 0x2000:
+        case 0x3000:
+        case 0x4000:
+        case 0x5000:
+
+        //SNE, JP V0, SKP/SKNP
+        case 0x9000:
+        case 0xB000:
+        case 0xE000:
+            return true;
+
+        //8xy8-8xyD and 8xyF are not instructions and trap
+        case 0x8000:
+            return (opcode & 0x000F) > 0x7 && (opcode & 0x000F) != 0xE;
+
+        case 0xF000:
+            switch(opcode & 0x00FF)
+            {
+                //LD Vx, DT, LD DT, Vx, LD ST, Vx, ADD I, Vx, LD F, Vx, LD Vx, [I]
+                case 0x07:
+                case 0x15:
+                case 0x18:
+                case 0x1E:
+                case 0x29:
+                case 0x65:
+                    return false;
+            }
+
+            //LD Vx, K waits for a key, LD B, Vx and LD [I], Vx write RAM,
+            //and anything else traps
+            return true;
+    }
+
+    return false;
+}
+
+const BlockCache::Block &BlockCache::decode(const Chip8 &cpu, unsigned short start)
+{
+    short slot;
+
+    if(!this->freeBlocks.empty())
+    {
+        slot = this->freeBlocks.back();
+        this->freeBlocks.pop_back();
+    }
+    else
+    {
+        slot = this->blocks.size();
+        this->blocks.push_back(Block());
+    }
+
+    Block &block = this->blocks[slot];
+    block.start = start;
+    block.length = 0;
+    block.instructions = 0;
+
+    //pairs are only fused for the default handlers, and not while debugging,
+    //where the cpu has to be able to stop between any two instructions
+    const Chip8::Instruction *defaults = Chip8::dispatchTable();
+    bool fusing = cpu.fusion && cpu.debugger == NULL;
+
+    unsigned short address = start;
+    while(block.instructions < MAX_BLOCK_LENGTH)
+    {
+        //an instruction at the very end of RAM wraps around, like it does in Chip8::cycle
+        unsigned short second = (address + 1) & (RAM_SIZE - 1);
+        unsigned short opcode = (cpu.read(address) << 8) | cpu.read(second);
+        const Chip8::Instruction &ins = cpu.table[opcode];
+
+        Chip8::Instruction *last = block.length > 0 ? &block.code[block.length - 1] : NULL;
+        bool fused = fusing && last != NULL && block.span[block.length - 1] == 1
+                     && last->handler == defaults[last->opcode].handler
+                     && ins.handler == defaults[opcode].handler && fuse(*last, ins);
+
+        if(fused)
+            block.span[block.length - 1] = 2;
+
+        //a breakpoint is decoded as a record that stops the cpu, so run() never checks PC
+        else if(cpu.debugger != NULL && cpu.debugger->breakpointAt(address))
+        {
+            block.span[block.length] = 1;
+            block.code[block.length++] = Chip8::breakRecord(ins);
+        }
+        else
+        {
+            block.span[block.length] = 1;
+            block.code[block.length++] = ins;
+        }
+
+        ++block.instructions;
+
+        //remember which bytes this block was decoded from
+        this->covered[address >> 5] |= 1u << (address & 31);
+        this->covered[second >> 5] |= 1u << (second & 31);
+
+        if(endsBlock(opcode) || second < address)
+            break;
+
+        address += 2;
+        if(address >= RAM_SIZE)
+            break;
+    }
+
+    this->index[start] = slot;
+    return block;
+}
+
+void BlockCache::invalidateCovering(unsigned short address)
+{
+    //a block covering address must start at most one block length before it
+    for(int distance = 0; distance < 2 * MAX_BLOCK_LENGTH; distance++)
+    {
+        unsigned short start = (address - distance) & (RAM_SIZE - 1);
+        short slot = this->index[start];
+        if(slot < 0)
+            continue;
+
+        const Block &block = this->blocks[slot];
+        if(distance < 2 * block.instructions)
+        {
+            this->index[start] = -1;
+            this->freeBlocks.push_back(slot);
+        }
+    }
+}
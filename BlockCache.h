@@ -0,0 +1,100 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef BLOCKCACHE_HH
+#define BLOCKCACHE_HH
+
+#include "Chip8.h"
+#include <vector>
+
+/**
+* Cache of pre-decoded basic blocks, keyed by the address they start at.
+*
+* A block is a straight-line run of instructions that ends at the first
+* instruction that can change the flow of control(JP, CALL, RET, the skips,
+* JPB, key waits) or that writes to RAM. Once decoded, the records of a block
+* are run back to back without fetching or decoding anything.
+*
+* Common pairs of instructions are fused into one record that runs both,
+* halving the dispatches they cost: LD I followed by DRW, an ADD Vx, byte
+* loop counter followed by the SE or SNE testing it, and two LD Vx, byte.
+* A fused record calls the same Chip8 methods the two instructions would,
+* so it behaves exactly like them. A jump to the second instruction of a
+* pair starts a block of its own there, like any other jump.
+*
+* Every write to RAM goes through Chip8::store, which calls invalidate() so
+* blocks covering the written byte are decoded again the next time they run.
+*/
+class BlockCache
+{
+	public:
+	    //longest run of instructions decoded into one block
+	    static const int MAX_BLOCK_LENGTH = 16;
+
+	    struct Block
+	    {
+	        //address of the first instruction
+	        unsigned short start;
+
+	        //number of records in code
+	        unsigned short length;
+
+	        //instructions the records run between them
+	        unsigned short instructions;
+
+	        //instructions each record runs: 1, or 2 for a fused pair
+	        unsigned char span[MAX_BLOCK_LENGTH];
+
+	        Chip8::Instruction code[MAX_BLOCK_LENGTH];
+	    };
+
+	    BlockCache ();
+
+	    //block starting at cpu.PC, decoding it first if it is not cached
+	    const Block &lookup(const Chip8 &cpu);
+
+	    //drop every block that covers address
+	    void invalidate(unsigned short address)
+	    {
+	        //most writes are to data, which no block covers
+	        if(this->covered[address >> 5] & (1u << (address & 31)))
+	            this->invalidateCovering(address);
+	    }
+
+	    //drop every block
+	    void flush();
+
+	    /**
+	    * True if the instruction ends a block: anything that can jump, skip,
+	    * stop the cpu or write to RAM.
+	    */
+	    static bool endsBlock(unsigned short opcode);
+
+	private:
+	    //one past the last byte of RAM
+	    static const int RAM_SIZE = 4096;
+
+	    //index into blocks for each start address, -1 if not decoded
+	    short index[RAM_SIZE];
+
+	    //one bit per RAM byte, set if some block was decoded from that byte
+	    unsigned int covered[RAM_SIZE / 32];
+
+	    std::vector<Block> blocks;
+
+	    //entries of blocks that were invalidated and can be reused
+	    std::vector<short> freeBlocks;
+
+	    void invalidateCovering(unsigned short address);
+
+	    /**
+	    * Turn the record for first into one that also runs second, if the
+	    * pair is one that is fused. Returns false if it isn't.
+	    */
+	    static bool fuse(Chip8::Instruction &first, const Chip8::Instruction &second);
+
+	    const Block &decode(const Chip8 &cpu, unsigned short start);
+};
+
+#endif
@@ -0,0 +1,458 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Checkpoint.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+static const char MAGIC[4] = {'C', '8', 'C', 'K'};
+
+//size of the payload before the RAM
+static const size_t FIXED_SIZE = 16 + 16 * 2 + 2 + 2 + 5 + 2 + 2 + 3 * 8 + Chip8::DISPLAY_HEIGHT * 8;
+
+static const size_t RAM_BYTES = sizeof(((Chip8::State *)0)->ram);
+static const size_t STACK_ENTRIES = sizeof(((Chip8::State *)0)->stack) / sizeof(unsigned short);
+
+//offset in the payload of SP, followed by the timers, status and keyRegister
+static const size_t SP_OFFSET = 16 + 16 * 2 + 2 + 2;
+
+static uint32_t crcTable[256];
+
+static void buildCrcTable()
+{
+    for(uint32_t i = 0; i < 256; i++)
+    {
+        uint32_t c = i;
+        for(int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        crcTable[i] = c;
+    }
+}
+
+uint32_t Checkpoint::crc32(const unsigned char *data, size_t size, uint32_t crc)
+{
+    static bool built = (buildCrcTable(), true);
+    (void)built;
+
+    crc = ~crc;
+    for(size_t i = 0; i < size; i++)
+    {
+        crc = crcTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static void put(std::vector<unsigned char> &out, uint64_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++)
+    {
+        out.push_back(value >> (8 * i));
+    }
+}
+
+static void putVarint(std::vector<unsigned char> &out, size_t value)
+{
+    while(value >= 0x80)
+    {
+        out.push_back((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(value);
+}
+
+static uint64_t get(const unsigned char *&in, int bytes)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < bytes; i++)
+    {
+        value |= (uint64_t)*in++ << (8 * i);
+    }
+    return value;
+}
+
+//reads nothing past end, a damaged record decodes as zeros instead
+static size_t getVarint(const unsigned char *&in, const unsigned char *end)
+{
+    size_t value = 0;
+    int shift = 0;
+    while(in < end && (*in & 0x80) && shift < 56)
+    {
+        value |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    if(in < end)
+        value |= (size_t)*in++ << shift;
+    return value;
+}
+
+void Checkpoint::encode(uint32_t id, const Chip8::State &state, std::vector<unsigned char> &out)
+{
+    size_t header = out.size();
+    out.resize(header + HEADER_SIZE);
+
+    size_t payload = out.size();
+
+    out.insert(out.end(), state.V, state.V + 16);
+    for(int i = 0; i < 16; i++)
+    {
+        put(out, state.stack[i], 2);
+    }
+    put(out, state.I, 2);
+    put(out, state.PC, 2);
+    put(out, state.SP, 1);
+    put(out, state.delayTimer, 1);
+    put(out, state.soundTimer, 1);
+    put(out, state.status, 1);
+    put(out, state.keyRegister, 1);
+    put(out, state.keys, 2);
+    put(out, state.trapOpcode, 2);
+    put(out, state.delayTimerCycle, 8);
+    put(out, state.soundTimerCycle, 8);
+    put(out, state.rngState, 8);
+    for(int y = 0; y < Chip8::DISPLAY_HEIGHT; y++)
+    {
+        put(out, state.display[y], 8);
+    }
+
+    //RAM is mostly zeros past the program, and the font and program are short
+    size_t i = 0;
+    while(i < RAM_BYTES)
+    {
+        size_t zeros = i;
+        while(zeros < RAM_BYTES && state.ram[zeros] == 0)
+        {
+            ++zeros;
+        }
+
+        //a lone zero between literals costs less kept in the literal run
+        size_t literal = zeros;
+        while(literal < RAM_BYTES && (state.ram[literal] != 0 ||
+              (literal + 1 < RAM_BYTES && state.ram[literal + 1] != 0)))
+        {
+            ++literal;
+        }
+
+        putVarint(out, zeros - i);
+        putVarint(out, literal - zeros);
+        out.insert(out.end(), state.ram + zeros, state.ram + literal);
+
+        i = literal;
+    }
+
+    size_t payloadSize = out.size() - payload;
+
+    unsigned char *h = &out[header];
+    std::vector<unsigned char> fields;
+    fields.insert(fields.end(), MAGIC, MAGIC + 4);
+    put(fields, VERSION, 2);
+    put(fields, HEADER_SIZE, 2);
+    put(fields, id, 4);
+    put(fields, payloadSize, 4);
+    put(fields, state.cycles, 8);
+    put(fields, crc32(&out[payload], payloadSize), 4);
+    put(fields, crc32(&fields[0], fields.size()), 4);
+    memcpy(h, &fields[0], HEADER_SIZE);
+}
+
+size_t Checkpoint::check(const unsigned char *data, size_t size)
+{
+    if(size < (size_t)HEADER_SIZE || memcmp(data, MAGIC, 4) != 0)
+        return 0;
+
+    const unsigned char *in = data + 4;
+    unsigned short version = get(in, 2);
+    unsigned short headerSize = get(in, 2);
+    get(in, 4);
+    size_t payloadSize = get(in, 4);
+    get(in, 8);
+    uint32_t payloadCrc = get(in, 4);
+    uint32_t headerCrc = get(in, 4);
+
+    if(version != VERSION || headerSize != HEADER_SIZE ||
+       headerCrc != crc32(data, HEADER_SIZE - 4) ||
+       payloadSize < FIXED_SIZE || size - headerSize < payloadSize ||
+       payloadCrc != crc32(data + headerSize, payloadSize))
+        return 0;
+
+    //a CRC can match by chance, or after a hand edit. Fields the cpu uses
+    //as indexes(stack[SP], V[keyRegister]) or switches on are checked too
+    const unsigned char *fields = data + headerSize + SP_OFFSET;
+    unsigned int SP = fields[0];
+    unsigned int status = fields[3];
+    unsigned int keyRegister = fields[4];
+
+    if(SP > STACK_ENTRIES || keyRegister > 0xF ||
+       (status != Chip8::RUNNING && status != Chip8::TRAPPED &&
+        status != Chip8::WAITING_KEY && status != Chip8::BREAK))
+        return 0;
+
+    return headerSize + payloadSize;
+}
+
+void Checkpoint::decode(const unsigned char *record, Chip8::State &state)
+{
+    const unsigned char *in = record + 12;
+    size_t payloadSize = get(in, 4);
+    state.cycles = get(in, 8);
+
+    in = record + HEADER_SIZE;
+    const unsigned char *end = in + payloadSize;
+
+    memcpy(state.V, in, 16);
+    in += 16;
+    for(int k = 0; k < 16; k++)
+    {
+        state.stack[k] = get(in, 2);
+    }
+    state.I = get(in, 2);
+    state.PC = get(in, 2);
+    state.SP = get(in, 1);
+    state.delayTimer = get(in, 1);
+    state.soundTimer = get(in, 1);
+    state.status = (Chip8::Status)get(in, 1);
+    state.keyRegister = get(in, 1);
+    state.keys = get(in, 2);
+    state.trapOpcode = get(in, 2);
+    state.delayTimerCycle = get(in, 8);
+    state.soundTimerCycle = get(in, 8);
+    state.rngState = get(in, 8);
+    for(int y = 0; y < Chip8::DISPLAY_HEIGHT; y++)
+    {
+        state.display[y] = get(in, 8);
+    }
+
+    size_t n = 0;
+    while(n < RAM_BYTES && in < end)
+    {
+        size_t zeros = getVarint(in, end);
+        size_t literal = getVarint(in, end);
+
+        zeros = std::min(zeros, RAM_BYTES - n);
+        memset(state.ram + n, 0, zeros);
+        n += zeros;
+
+        literal = std::min(literal, std::min(RAM_BYTES - n, (size_t)(end - in)));
+        memcpy(state.ram + n, in, literal);
+        n += literal;
+        in += literal;
+    }
+    memset(state.ram + n, 0, RAM_BYTES - n);
+}
+
+CheckpointWriter::CheckpointWriter(const char *path) : path(path)
+{
+    this->written = 0;
+    this->skipped = 0;
+    this->failures = 0;
+    this->hasReady = false;
+    this->busy = false;
+    this->stopping = false;
+
+    this->thread = std::thread(&CheckpointWriter::work, this);
+}
+
+CheckpointWriter::~CheckpointWriter()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        this->stopping = true;
+    }
+    this->wake.notify_one();
+    this->thread.join();
+}
+
+void CheckpointWriter::submit(uint32_t id, const Chip8 &cpu)
+{
+    this->building.emplace_back();
+    Entry &entry = this->building.back();
+    entry.id = id;
+    cpu.save(entry.state);
+}
+
+void CheckpointWriter::commit()
+{
+    {
+        std::lock_guard<std::mutex> guard(this->lock);
+        if(this->hasReady)
+            ++this->skipped;
+
+        //the old set's memory is reused for the next one
+        this->ready.swap(this->building);
+        this->hasReady = true;
+    }
+    this->wake.notify_one();
+
+    this->building.clear();
+}
+
+void CheckpointWriter::flush()
+{
+    std::unique_lock<std::mutex> guard(this->lock);
+    this->idle.wait(guard, [this] { return !this->hasReady && !this->busy; });
+}
+
+void CheckpointWriter::work()
+{
+    std::vector<Entry> entries;
+    std::unique_lock<std::mutex> guard(this->lock);
+
+    for(;;)
+    {
+        this->wake.wait(guard, [this] { return this->hasReady || this->stopping; });
+
+        //a committed set is still written when stopping
+        if(!this->hasReady)
+            break;
+
+        entries.swap(this->ready);
+        this->hasReady = false;
+        this->busy = true;
+        guard.unlock();
+
+        bool ok = this->write(entries);
+        entries.clear();
+
+        guard.lock();
+        this->busy = false;
+        if(ok)
+            ++this->written;
+        else
+            ++this->failures;
+        this->idle.notify_all();
+    }
+}
+
+bool CheckpointWriter::write(const std::vector<Entry> &entries)
+{
+    std::vector<unsigned char> out;
+    out.reserve(entries.size() * 1024);
+    for(size_t i = 0; i < entries.size(); i++)
+    {
+        Checkpoint::encode(entries[i].id, entries[i].state, out);
+    }
+
+    std::string tmp = this->path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "wb");
+    if(file == NULL)
+        return false;
+
+    bool ok = out.empty() || fwrite(&out[0], 1, out.size(), file) == out.size();
+    ok = fflush(file) == 0 && ok;
+    ok = fsync(fileno(file)) == 0 && ok;
+    ok = fclose(file) == 0 && ok;
+
+    //only a complete file replaces the last one
+    if(!ok || rename(tmp.c_str(), this->path.c_str()) != 0)
+    {
+        remove(tmp.c_str());
+        return false;
+    }
+
+    //the rename is only durable once the directory holding it is synced
+    size_t slash = this->path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : this->path.substr(0, slash);
+
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+    if(fd < 0)
+        return false;
+
+    ok = fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+}
+
+CheckpointReader::CheckpointReader()
+{
+    this->data = NULL;
+    this->size = 0;
+}
+
+CheckpointReader::~CheckpointReader()
+{
+    this->close();
+}
+
+bool CheckpointReader::open(const char *path)
+{
+    this->close();
+
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    this->size = info.st_size;
+    if(this->size > 0)
+    {
+        void *mapped = mmap(NULL, this->size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if(mapped == MAP_FAILED)
+        {
+            ::close(fd);
+            this->size = 0;
+            return false;
+        }
+        this->data = (const unsigned char *)mapped;
+    }
+    ::close(fd);
+
+    size_t offset = 0;
+    while(offset < this->size)
+    {
+        size_t record = Checkpoint::check(this->data + offset, this->size - offset);
+        if(record == 0)
+            break;
+
+        this->records.push_back(offset);
+        offset += record;
+    }
+
+    if(offset != this->size)
+    {
+        this->close();
+        return false;
+    }
+
+    return true;
+}
+
+void CheckpointReader::close()
+{
+    if(this->data != NULL)
+        munmap((void *)this->data, this->size);
+
+    this->data = NULL;
+    this->size = 0;
+    this->records.clear();
+}
+
+uint32_t CheckpointReader::id(size_t i) const
+{
+    const unsigned char *in = this->data + this->records[i] + 8;
+    return get(in, 4);
+}
+
+void CheckpointReader::decode(size_t i, Chip8::State &state) const
+{
+    Checkpoint::decode(this->data + this->records[i], state);
+}
+
+void CheckpointReader::restore(size_t i, Chip8 &cpu) const
+{
+    Chip8::State state;
+    this->decode(i, state);
+    cpu.restore(state);
+}
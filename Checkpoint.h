@@ -0,0 +1,157 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef CHECKPOINT_HH
+#define CHECKPOINT_HH
+
+#include "Chip8.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+* Checkpoint files(.c8ck): any number of cpu states, one record each.
+*
+* A record is a fixed 32 byte header
+*     "C8CK" version headerSize id payloadSize cycles payloadCrc headerCrc
+* followed by the payload: registers, stack, timers, RNG, keys, status and
+* display in a fixed layout, then RAM run-length encoded as
+*     (varint run of zero bytes, varint run of literal bytes, the literals)...
+* Numbers are little endian. headerCrc covers the header up to itself and
+* payloadCrc the payload, both CRC-32.
+*
+* Files are only ever replaced whole: a set of checkpoints is written to
+* path.tmp, synced, renamed over path, then the directory is synced, so a
+* crash leaves either the old set or the new one.
+*
+* A record is only accepted if both CRCs match and the fields a cpu uses
+* as indexes are in range: SP at most 16, keyRegister at most 0xF and a
+* known status.
+*/
+namespace Checkpoint
+{
+    static const unsigned short VERSION = 1;
+    static const int HEADER_SIZE = 32;
+
+    //CRC-32(IEEE) of size bytes
+    uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0);
+
+    //append the record for state to out
+    void encode(uint32_t id, const Chip8::State &state, std::vector<unsigned char> &out);
+
+    //size of the record at data if it is whole, its CRCs match and its fields are in range, else 0
+    size_t check(const unsigned char *data, size_t size);
+
+    //decode a record check() accepted
+    void decode(const unsigned char *record, Chip8::State &state);
+}
+
+/**
+* Writes checkpoints from a background thread.
+*
+* The emulation thread calls submit() for each cpu, which only copies its
+* state(Chip8::save), then commit() to hand the set over. Encoding, CRCs
+* and disk writes all happen on the writer thread. If it is still busy
+* with an older set when a new one is committed, the set waiting behind it
+* is replaced by the new one, so the emulation thread never waits on I/O.
+*/
+class CheckpointWriter
+{
+	public:
+	    CheckpointWriter (const char *path);
+
+	    //writes whatever was committed, then stops the thread
+	    ~CheckpointWriter ();
+
+	    //add the current state of cpu to the set being built
+	    void submit(uint32_t id, const Chip8 &cpu);
+
+	    //hand the set built since the last commit to the writer thread
+	    void commit();
+
+	    //block until every committed set is on disk
+	    void flush();
+
+	    //sets written, sets replaced before being written, and failed writes.
+	    //A set whose directory can't be synced after the rename counts as failed
+	    unsigned long written;
+	    unsigned long skipped;
+	    unsigned long failures;
+
+	private:
+	    struct Entry
+	    {
+	        uint32_t id;
+	        Chip8::State state;
+	    };
+
+	    std::string path;
+
+	    //set being built by submit(), only touched by the emulation thread
+	    std::vector<Entry> building;
+
+	    //committed set waiting for the writer thread
+	    std::vector<Entry> ready;
+	    bool hasReady;
+	    bool busy;
+	    bool stopping;
+
+	    std::mutex lock;
+	    std::condition_variable wake;
+	    std::condition_variable idle;
+	    std::thread thread;
+
+	    void work();
+
+	    //encode entries and put them on disk. Returns false if anything failed
+	    bool write(const std::vector<Entry> &entries);
+
+	    CheckpointWriter (const CheckpointWriter &);
+	    CheckpointWriter &operator=(const CheckpointWriter &);
+};
+
+/**
+* Reads a checkpoint file by mapping it into memory. open() checks every
+* record's CRCs and indexes them; restore() decodes straight out of the
+* mapping, so resuming thousands of cpus makes one system call for the
+* file, not one per cpu.
+*/
+class CheckpointReader
+{
+	public:
+	    CheckpointReader ();
+	    ~CheckpointReader ();
+
+	    //map and check path. Returns false if it can't be read or a record is damaged
+	    bool open(const char *path);
+	    void close();
+
+	    size_t count() const { return this->records.size(); }
+
+	    //id given to submit() for record i
+	    uint32_t id(size_t i) const;
+
+	    /**
+	    * Put cpu in the state of record i. Load the cpu's ROM first: RAM pages
+	    * that still match it stay shared instead of being copied.
+	    */
+	    void restore(size_t i, Chip8 &cpu) const;
+
+	    //decode record i without touching a cpu
+	    void decode(size_t i, Chip8::State &state) const;
+
+	private:
+	    const unsigned char *data;
+	    size_t size;
+
+	    //offset of each record's header
+	    std::vector<size_t> records;
+
+	    CheckpointReader (const CheckpointReader &);
+	    CheckpointReader &operator=(const CheckpointReader &);
+};
+
+#endif
@@ -3,10 +3,13 @@
 */
 
 #include "Chip8.h"
+#include "BlockCache.h"
+#include "Jit.h"
+#include "Tracer.h"
+#include "Debugger.h"
 #include <string>
+#include <string.h>
 #include <iostream>
-#include <cstdlib>
-#include <ctime>
 
 using std::string;
 using std::cout;
@@ -15,8 +18,45 @@ using std::endl;
 //8-bits
 typedef unsigned char BYTE;
 
+//sprites for the hex digits 0-F, 4 pixels wide and 5 rows tall
+static const BYTE FONT[16 * 5] =
+{
+    0xF0, 0x90, 0x90, 0x90, 0xF0, //0
+    0x20, 0x60, 0x20, 0x20, 0x70, //1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
+    0x90, 0x90, 0xF0, 0x10, 0x10, //4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
+    0xF0, 0x10, 0x20, 0x40, 0x40, //7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, //A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, //C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, //D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  //F
+};
+
 Chip8::Chip8()
 {
+    this->table = dispatchTable();
+    this->profile = PROFILE_DEFAULT;
+    this->blockCache = NULL;
+    this->engine = ENGINE_BLOCKS;
+    this->jit = NULL;
+    this->fusion = true;
+    this->tracer = NULL;
+    this->debugger = NULL;
+    this->readWatches = 0;
+    this->writeWatches = 0;
+    
+    for(int i = 0; i < NUM_PAGES; i++)
+    {
+        this->owned[i] = NULL;
+    }
+    
     this->init();
     
 }
@@ -26,10 +66,25 @@ void Chip8::init()
     //reset Program Counter
     this->PC = PC_START;
     
-    //clear RAM
-    for(int i = 0; i < RAM_SIZE; i++)
+    //RAM is the font and nothing else, in pages shared with every other cpu
+    this->image = defaultImage();
+    for(int i = 0; i < NUM_PAGES; i++)
     {
-        this->ram[i] = 0;
+        this->pages[i] = this->image->page(i);
+    }
+    
+    //clear display
+    for(int i = 0; i < DISPLAY_HEIGHT; i++)
+    {
+        this->display[i] = 0;
+    }
+    
+    //a new consumer has to copy everything once anyway
+    this->dirtyRows = 0xFFFFFFFF;
+    this->frame = 0;
+    for(int i = 0; i < DIRTY_HISTORY; i++)
+    {
+        this->dirtyHistory[i] = 0xFFFFFFFF;
     }
     
     //clear registers
@@ -50,232 +105,1255 @@ void Chip8::init()
     //reset stack pointer
     this->SP = 0;
     
+    //clear timers
+    this->cycles = 0;
+    this->cycleLimit = 0;
+    this->dispatches = 0;
+    this->delayTimer = 0;
+    this->delayTimerCycle = 0;
+    this->soundTimer = 0;
+    this->soundTimerCycle = 0;
+    
+    this->seed(0);
+    
+    //all keys up
+    this->keys = 0;
+    
+    this->status = RUNNING;
+    this->trapOpcode = 0;
+    this->keyRegister = 0;
+    
+    this->ramHash = this->image->ramHash;
+    this->displayHash = 0;
+    
+    this->flushBlocks();
+}
+
+void Chip8::seed(uint64_t seed)
+{
+    //splitmix64 spreads similar seeds(0, 1, 2...) far apart
+    uint64_t z = mix64(seed + 0x9E3779B97F4A7C15ULL);
+    
+    //xorshift gets stuck at 0
+    this->rngState = z != 0 ? z : 1;
+}
+
+void Chip8::load(const BYTE *program, int size)
+{
+    this->load(makeImage(program, size));
+}
+
+void Chip8::load(const std::shared_ptr<const RomImage> &image)
+{
+    this->init();
+    
+    this->image = image;
+    for(int i = 0; i < NUM_PAGES; i++)
+    {
+        this->pages[i] = image->page(i);
+    }
+    
+    this->ramHash = image->ramHash;
+}
+
+std::shared_ptr<const RomImage> Chip8::makeImage(const BYTE *program, int size)
+{
+    BYTE memory[RAM_SIZE] = { 0 };
+    
+    //load hex digit sprites
+    for(int i = 0; i < 16 * 5; i++)
+    {
+        memory[FONT_START + i] = FONT[i];
+    }
+    
+    if(size > RAM_SIZE - PC_START)
+        size = RAM_SIZE - PC_START;
+    
+    for(int i = 0; i < size; i++)
+    {
+        memory[PC_START + i] = program[i];
+    }
+    
+    uint64_t hash = 0;
+    for(int i = 0; i < RAM_SIZE; i++)
+    {
+        hash ^= ramKey(i, memory[i]);
+    }
+    
+    return std::make_shared<const RomImage>(memory, hash);
+}
+
+const std::shared_ptr<const RomImage> &Chip8::defaultImage()
+{
+    //built once, the first time a cpu is initialized. Thread safe
+    static const std::shared_ptr<const RomImage> image = makeImage(NULL, 0);
+    return image;
+}
+
+bool Chip8::sameRam(const Chip8 &other) const
+{
+    for(int i = 0; i < NUM_PAGES; i++)
+    {
+        //pages still shared from the same image are equal without looking
+        if(this->pages[i] != other.pages[i] && memcmp(this->pages[i], other.pages[i], PAGE_SIZE) != 0)
+            return false;
+    }
+    
+    return true;
+}
+
+int Chip8::ownedPageCount() const
+{
+    int count = 0;
+    for(int i = 0; i < NUM_PAGES; i++)
+    {
+        if(this->owned[i] != NULL && this->pages[i] == this->owned[i])
+            ++count;
+    }
+    
+    return count;
+}
+
+BYTE *Chip8::ownPage(int page)
+{
+    if(this->owned[page] == NULL)
+        this->owned[page] = new BYTE[PAGE_SIZE];
+    
+    memcpy(this->owned[page], this->pages[page], PAGE_SIZE);
+    this->pages[page] = this->owned[page];
+    
+    return this->owned[page];
 }
 
 void Chip8::cycle()
 {
+    //one cycle has no room to skip delay loop passes in, so cycles moves on by exactly 1
+    this->cycleLimit = this->cycles + 1;
+    
+    //through the debugger's blocks, so one cycle stops at its breakpoints and
+    //conditions too, and does nothing while stopped
+    if(this->debugger != NULL && this->status != WAITING_KEY)
+    {
+        this->runDebugged(this->cycles);
+        return;
+    }
+    
+    this->step();
+}
+
+void Chip8::step()
+{
+    if(this->status == WAITING_KEY)
+    {
+        ++this->cycles;
+        return;
+    }
+    
     //fetch opcode
     //need to get next 2 instructions from memory since each instruction is only 1 byte in ram. We need 2 bytes
-    unsigned short opcode = (this->ram[this->PC] << 8) | this->ram[this->PC + 1];
+    //an instruction at the very end of RAM wraps around to the start
+    unsigned short opcode = (this->read(this->PC) << 8) | this->read(this->PC + 1);
     
-    //decode
-    this->decode(opcode);
+    //decode and execute. The table already holds the handler and its operands
+    const Instruction &ins = this->table[opcode];
+    ins.handler(*this, ins);
     
-    //execute
+    ++this->cycles;
 }
 
-void Chip8::decode(unsigned short opcode)
+unsigned long Chip8::run(unsigned long count)
 {
-	//ex. 1234 - 1=>first nibble, 2=>second nibble, etc.
-    //mask to get first(leftmost) NIBBLE(4 bits)
-    const unsigned short FIRST_NIBBLE_MASK = 0xF000;
+    //counted in cycles rather than instructions, since idle loops can be
+    //skipped over without running them
+    unsigned long long start = this->cycles;
+    this->cycleLimit = start + count;
     
-    //mask to get second NIBBLE
-    const unsigned short SECOND_NIBBLE_MASK = 0x0F00;
+    //blocked on a key, the frame still goes by
+    if(this->status == WAITING_KEY)
+    {
+        this->cycles = this->cycleLimit;
+        return count;
+    }
     
-    //mask to get third NIBBLE
-    const unsigned short THIRD_NIBBLE_MASK = 0x00F0;
+    if(this->debugger != NULL)
+        return this->runDebugged(start);
     
-    //mask to get fourth NIBBLE
-    const unsigned short FOURTH_NIBBLE_MASK = 0x000F;
+    if(this->tracer != NULL)
+        return this->runTraced(start);
     
-    //mask to get second BYTE
-    const unsigned short SECOND_BYTE_MASK = 0x00FF;
+    if(this->engine == ENGINE_THREADED)
+        return this->runThreaded(start);
     
-    //mask to get last(rightmost) 12 bits
-    const unsigned short DATA_MASK = 0x0FFF;
+    if(this->engine == ENGINE_INTERPRETER)
+    {
+        while(this->cycles < this->cycleLimit && this->status == RUNNING)
+        {
+            this->step();
+        }
+        return this->cycles - start;
+    }
     
-    switch(opcode & FIRST_NIBBLE_MASK)
+    if(this->blockCache == NULL)
+        this->blockCache = new BlockCache();
+    
+    while(this->cycles < this->cycleLimit && this->status == RUNNING)
     {
-        case 0x0000:
-            switch(opcode & FOURTH_NIBBLE_MASK)
-                //00E0 - CLS
-                case 0x0000:
-                break;
-                
-                //00EE - RET
-                case 0x000E:
-                break;     
-        break;
+        const BlockCache::Block &block = this->blockCache->lookup(*this);
         
-        //1nnn - JP addr
-        case 0x1000:
-            this->JP(opcode & DATA_MASK);
-        break;
+        unsigned long long length = block.length;
+        unsigned long long left = this->cycleLimit - this->cycles;
+        if(block.instructions > left)
+        {
+            //only the records that fit before the limit
+            length = 0;
+            while(block.span[length] <= left)
+            {
+                left -= block.span[length];
+                ++length;
+            }
+            
+            //a fused pair the limit cuts through runs its first instruction alone
+            if(length == 0)
+            {
+                this->step();
+                continue;
+            }
+        }
+        else if(this->jit != NULL)
+        {
+            //whole block fits, use its translation once it has one
+            if(this->jit->execute(*this, block) > 0)
+                continue;
+        }
         
-        //2nnn - CALL addr
-        case 0x2000:
-            this->CALL(opcode & DATA_MASK);
-        break;
-        
-        //3xkk - SE3 Vx, byte
-        case 0x3000:
-            this->SE3(opcode & SECOND_NIBBLE_MASK, opcode & SECOND_BYTE_MASK);
-        break;
-        
-        //4xkk - SNE Vx, byte
-        case 0x4000:
-        	this->SNE4(opcode & SECOND_NIBBLE_MASK, opcode & SECOND_BYTE_MASK);
-        break;
-        
-        //5xy0 - SE Vx, Vy
-        case 0x5000:
-        	this->SE5(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        break;
+        //only the last record of a block can jump, skip or write RAM,
+        //so the rest can be run back to back. A fused record adds its
+        //second instruction's cycle itself
+        for(unsigned long long i = 0; i < length; i++)
+        {
+            block.code[i].handler(*this, block.code[i]);
+            ++this->cycles;
+        }
+        this->dispatches += length;
+    }
+    
+    return this->cycles - start;
+}
+
+unsigned long Chip8::runTraced(unsigned long long start)
+{
+    this->tracer->sync();
+    
+    if(this->engine == ENGINE_INTERPRETER)
+    {
+        while(this->cycles < this->cycleLimit && this->status == RUNNING)
+        {
+            this->traceStep();
+        }
+        return this->cycles - start;
+    }
+    
+    if(this->blockCache == NULL)
+        this->blockCache = new BlockCache();
+    
+    while(this->cycles < this->cycleLimit && this->status == RUNNING)
+    {
+        const BlockCache::Block &block = this->blockCache->lookup(*this);
         
-        //6xkk - LD Vx, byte
-        case 0x6000:
-        	this->LD6(opcode & SECOND_NIBBLE_MASK, opcode & SECOND_BYTE_MASK);
-        break;
+        for(int i = 0; i < block.length && this->cycles < this->cycleLimit; i++)
+        {
+            //a fused record is two steps to the tracer, so its pair runs unfused
+            if(block.span[i] != 1)
+            {
+                this->traceStep();
+                if(this->cycles < this->cycleLimit)
+                    this->traceStep();
+                continue;
+            }
+            
+            const Instruction &ins = block.code[i];
+            unsigned long long cycle = this->cycles;
+            ins.handler(*this, ins);
+            ++this->cycles;
+            
+            this->tracer->step(ins.opcode, cycle);
+        }
+    }
+    
+    return this->cycles - start;
+}
+
+void Chip8::traceStep()
+{
+    //same as step(), with the opcode kept for the tracer
+    unsigned long long cycle = this->cycles;
+    unsigned short opcode = (this->read(this->PC) << 8) | this->read(this->PC + 1);
+    
+    const Instruction &ins = this->table[opcode];
+    ins.handler(*this, ins);
+    ++this->cycles;
+    
+    this->tracer->step(opcode, cycle);
+}
+
+unsigned long Chip8::runDebugged(unsigned long long start)
+{
+    if(this->tracer != NULL)
+        this->tracer->sync();
+    
+    if(this->blockCache == NULL)
+        this->blockCache = new BlockCache();
+    
+    bool conditions = this->debugger->activeConditions > 0;
+    
+    while(this->cycles < this->cycleLimit && this->status == RUNNING)
+    {
+        const BlockCache::Block &block = this->blockCache->lookup(*this);
         
-        //7xkk - ADD Vx, byte
-        case 0x7000:
-        	this->ADD7(opcode & SECOND_NIBBLE_MASK, opcode & SECOND_BYTE_MASK);        	
-        break;
+        unsigned long long length = block.length;
+        if(length > this->cycleLimit - this->cycles)
+            length = this->cycleLimit - this->cycles;
         
+        //a watchpoint or condition can stop the cpu in the middle of a block
+        for(unsigned long long i = 0; i < length; i++)
+        {
+            const Instruction &ins = block.code[i];
+            unsigned long long cycle = this->cycles;
+            ins.handler(*this, ins);
+            
+            //stopping at a breakpoint runs nothing, so no time passes
+            if(this->status == BREAK && this->debugger->reason == Debugger::BREAKPOINT)
+                break;
+            
+            ++this->cycles;
+            
+            if(this->tracer != NULL)
+                this->tracer->step(ins.opcode, cycle);
+            
+            //conditions are brought up to date even when a watchpoint stopped the
+            //cpu, or one that turned false here would miss turning true again
+            bool stopped = this->status != RUNNING;
+            if(conditions && this->debugger->checkConditions())
+                stopped = true;
+            
+            if(stopped)
+                break;
+        }
+    }
+    
+    return this->cycles - start;
+}
+
+unsigned long long Chip8::nextTimerExpiry() const
+{
+    unsigned long long next = ~0ULL;
+    
+    if(this->currentDelayTimer() > 0)
+        next = timerExpiry(this->delayTimer, this->delayTimerCycle);
+    
+    if(this->currentSoundTimer() > 0)
+    {
+        unsigned long long sound = timerExpiry(this->soundTimer, this->soundTimerCycle);
+        if(sound < next)
+            next = sound;
+    }
+    
+    return next;
+}
+
+uint32_t Chip8::endFrame()
+{
+    uint32_t changed = this->dirtyRows;
+    
+    this->dirtyHistory[this->frame % DIRTY_HISTORY] = changed;
+    this->dirtyRows = 0;
+    ++this->frame;
+    
+    return changed;
+}
+
+uint32_t Chip8::rowsChangedSince(unsigned long since) const
+{
+    if(since > this->frame || this->frame - since > DIRTY_HISTORY)
+        return 0xFFFFFFFF;
+    
+    uint32_t changed = this->dirtyRows;
+    for(unsigned long f = since; f < this->frame; f++)
+    {
+        changed |= this->dirtyHistory[f % DIRTY_HISTORY];
+    }
+    
+    return changed;
+}
+
+void Chip8::setEngine(Engine engine)
+{
+    if(engine == ENGINE_JIT && this->jit == NULL && Jit::supported())
+        this->jit = new Jit();
+    
+    if(engine != ENGINE_JIT)
+    {
+        delete this->jit;
+        this->jit = NULL;
+    }
+    
+    this->engine = engine;
+}
+
+void Chip8::setProfile(Profile profile)
+{
+    this->profile = profile;
+    this->table = dispatchTable(profile);
+    
+    //blocks and translations hold handlers from the old table
+    this->flushBlocks();
+}
+
+const char *Chip8::profileName(Profile profile)
+{
+    static const char *const NAMES[NUM_PROFILES] = { "default", "vip", "chip48", "schip", "xochip" };
+    
+    return profile >= 0 && profile < NUM_PROFILES ? NAMES[profile] : "unknown";
+}
+
+bool Chip8::profileNamed(const char *name, Profile &profile)
+{
+    for(int i = 0; i < NUM_PROFILES; i++)
+    {
+        if(strcmp(name, profileName((Profile)i)) == 0)
+        {
+            profile = (Profile)i;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+Chip8::Profile Chip8::guessProfile(const unsigned char *program, int size)
+{
+    bool schip = false;
+    
+    for(int i = 0; i + 1 < size; i += 2)
+    {
+        unsigned short opcode = program[i] << 8 | program[i + 1];
         
-        case 0x8000:
-        	switch(opcode & FOURTH_NIBBLE_MASK)
-        	{
-        		//8xy0 - LD Vx, Vy
-        		case 0x0000:
-        			this->LD8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy1 - OR Vx, Vy
-        		case 0x0001:
-        			this->OR8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy2 - AND Vx, Vy
-        		case 0x0002:
-        			this->AND8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy3 - XOR Vx, Vy
-        		case 0x0003:
-        			this->XOR8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy4 - ADD Vx, Vy
-        		case 0x0004:
-        			this->ADD8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy5 - SUB Vx, Vy
-        		case 0x0005:
-        			this->SUB8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy6 - SHR Vx, {, Vy}
-        		case 0x0006:
-        			this->SHR8(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xy7 - SUBN Vx, Vy
-        		case 0x0007:
-        			this->SUBN(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;
-        		
-        		//8xyE - SHL Vx {, Vy}
-        		case 0x000E:
-        			this->SHL(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        		break;       	
-        		
-        	}
-        break;
+        //F000 nnnn - LD I, long; 5xy2/5xy3 - save/load Vx..Vy; F002 - audio; 00Dn - scroll up
+        if(opcode == 0xF000 || opcode == 0xF002 || (opcode & 0xFFF0) == 0x00D0 ||
+           ((opcode & 0xF00F) == 0x5002 || (opcode & 0xF00F) == 0x5003))
+            return PROFILE_XO_CHIP;
         
-        //9xy0 - SNE Vx, Vy
-        case 0x9000:
-        	this->SNE9(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK);
-        break;
+        //00Cn - scroll down; 00FB-00FF - scroll, exit, low/high resolution; Fx30, Fx75, Fx85
+        if((opcode & 0xFFF0) == 0x00C0 || (opcode >= 0x00FB && opcode <= 0x00FF) ||
+           (opcode & 0xF0FF) == 0xF030 || (opcode & 0xF0FF) == 0xF075 || (opcode & 0xF0FF) == 0xF085)
+            schip = true;
+    }
+    
+    return schip ? PROFILE_SCHIP : PROFILE_DEFAULT;
+}
+
+void Chip8::setFusion(bool fusion)
+{
+    this->fusion = fusion;
+    this->flushBlocks();
+}
+
+void Chip8::store(unsigned short address, BYTE value)
+{
+    address &= RAM_SIZE - 1;
+    
+    //copy on write
+    int p = address / PAGE_SIZE;
+    BYTE *page = this->pages[p] == this->owned[p] ? this->owned[p] : this->ownPage(p);
+    
+    this->ramHash ^= ramKey(address, page[address % PAGE_SIZE]) ^ ramKey(address, value);
+    page[address % PAGE_SIZE] = value;
+    
+    if(this->tracer != NULL)
+        this->tracer->stored(address);
+    
+    if(this->writeWatches & (1u << p))
+        this->debugger->written(address);
+    
+    this->invalidateCode(address);
+}
+
+void Chip8::invalidateCode(unsigned short address)
+{
+    if(this->blockCache != NULL)
+        this->blockCache->invalidate(address);
+    
+    if(this->jit != NULL)
+        this->jit->invalidate(address);
+}
+
+void Chip8::save(State &state) const
+{
+    for(int p = 0; p < NUM_PAGES; p++)
+    {
+        memcpy(state.ram + p * PAGE_SIZE, this->pages[p], PAGE_SIZE);
+    }
+    memcpy(state.display, this->display, sizeof(state.display));
+    
+    memcpy(state.V, this->V, sizeof(state.V));
+    memcpy(state.stack, this->stack, sizeof(state.stack));
+    state.I = this->I;
+    state.PC = this->PC;
+    state.SP = this->SP;
+    
+    state.delayTimer = this->delayTimer;
+    state.soundTimer = this->soundTimer;
+    state.delayTimerCycle = this->delayTimerCycle;
+    state.soundTimerCycle = this->soundTimerCycle;
+    state.cycles = this->cycles;
+    
+    state.rngState = this->rngState;
+    state.keys = this->keys;
+    state.status = this->status;
+    state.trapOpcode = this->trapOpcode;
+    state.keyRegister = this->keyRegister;
+}
+
+void Chip8::restore(const State &state)
+{
+    for(int p = 0; p < NUM_PAGES; p++)
+    {
+        const BYTE *saved = state.ram + p * PAGE_SIZE;
+        const BYTE *current = this->pages[p];
         
-        //Annn - LD I, addr
-        case 0xA000:
-        	this->LDA(opcode & DATA_MASK);
-        break;
+        if(memcmp(current, saved, PAGE_SIZE) == 0)
+            continue;
         
-        //Bnnn - JP V0, addr
-        case 0xB000:
-        	this->JPB(opcode & DATA_MASK);
-        break;
+        for(int i = 0; i < PAGE_SIZE; i++)
+        {
+            if(current[i] == saved[i])
+                continue;
+            
+            unsigned short address = p * PAGE_SIZE + i;
+            this->ramHash ^= ramKey(address, current[i]) ^ ramKey(address, saved[i]);
+            this->invalidateCode(address);
+        }
         
-        //Cxkk - RND Vx, byte
-        case 0xC000:
-        	this->RND(opcode & SECOND_NIBBLE_MASK, opcode & SECOND_BYTE_MASK);
-        break;
+        //back to sharing the image's page if that is what it was saved as
+        if(memcmp(this->image->page(p), saved, PAGE_SIZE) == 0)
+        {
+            this->pages[p] = this->image->page(p);
+            continue;
+        }
         
-        //Dxyn - DRW Vx, Vy, nibble
-        case 0xD000:
-        	this->DRW(opcode & SECOND_NIBBLE_MASK, opcode & THIRD_NIBBLE_MASK, opcode & FOURTH_NIBBLE_MASK);
-        break;
+        if(this->owned[p] == NULL)
+            this->owned[p] = new BYTE[PAGE_SIZE];
+        memcpy(this->owned[p], saved, PAGE_SIZE);
+        this->pages[p] = this->owned[p];
+    }
+    
+    for(int y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        if(this->display[y] == state.display[y])
+            continue;
         
-        case 0xE000:
-        	switch(opcode & FOURTH_NIBBLE_MASK)
-        	{
-        		//Ex9E - SKP Vx
-        		case 0x000E:
-        			this->SKP(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//ExA1 - SKNP Vx
-        		case 0x0001:
-        			this->SKNP(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        	}
-        break;
+        this->displayHash ^= rowKey(y, this->display[y]) ^ rowKey(y, state.display[y]);
+        this->display[y] = state.display[y];
+        this->dirtyRows |= 1u << y;
+    }
+    
+    memcpy(this->V, state.V, sizeof(state.V));
+    memcpy(this->stack, state.stack, sizeof(state.stack));
+    this->I = state.I;
+    this->PC = state.PC;
+    this->SP = state.SP;
+    
+    this->delayTimer = state.delayTimer;
+    this->soundTimer = state.soundTimer;
+    this->delayTimerCycle = state.delayTimerCycle;
+    this->soundTimerCycle = state.soundTimerCycle;
+    this->cycles = state.cycles;
+    
+    this->rngState = state.rngState;
+    this->keys = state.keys;
+    this->status = state.status;
+    this->trapOpcode = state.trapOpcode;
+    this->keyRegister = state.keyRegister;
+    
+    //a resume() before this was for the state left behind
+    if(this->debugger != NULL)
+        this->debugger->stepOver = -1;
+}
+
+void Chip8::rehash()
+{
+    this->ramHash = 0;
+    for(int i = 0; i < RAM_SIZE; i++)
+    {
+        this->ramHash ^= ramKey(i, this->read(i));
+    }
+    
+    this->displayHash = 0;
+    for(int y = 0; y < DISPLAY_HEIGHT; y++)
+    {
+        this->displayHash ^= rowKey(y, this->display[y]);
+    }
+}
+
+uint64_t Chip8::stateHash() const
+{
+    //everything but RAM and the display, packed so it can be mixed a word at a time
+    uint64_t words[8];
+    BYTE *bytes = (BYTE *)words;
+    
+    for(int i = 0; i < NUM_REGISTERS; i++)
+    {
+        bytes[i] = this->V[i];
+    }
+    
+    words[2] = (uint64_t)this->I | (uint64_t)this->PC << 16 | (uint64_t)this->SP << 32 | (uint64_t)this->keys << 40;
+    words[3] = (uint64_t)this->currentDelayTimer() | (uint64_t)this->currentSoundTimer() << 8
+             | (uint64_t)(this->cycles % CYCLES_PER_FRAME) << 16
+             | (uint64_t)this->status << 32 | (uint64_t)this->keyRegister << 40;
+    words[4] = this->rngState;
+    
+    //only the live part of the stack
+    uint64_t stackHash = 0;
+    for(int i = 0; i < this->SP && i < STACK_SIZE; i++)
+    {
+        stackHash = mix64(stackHash ^ this->stack[i] ^ (uint64_t)i << 16);
+    }
+    words[5] = stackHash;
+    words[6] = this->ramHash;
+    words[7] = this->displayHash;
+    
+    uint64_t hash = 0;
+    for(int i = 0; i < 8; i++)
+    {
+        hash = mix64(hash ^ words[i] ^ (0x9E3779B97F4A7C15ULL * (i + 1)));
+    }
+    
+    return hash;
+}
+
+void Chip8::flushBlocks()
+{
+    if(this->blockCache != NULL)
+        this->blockCache->flush();
+    
+    if(this->jit != NULL)
+        this->jit->flush();
+}
+
+void Chip8::decode(unsigned short opcode)
+{
+    const Instruction &ins = this->table[opcode];
+    ins.handler(*this, ins);
+}
+
+/**
+* Handlers stored in the dispatch table. Each one unpacks the pre-decoded
+* operands and calls the matching instruction.
+*/
+static void execCLS(Chip8 &cpu, const Chip8::Instruction &)       { cpu.CLS(); }
+static void execRET(Chip8 &cpu, const Chip8::Instruction &)       { cpu.RET(); }
+static void execJP(Chip8 &cpu, const Chip8::Instruction &ins)    { cpu.JP(ins.nnn); }
+static void execCALL(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.CALL(ins.nnn); }
+static void execSE3(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.SE3(ins.x, ins.kk); }
+static void execSNE4(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SNE4(ins.x, ins.kk); }
+static void execSE5(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.SE5(ins.x, ins.y); }
+static void execLD6(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.LD6(ins.x, ins.kk); }
+static void execADD7(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.ADD7(ins.x, ins.kk); }
+static void execLD8(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.LD8(ins.x, ins.y); }
+static void execOR8(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.OR8(ins.x, ins.y); }
+static void execAND8(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.AND8(ins.x, ins.y); }
+static void execXOR8(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.XOR8(ins.x, ins.y); }
+static void execADD8(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.ADD8(ins.x, ins.y); }
+static void execSUB8(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SUB8(ins.x, ins.y); }
+static void execSHR8(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SHR8(ins.x, ins.y); }
+static void execSUBN(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SUBN(ins.x, ins.y); }
+static void execSHL(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.SHL(ins.x, ins.y); }
+static void execSNE9(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SNE9(ins.x, ins.y); }
+static void execLDA(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.LDA(ins.nnn); }
+static void execJPB(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.JPB(ins.nnn); }
+static void execRND(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.RND(ins.x, ins.kk); }
+static void execDRW(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.DRW(ins.x, ins.y, ins.n); }
+static void execSKP(Chip8 &cpu, const Chip8::Instruction &ins)   { cpu.SKP(ins.x); }
+static void execSKNP(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.SKNP(ins.x); }
+static void execLDF07(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF07(ins.x); }
+static void execLDF0A(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF0A(ins.x); }
+static void execLDF15(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF15(ins.x); }
+static void execLDF18(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF18(ins.x); }
+static void execLDF1E(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF1E(ins.x); }
+static void execLDF29(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF29(ins.x); }
+static void execLDF33(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF33(ins.x); }
+static void execLDF55(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF55(ins.x); }
+static void execLDF65(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.LDF65(ins.x); }
+static void execTRAP(Chip8 &cpu, const Chip8::Instruction &ins)  { cpu.TRAP(ins.opcode); }
+static void execBREAKPOINT(Chip8 &cpu, const Chip8::Instruction &ins) { cpu.BREAKPOINT(ins.opcode); }
+
+Chip8::Instruction Chip8::breakRecord(const Instruction &ins)
+{
+    //operands are kept so the debugger can show what is under the breakpoint
+    Instruction record = ins;
+    record.handler = execBREAKPOINT;
+    return record;
+}
+
+/**
+* Quirk policies, one for each Profile but PROFILE_DEFAULT. The handlers
+* below that depend on a quirk are templates on the policy, so a profile's
+* table gets handlers with its choices compiled in and no test left in
+* them. Each runs the default instruction and adjusts what the profile
+* does differently.
+*/
+struct CosmacVipQuirks
+{
+    //8xy6/8xyE shift Vy into Vx instead of shifting Vx
+    static const bool SHIFT_VY = true;
+    
+    //Fx55/Fx65 leave I past the last register(I += x + 1), or CHIP-48's I += x
+    static const bool INCREMENT_I = true;
+    static const bool INCREMENT_I_BY_X = false;
+    
+    //Bxnn jumps to xnn + Vx instead of nnn + V0
+    static const bool JUMP_VX = false;
+    
+    //8xy1/2/3 clear VF
+    static const bool LOGIC_CLEARS_VF = true;
+};
+
+struct Chip48Quirks
+{
+    static const bool SHIFT_VY = false;
+    static const bool INCREMENT_I = false;
+    static const bool INCREMENT_I_BY_X = true;
+    static const bool JUMP_VX = true;
+    static const bool LOGIC_CLEARS_VF = false;
+};
+
+struct SchipQuirks
+{
+    static const bool SHIFT_VY = false;
+    static const bool INCREMENT_I = false;
+    static const bool INCREMENT_I_BY_X = false;
+    static const bool JUMP_VX = true;
+    static const bool LOGIC_CLEARS_VF = false;
+};
+
+struct XoChipQuirks
+{
+    static const bool SHIFT_VY = true;
+    static const bool INCREMENT_I = true;
+    static const bool INCREMENT_I_BY_X = false;
+    static const bool JUMP_VX = false;
+    static const bool LOGIC_CLEARS_VF = false;
+};
+
+template<class Quirks> static void execOR8Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.OR8(ins.x, ins.y);
+    if(Quirks::LOGIC_CLEARS_VF)
+        cpu.V[0x0F] = 0;
+}
+
+template<class Quirks> static void execAND8Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.AND8(ins.x, ins.y);
+    if(Quirks::LOGIC_CLEARS_VF)
+        cpu.V[0x0F] = 0;
+}
+
+template<class Quirks> static void execXOR8Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.XOR8(ins.x, ins.y);
+    if(Quirks::LOGIC_CLEARS_VF)
+        cpu.V[0x0F] = 0;
+}
+
+template<class Quirks> static void execSHR8Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    if(Quirks::SHIFT_VY)
+        cpu.V[ins.x] = cpu.V[ins.y];
+    cpu.SHR8(ins.x, ins.y);
+}
+
+template<class Quirks> static void execSHLQ(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    if(Quirks::SHIFT_VY)
+        cpu.V[ins.x] = cpu.V[ins.y];
+    cpu.SHL(ins.x, ins.y);
+}
+
+template<class Quirks> static void execJPBQ(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    //Bxnn - JP Vx, addr: jump to xnn + Vx, wrapping at the end of RAM like JPB
+    if(Quirks::JUMP_VX)
+        cpu.JP((ins.nnn + cpu.V[ins.x]) & 0x0FFF);
+    else
+        cpu.JPB(ins.nnn);
+}
+
+template<class Quirks> static void execLDF55Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.LDF55(ins.x);
+    if(Quirks::INCREMENT_I)
+        cpu.I += ins.x + 1;
+    if(Quirks::INCREMENT_I_BY_X)
+        cpu.I += ins.x;
+}
+
+template<class Quirks> static void execLDF65Q(Chip8 &cpu, const Chip8::Instruction &ins)
+{
+    cpu.LDF65(ins.x);
+    if(Quirks::INCREMENT_I)
+        cpu.I += ins.x + 1;
+    if(Quirks::INCREMENT_I_BY_X)
+        cpu.I += ins.x;
+}
+
+/**
+* Swap the handlers of a default table that depend on a quirk for Quirks'
+* versions. Only the ones where Quirks differs from the default are
+* swapped: the rest stay default handlers, which the JIT translates, blocks
+* fuse and the threaded core has labels for.
+*/
+template<class Quirks> static void applyQuirks(Chip8::Instruction *table)
+{
+    bool logic = Quirks::LOGIC_CLEARS_VF;
+    bool shift = Quirks::SHIFT_VY;
+    bool jump = Quirks::JUMP_VX;
+    bool increment = Quirks::INCREMENT_I || Quirks::INCREMENT_I_BY_X;
+    
+    for(unsigned int opcode = 0; opcode <= 0xFFFF; opcode++)
+    {
+        Chip8::Instruction &ins = table[opcode];
         
-        case 0xF000:
-        	switch(opcode & SECOND_BYTE_MASK)
-        	{
-        		//Fx07 - LD Vx, DT
-        		case 0x0007:
-        			this->LDF07(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//Fx0A - LD Vx, K
-        		case 0x000A:
-        			this->LDF0A(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//Fx15 - LD DT, Vx
-        		case 0x0015:
-        			this->LDF15(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//Fx18 - LD ST, Vx
-        		case 0x0018:
-        			this->LDF18(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//Fx1E - ADD I, Vx
-        		case 0x001E:
-        			this->LDF1E(opcode & SECOND_NIBBLE_MASK);
-        		break;
-        		
-        		//Fx29 - LD F, Vx
-        		case 0x0029:
-        		break;
-        		
-        		//Fx33 - LD B, Vx
-        		case 0x0033:
-        		break;
-        		
-        		//Fx55 - LD [I], Vx
-        		case 0x0055:
-        		break;
-
-				//Fx65 - LD Vx, [I]
-				case 0x0065:
-				break;
-        	}
-        break;
+        if(logic && ins.handler == execOR8)
+            ins.handler = execOR8Q<Quirks>;
+        else if(logic && ins.handler == execAND8)
+            ins.handler = execAND8Q<Quirks>;
+        else if(logic && ins.handler == execXOR8)
+            ins.handler = execXOR8Q<Quirks>;
+        else if(shift && ins.handler == execSHR8)
+            ins.handler = execSHR8Q<Quirks>;
+        else if(shift && ins.handler == execSHL)
+            ins.handler = execSHLQ<Quirks>;
+        else if(jump && ins.handler == execJPB)
+            ins.handler = execJPBQ<Quirks>;
+        else if(increment && ins.handler == execLDF55)
+            ins.handler = execLDF55Q<Quirks>;
+        else if(increment && ins.handler == execLDF65)
+            ins.handler = execLDF65Q<Quirks>;
+    }
+}
+
+template<class Quirks>
+const Chip8::Instruction *Chip8::profileTable()
+{
+    //one table per policy, only built if a cpu uses that profile
+    static Instruction table[0x10000];
+    
+    static bool built = (buildDispatchTable(table), applyQuirks<Quirks>(table), true);
+    (void)built;
+    
+    return table;
+}
+
+const Chip8::Instruction *Chip8::dispatchTable(Profile profile)
+{
+    switch(profile)
+    {
+        case PROFILE_COSMAC_VIP: return profileTable<CosmacVipQuirks>();
+        case PROFILE_CHIP48:     return profileTable<Chip48Quirks>();
+        case PROFILE_SCHIP:      return profileTable<SchipQuirks>();
+        case PROFILE_XO_CHIP:    return profileTable<XoChipQuirks>();
+        default:                 return dispatchTable();
+    }
+}
+
+//handlers of the default table in the order of the threaded core's labels
+static void (*const THREADED_HANDLERS[])(Chip8 &cpu, const Chip8::Instruction &ins) =
+{
+    execCLS, execRET, execJP, execCALL, execSE3, execSNE4, execSE5, execLD6, execADD7,
+    execLD8, execOR8, execAND8, execXOR8, execADD8, execSUB8, execSHR8, execSUBN, execSHL,
+    execSNE9, execLDA, execJPB, execRND, execDRW, execSKP, execSKNP,
+    execLDF07, execLDF0A, execLDF15, execLDF18, execLDF1E, execLDF29, execLDF33, execLDF55, execLDF65,
+    execTRAP
+};
+
+static const int NUM_THREADED_HANDLERS = sizeof(THREADED_HANDLERS) / sizeof(THREADED_HANDLERS[0]);
+
+//build the threaded core's label index for every opcode from the default table.
+//A handler not in THREADED_HANDLERS gets NUM_THREADED_HANDLERS, a plain call
+static void buildThreadedTable(BYTE *labels, const Chip8::Instruction *table)
+{
+    for(unsigned int opcode = 0; opcode <= 0xFFFF; opcode++)
+    {
+        int i = 0;
+        while(i < NUM_THREADED_HANDLERS && THREADED_HANDLERS[i] != table[opcode].handler)
+        {
+            ++i;
+        }
+        labels[opcode] = i;
+    }
+}
+
+//the threaded core's label index for PROFILE's table, built the first time it is asked for
+template<int PROFILE> static const BYTE *threadedTable()
+{
+    static BYTE labels[0x10000];
+    static bool built = (buildThreadedTable(labels, Chip8::dispatchTable((Chip8::Profile)PROFILE)), true);
+    (void)built;
+    
+    return labels;
+}
+
+//a profile's quirk handlers have no label of their own and run as plain calls
+static const BYTE *threadedTable(Chip8::Profile profile)
+{
+    switch(profile)
+    {
+        case Chip8::PROFILE_COSMAC_VIP: return threadedTable<Chip8::PROFILE_COSMAC_VIP>();
+        case Chip8::PROFILE_CHIP48:     return threadedTable<Chip8::PROFILE_CHIP48>();
+        case Chip8::PROFILE_SCHIP:      return threadedTable<Chip8::PROFILE_SCHIP>();
+        case Chip8::PROFILE_XO_CHIP:    return threadedTable<Chip8::PROFILE_XO_CHIP>();
+        default:                        return threadedTable<Chip8::PROFILE_DEFAULT>();
+    }
+}
+
+/**
+* ENGINE_THREADED. Runs the same handlers as cycle(), but instead of every
+* instruction returning to one shared indirect call, each handler fetches
+* the next opcode and jumps to its label itself. Every handler then has its
+* own indirect jump for the branch predictor to learn, so the jump after
+* an ADD predicts the SE that usually follows it, and so on.
+*/
+unsigned long Chip8::runThreaded(unsigned long long start)
+{
+#if defined(__GNUC__)
+    const BYTE *labelOf = threadedTable(this->profile);
+    
+    //same order as THREADED_HANDLERS, then the plain call
+    static void *const labels[NUM_THREADED_HANDLERS + 1] =
+    {
+        &&CLS, &&RET, &&JP, &&CALL, &&SE3, &&SNE4, &&SE5, &&LD6, &&ADD7,
+        &&LD8, &&OR8, &&AND8, &&XOR8, &&ADD8, &&SUB8, &&SHR8, &&SUBN, &&SHL,
+        &&SNE9, &&LDA, &&JPB, &&RND, &&DRW, &&SKP, &&SKNP,
+        &&LDF07, &&LDF0A, &&LDF15, &&LDF18, &&LDF1E, &&LDF29, &&LDF33, &&LDF55, &&LDF65,
+        &&TRAP, &&OTHER
+    };
+    
+    const Instruction *ins;
+    unsigned short opcode;
+    
+    //fetch the instruction at PC and jump to its handler, like cycle()
+    #define DISPATCH() \
+        do { \
+            opcode = (this->read(this->PC) << 8) | this->read(this->PC + 1); \
+            ins = &this->table[opcode]; \
+            goto *labels[labelOf[opcode]]; \
+        } while(0)
+    
+    //count the instruction that just ran and go on to the next one
+    #define NEXT() \
+        do { \
+            if(++this->cycles >= this->cycleLimit) \
+                goto done; \
+            DISPATCH(); \
+        } while(0)
+    
+    //the same, for the only handlers that can stop the cpu
+    #define NEXT_CHECKED() \
+        do { \
+            if(++this->cycles >= this->cycleLimit || this->status != RUNNING) \
+                goto done; \
+            DISPATCH(); \
+        } while(0)
+    
+    if(this->cycles >= this->cycleLimit || this->status != RUNNING)
+        goto done;
+    DISPATCH();
+    
+    CLS:   this->CLS(); NEXT();
+    RET:   this->RET(); NEXT_CHECKED();
+    JP:    this->JP(ins->nnn); NEXT();
+    CALL:  this->CALL(ins->nnn); NEXT_CHECKED();
+    SE3:   this->SE3(ins->x, ins->kk); NEXT();
+    SNE4:  this->SNE4(ins->x, ins->kk); NEXT();
+    SE5:   this->SE5(ins->x, ins->y); NEXT();
+    LD6:   this->LD6(ins->x, ins->kk); NEXT();
+    ADD7:  this->ADD7(ins->x, ins->kk); NEXT();
+    LD8:   this->LD8(ins->x, ins->y); NEXT();
+    OR8:   this->OR8(ins->x, ins->y); NEXT();
+    AND8:  this->AND8(ins->x, ins->y); NEXT();
+    XOR8:  this->XOR8(ins->x, ins->y); NEXT();
+    ADD8:  this->ADD8(ins->x, ins->y); NEXT();
+    SUB8:  this->SUB8(ins->x, ins->y); NEXT();
+    SHR8:  this->SHR8(ins->x, ins->y); NEXT();
+    SUBN:  this->SUBN(ins->x, ins->y); NEXT();
+    SHL:   this->SHL(ins->x, ins->y); NEXT();
+    SNE9:  this->SNE9(ins->x, ins->y); NEXT();
+    LDA:   this->LDA(ins->nnn); NEXT();
+    JPB:   this->JPB(ins->nnn); NEXT();
+    RND:   this->RND(ins->x, ins->kk); NEXT();
+    DRW:   this->DRW(ins->x, ins->y, ins->n); NEXT();
+    SKP:   this->SKP(ins->x); NEXT();
+    SKNP:  this->SKNP(ins->x); NEXT();
+    LDF07: this->LDF07(ins->x); NEXT();
+    LDF0A: this->LDF0A(ins->x); NEXT_CHECKED();
+    LDF15: this->LDF15(ins->x); NEXT();
+    LDF18: this->LDF18(ins->x); NEXT();
+    LDF1E: this->LDF1E(ins->x); NEXT();
+    LDF29: this->LDF29(ins->x); NEXT();
+    LDF33: this->LDF33(ins->x); NEXT();
+    LDF55: this->LDF55(ins->x); NEXT();
+    LDF65: this->LDF65(ins->x); NEXT();
+    TRAP:  this->TRAP(opcode); NEXT_CHECKED();
+    OTHER: ins->handler(*this, *ins); NEXT_CHECKED();
+    
+    #undef DISPATCH
+    #undef NEXT
+    #undef NEXT_CHECKED
+    
+done:
+    return this->cycles - start;
+#else
+    while(this->cycles < this->cycleLimit && this->status == RUNNING)
+    {
+        this->step();
+    }
+    return this->cycles - start;
+#endif
+}
+
+const Chip8::Instruction *Chip8::dispatchTable()
+{
+    //65536 entries, one for every possible opcode
+    static Instruction table[0x10000];
+    
+    //initialised exactly once, even if several threads get here first
+    static bool built = (buildDispatchTable(table), true);
+    (void)built;
+    
+    return table;
+}
+
+void Chip8::buildDispatchTable(Instruction *table)
+{
+    for(unsigned int opcode = 0; opcode <= 0xFFFF; opcode++)
+    {
+        Instruction &ins = table[opcode];
         
+        //ex. 1234 - 1=>first nibble, 2=>second nibble, etc.
+        ins.opcode = opcode;
+        ins.nnn = opcode & 0x0FFF;
+        ins.x = (opcode & 0x0F00) >> 8;
+        ins.y = (opcode & 0x00F0) >> 4;
+        ins.n = opcode & 0x000F;
+        ins.kk = opcode & 0x00FF;
         
+        //anything not matched below is not a valid instruction
+        ins.handler = execTRAP;
         
+        switch(opcode & 0xF000)
+        {
+            case 0x0000:
+                //00E0 - CLS
+                if(opcode == 0x00E0)
+                    ins.handler = execCLS;
+                
+                //00EE - RET
+                else if(opcode == 0x00EE)
+                    ins.handler = execRET;
+            break;
+            
+            //1nnn - JP addr
+            case 0x1000: ins.handler = execJP; break;
+            
+            //2nnn - CALL addr
+            case 0x2000: ins.handler = execCALL; break;
+            
+            //3xkk - SE Vx, byte
+            case 0x3000: ins.handler = execSE3; break;
+            
+            //4xkk - SNE Vx, byte
+            case 0x4000: ins.handler = execSNE4; break;
+            
+            //5xy0 - SE Vx, Vy
+            case 0x5000:
+                if(ins.n == 0x0)
+                    ins.handler = execSE5;
+            break;
+            
+            //6xkk - LD Vx, byte
+            case 0x6000: ins.handler = execLD6; break;
+            
+            //7xkk - ADD Vx, byte
+            case 0x7000: ins.handler = execADD7; break;
+            
+            case 0x8000:
+                switch(ins.n)
+                {
+                    //8xy0 - LD Vx, Vy
+                    case 0x0: ins.handler = execLD8; break;
+                    
+                    //8xy1 - OR Vx, Vy
+                    case 0x1: ins.handler = execOR8; break;
+                    
+                    //8xy2 - AND Vx, Vy
+                    case 0x2: ins.handler = execAND8; break;
+                    
+                    //8xy3 - XOR Vx, Vy
+                    case 0x3: ins.handler = execXOR8; break;
+                    
+                    //8xy4 - ADD Vx, Vy
+                    case 0x4: ins.handler = execADD8; break;
+                    
+                    //8xy5 - SUB Vx, Vy
+                    case 0x5: ins.handler = execSUB8; break;
+                    
+                    //8xy6 - SHR Vx {, Vy}
+                    case 0x6: ins.handler = execSHR8; break;
+                    
+                    //8xy7 - SUBN Vx, Vy
+                    case 0x7: ins.handler = execSUBN; break;
+                    
+                    //8xyE - SHL Vx {, Vy}
+                    case 0xE: ins.handler = execSHL; break;
+                }
+            break;
+            
+            //9xy0 - SNE Vx, Vy
+            case 0x9000:
+                if(ins.n == 0x0)
+                    ins.handler = execSNE9;
+            break;
+            
+            //Annn - LD I, addr
+            case 0xA000: ins.handler = execLDA; break;
+            
+            //Bnnn - JP V0, addr
+            case 0xB000: ins.handler = execJPB; break;
+            
+            //Cxkk - RND Vx, byte
+            case 0xC000: ins.handler = execRND; break;
+            
+            //Dxyn - DRW Vx, Vy, nibble
+            case 0xD000: ins.handler = execDRW; break;
+            
+            case 0xE000:
+                switch(ins.kk)
+                {
+                    //Ex9E - SKP Vx
+                    case 0x9E: ins.handler = execSKP; break;
+                    
+                    //ExA1 - SKNP Vx
+                    case 0xA1: ins.handler = execSKNP; break;
+                }
+            break;
+            
+            case 0xF000:
+                switch(ins.kk)
+                {
+                    //Fx07 - LD Vx, DT
+                    case 0x07: ins.handler = execLDF07; break;
+                    
+                    //Fx0A - LD Vx, K
+                    case 0x0A: ins.handler = execLDF0A; break;
+                    
+                    //Fx15 - LD DT, Vx
+                    case 0x15: ins.handler = execLDF15; break;
+                    
+                    //Fx18 - LD ST, Vx
+                    case 0x18: ins.handler = execLDF18; break;
+                    
+                    //Fx1E - ADD I, Vx
+                    case 0x1E: ins.handler = execLDF1E; break;
+                    
+                    //Fx29 - LD F, Vx
+                    case 0x29: ins.handler = execLDF29; break;
+                    
+                    //Fx33 - LD B, Vx
+                    case 0x33: ins.handler = execLDF33; break;
+                    
+                    //Fx55 - LD [I], Vx
+                    case 0x55: ins.handler = execLDF55; break;
+                    
+                    //Fx65 - LD Vx, [I]
+                    case 0x65: ins.handler = execLDF65; break;
+                }
+            break;
+        }
+    }
+}
+
+/**
+* 00E0 - CLS
+* Clear the display.
+*/
+void Chip8::CLS()
+{
+    for(int i = 0; i < DISPLAY_HEIGHT; i++)
+    {
+        //only rows that had something on them change
+        if(this->display[i] != 0)
+            this->dirtyRows |= 1u << i;
         
+        this->display[i] = 0;
+    }
+    
+    this->displayHash = 0;
+    
+    this->advance(2);
+}
+
+/**
+* 00EE - RET
+* Return from a subroutine.
+* The interpreter sets the program counter to the address at the top of the stack,
+* then subtracts 1 from the stack pointer.
+*/
+void Chip8::RET()
+{
+    //nothing to return to. Trapped like an unknown opcode, PC left at the RET
+    if(this->SP == 0)
+    {
+        this->TRAP(0x00EE);
+        return;
+    }
+    
+    --this->SP;
+    
+    //CALL stored the address of the CALL itself, so continue after it
+    this->PC = this->stack[this->SP];
+    this->advance(2);
+}
+
+/**
+* Any opcode that is not part of the instruction set.
+* Stops the cpu and records the opcode so it can be reported.
+*/
+void Chip8::TRAP(unsigned short opcode)
+{
+    this->status = TRAPPED;
+    this->trapOpcode = opcode;
+}
+
+/**
+* Not an instruction: stands in for the instruction at a PC breakpoint.
+* Stops the cpu before it runs, or runs it if the debugger is resuming
+* from this breakpoint.
+*/
+void Chip8::BREAKPOINT(unsigned short opcode)
+{
+    //only straight after resume(): a cpu moved some other way doesn't step
+    //over a breakpoint it lands on
+    if(this->debugger->stepOver == this->PC && this->debugger->stepOverCycle == this->cycles)
+    {
+        this->debugger->stepOver = -1;
         
+        const Instruction &ins = this->table[opcode];
+        ins.handler(*this, ins);
+        return;
     }
+    
+    this->debugger->stop(Debugger::BREAKPOINT, this->PC, -1);
 }
 
 /**
@@ -296,6 +1374,13 @@ void Chip8::JP(unsigned short address)
 */
 void Chip8::CALL(unsigned short nnn)
 {
+    //all 16 levels in use. Trapped like an unknown opcode, PC left at the CALL
+    if(this->SP >= STACK_SIZE)
+    {
+        this->TRAP(0x2000 | nnn);
+        return;
+    }
+    
     /**store current address of program counter on stack to remember where
     * to jump back to after calling subroutine 
     */
@@ -317,9 +1402,9 @@ void Chip8::CALL(unsigned short nnn)
 void Chip8::SE3(unsigned short x, unsigned short kk)
 {
     if(this->V[x] == kk)
-        this->PC += 4;
+        this->advance(4);
     else
-        this->PC += 2;
+        this->advance(2);
 }
 
 /**
@@ -331,9 +1416,9 @@ void Chip8::SE3(unsigned short x, unsigned short kk)
 void Chip8::SNE4(unsigned short x, unsigned short kk)
 {
     if(this->V[x] != kk)
-        this->PC += 4;
+        this->advance(4);
     else
-        this->PC += 2;
+        this->advance(2);
 }
 
 /**
@@ -345,9 +1430,9 @@ void Chip8::SNE4(unsigned short x, unsigned short kk)
 void Chip8::SE5(unsigned short x, unsigned short y)
 {
     if(this->V[x] == this->V[y])
-        this->PC += 4;
+        this->advance(4);
     else
-        this->PC += 2;
+        this->advance(2);
 }
 
 /**
@@ -358,7 +1443,7 @@ void Chip8::SE5(unsigned short x, unsigned short y)
 void Chip8::LD6(unsigned short x, unsigned short kk)
 {
     this->V[x] = kk;
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -369,7 +1454,7 @@ void Chip8::LD6(unsigned short x, unsigned short kk)
 void Chip8::ADD7(unsigned short x, unsigned short kk)
 {
     this->V[x] += kk;
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -380,7 +1465,7 @@ void Chip8::ADD7(unsigned short x, unsigned short kk)
 void Chip8::LD8(unsigned short x, unsigned short y)
 {
     this->V[x] = this->V[y];
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -391,7 +1476,7 @@ void Chip8::LD8(unsigned short x, unsigned short y)
 void Chip8::OR8(unsigned short x, unsigned short y)
 {
     this->V[x] |= this->V[y];
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -402,7 +1487,7 @@ void Chip8::OR8(unsigned short x, unsigned short y)
 void Chip8::AND8(unsigned short x, unsigned short y)
 {
     this->V[x] &= this->V[y];
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -413,7 +1498,7 @@ void Chip8::AND8(unsigned short x, unsigned short y)
 void Chip8::XOR8(unsigned short x, unsigned short y)
 {
     this->V[x] ^= this->V[y];
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -431,7 +1516,7 @@ void Chip8::ADD8(unsigned short x, unsigned short y)
     else
     	this->V[F] = 0;
     this->V[x] = sum & 0x00FF; //only store lowest 8 bits
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -448,7 +1533,7 @@ void Chip8::SUB8(unsigned short x, unsigned short y)
 		this->V[0x0F] = 0;
 		
 	this->V[x] -= this->V[y];
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -457,15 +1542,13 @@ void Chip8::SUB8(unsigned short x, unsigned short y)
 * If the least-significant bit of Vx is 1, then VF is set to 1, otherwise 0. 
 * Then Vx is divided by 2.
 */
-void Chip8::SHR8(unsigned short x, unsigned short y)
+void Chip8::SHR8(unsigned short x, unsigned short)
 {
-	if(this->V[x] & 0x0001 == 1)
-		this->V[F] = 1;
-	else
-		this->V[F] = 0;
+	//Vy is only shifted by the profiles that copy it into Vx first, see execSHR8Q
+	this->V[F] = this->V[x] & 0x01;
 	this->V[x] >>= 1;
 	
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -483,7 +1566,7 @@ void Chip8::SUBN(unsigned short x, unsigned short y)
 	
 	this->V[x] = this->V[y] - this->V[x];
 	
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -492,16 +1575,14 @@ void Chip8::SUBN(unsigned short x, unsigned short y)
 * If the most-significant bit of Vx is 1, then VF is set to 1,
 * otherwise to 0. Then Vx is multiplied by 2.
 */
-void Chip8::SHL(unsigned short x, unsigned short y)
+void Chip8::SHL(unsigned short x, unsigned short)
 {
-	if(this->V[x] & 0x8000 == 1)
-		this->V[F] = 1;
-	else
-		this->V[F] = 0;
+	//Vy is only shifted by the profiles that copy it into Vx first, see execSHLQ
+	this->V[F] = this->V[x] >> 7;
 	
 	this->V[x] <<= 1;
 	
-    this->PC += 2;
+    this->advance(2);
 }
 
 /**
@@ -513,9 +1594,9 @@ void Chip8::SHL(unsigned short x, unsigned short y)
 void Chip8::SNE9(unsigned short x, unsigned short y)
 {
 	if(this->V[x] != this->V[y])
-		this->PC += 4;
+		this->advance(4);
 	else
-		this->PC += 2;
+		this->advance(2);
 }
 
 /**
@@ -526,7 +1607,7 @@ void Chip8::SNE9(unsigned short x, unsigned short y)
 void Chip8::LDA(unsigned short nnn)
 {
 	this->I = nnn;
-	this->PC += 2;
+	this->advance(2);
 }
 
 /**
@@ -536,10 +1617,8 @@ void Chip8::LDA(unsigned short nnn)
 */
 void Chip8::JPB(unsigned short nnn)
 {
-	this->stack[this->SP] = this->PC;
-	++this->SP;
-	
-	this->PC = nnn + this->V[0];
+	//PC is 12 bits, so nnn + V0 past the end of RAM wraps around to the start
+	this->PC = (nnn + this->V[0]) & (RAM_SIZE - 1);
 }
 
 /**
@@ -550,11 +1629,11 @@ void Chip8::JPB(unsigned short nnn)
 */
 void Chip8::RND(unsigned short x, unsigned short kk)
 {
-	srand(time(0));
-	int randByte = rand() % 255 + 1;
+	//top byte of the generator, the best mixed bits
+	BYTE randByte = this->random() >> 56;
 	this->V[x] = randByte & kk;
 	
-	this->PC += 2;
+	this->advance(2);
 }
 
 /**
@@ -568,7 +1647,37 @@ void Chip8::RND(unsigned short x, unsigned short kk)
 */
 void Chip8::DRW(unsigned short x, unsigned short y, unsigned short n)
 {
+	unsigned int column = this->V[x] % DISPLAY_WIDTH;
+	unsigned int row = this->V[y] % DISPLAY_HEIGHT;
 	
+	//bits that were on and are turned off by the sprite
+	uint64_t erased = 0;
+	
+	if(this->readWatches != 0)
+		this->debugger->read(this->I, n);
+	
+	for(unsigned int i = 0; i < n; i++)
+	{
+		//line the sprite byte up with x = 0, then rotate it right to the column.
+		//Rotating wraps the pixels that fall off the right edge back to the left
+		uint64_t bits = (uint64_t)this->read(this->I + i) << (DISPLAY_WIDTH - 8);
+		bits = (bits >> column) | (bits << ((DISPLAY_WIDTH - column) % DISPLAY_WIDTH));
+		
+		unsigned int y = (row + i) % DISPLAY_HEIGHT;
+		uint64_t &line = this->display[y];
+		
+		//a blank sprite row leaves the line as it was
+		if(bits == 0)
+			continue;
+		
+		erased |= line & bits;
+		this->displayHash ^= rowKey(y, line) ^ rowKey(y, line ^ bits);
+		line ^= bits;
+		this->dirtyRows |= 1u << y;
+	}
+	
+	this->V[F] = erased != 0;
+	this->advance(2);
 }
 
 /**
@@ -579,7 +1688,10 @@ void Chip8::DRW(unsigned short x, unsigned short y, unsigned short n)
 */
 void Chip8::SKP(unsigned short x)
 {
-	
+    if(this->keys & (1 << (this->V[x] & 0xF)))
+        this->advance(4);
+    else
+        this->advance(2);
 }
 
 /**
@@ -590,7 +1702,10 @@ void Chip8::SKP(unsigned short x)
 */
 void Chip8::SKNP(unsigned short x)
 {
-	
+    if(this->keys & (1 << (this->V[x] & 0xF)))
+        this->advance(2);
+    else
+        this->advance(4);
 }
 
 /**
@@ -600,18 +1715,85 @@ void Chip8::SKNP(unsigned short x)
 */
 void Chip8::LDF07(unsigned short x)
 {
-	this->V[x] = this->delayTimer;
-	this->PC += 2;
+	this->skipDelayLoop();
+	
+	this->V[x] = this->currentDelayTimer();
+	this->advance(2);
+}
+
+/**
+* Many programs wait for the delay timer with
+*     PC:   Fx07 - LD Vx, DT
+*     PC+2: 3x00 - SE Vx, 0
+*     PC+4: 1nnn - JP PC
+* Every pass of that loop leaves the same state behind apart from cycles
+* (Vx is overwritten by the next read), so whole passes can be skipped by
+* moving cycles forward. It stops at the first pass whose read gives 0, or
+* earlier if that would go past the cycle limit of the current run(), with
+* room left for one whole pass.
+*/
+void Chip8::skipDelayLoop()
+{
+	if(this->currentDelayTimer() == 0 || !this->delayLoopAt(this->PC))
+		return;
+	
+	//3 instructions per pass
+	unsigned long long expiry = timerExpiry(this->delayTimer, this->delayTimerCycle);
+	unsigned long long passes = (expiry - this->cycles + 2) / 3;
+	
+	if(this->cycleLimit < this->cycles + 3)
+		return;
+	
+	unsigned long long room = (this->cycleLimit - this->cycles - 3) / 3;
+	if(passes > room)
+		passes = room;
+	
+	this->cycles += 3 * passes;
+}
+
+bool Chip8::delayLoopAt(unsigned short address) const
+{
+	address &= RAM_SIZE - 1;
+	
+	unsigned short load = (this->read(address) << 8) | this->read(address + 1);
+	unsigned short next = (this->read(address + 2) << 8) | this->read(address + 3);
+	unsigned short after = (this->read(address + 4) << 8) | this->read(address + 5);
+	
+	return (load & 0xF0FF) == 0xF007
+		&& next == (0x3000 | (load & 0x0F00))
+		&& after == (0x1000 | address);
+}
+
+bool Chip8::waitingOnDelay() const
+{
+	if(this->status != RUNNING || this->currentDelayTimer() == 0)
+		return false;
+	
+	//PC can be at any of the three instructions of the loop
+	return this->delayLoopAt(this->PC) || this->delayLoopAt(this->PC - 2) || this->delayLoopAt(this->PC - 4);
 }
 
 /**
 * Fx0A - LD Vx, K
 * Wait for a key press, store the value of the key in Vx.
 * All execution stops until a key is pressed, then the value of that key is stored in Vx.
+*
+* If a key is already down the lowest one held is stored straight away.
+* Otherwise the cpu stops in WAITING_KEY, costing nothing until setKey
+* presses a key and stores it.
 */
 void Chip8::LDF0A(unsigned short x)
 {
+	this->advance(2);
 	
+	if(this->keys != 0)
+	{
+		this->V[x] = __builtin_ctz(this->keys);
+		return;
+	}
+	
+	this->status = WAITING_KEY;
+	this->keyRegister = x;
 }
 
 /**
@@ -622,7 +1804,8 @@ void Chip8::LDF0A(unsigned short x)
 void Chip8::LDF15(unsigned short x)
 {
 	this->delayTimer = this->V[x];
-	this->PC += 2;
+	this->delayTimerCycle = this->cycles;
+	this->advance(2);
 }
 
 /**
@@ -633,7 +1816,8 @@ void Chip8::LDF15(unsigned short x)
 void Chip8::LDF18(unsigned short x)
 {
 	this->soundTimer = this->V[x];
-	this->PC += 2;
+	this->soundTimerCycle = this->cycles;
+	this->advance(2);
 }
 
 /**
@@ -644,7 +1828,7 @@ void Chip8::LDF18(unsigned short x)
 void Chip8::LDF1E(unsigned short x)
 {
 	this->I += this->V[x];
-	this->PC += 2;
+	this->advance(2);
 }
 
 /**
@@ -655,7 +1839,9 @@ void Chip8::LDF1E(unsigned short x)
 */
 void Chip8::LDF29(unsigned short x)
 {
-	
+	//each digit sprite is 5 bytes long
+	this->I = FONT_START + (this->V[x] & 0x0F) * 5;
+	this->advance(2);
 }
 
 /**
@@ -667,7 +1853,13 @@ void Chip8::LDF29(unsigned short x)
 */
 void Chip8::LDF33(unsigned short x)
 {
+	BYTE value = this->V[x];
+	
+	this->store(this->I, value / 100);
+	this->store(this->I + 1, (value / 10) % 10);
+	this->store(this->I + 2, value % 10);
 	
+	this->advance(2);
 }
 
 /**
@@ -680,9 +1872,9 @@ void Chip8::LDF55(unsigned short x)
 {
 	for(int i = 0; i <= x; i++)
 	{
-		this->ram[this->I + i] = this->V[i];
+		this->store(this->I + i, this->V[i]);
 	}
-	this->PC += 2;
+	this->advance(2);
 }
 
 /**
@@ -692,12 +1884,15 @@ void Chip8::LDF55(unsigned short x)
 */
 void Chip8::LDF65(unsigned short x)
 {
+	if(this->readWatches != 0)
+		this->debugger->read(this->I, x + 1);
+	
 	for(int i = 0; i <= x; i++)
 	{
-		this->V[i] = this->ram[this->I + i];
+		this->V[i] = this->read(this->I + i);
 	}
 	
-	this->PC += 2;
+	this->advance(2);
 }
 
 
@@ -716,5 +1911,14 @@ void Chip8::dump()
 
 Chip8::~Chip8()
 {
-
+	if(this->debugger != NULL)
+		this->debugger->detach();
+	
+	delete this->blockCache;
+	delete this->jit;
+	
+	for(int i = 0; i < NUM_PAGES; i++)
+	{
+		delete[] this->owned[i];
+	}
 }
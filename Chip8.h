@@ -5,6 +5,15 @@
 #ifndef CHIP8_HH
 #define CHIP8_HH
 
+#include "RomImage.h"
+#include <stdint.h>
+#include <memory>
+
+class BlockCache;
+class Jit;
+class Tracer;
+class Debugger;
+
 /**
 Memory Map:
 +---------------+= 0xFFF (4095) End of Chip-8 RAM
@@ -38,6 +47,10 @@ class Chip8
     //4k of RAM(4096 bytes)
     static const int RAM_SIZE = 4096;
     
+    //RAM is kept in pages that can be shared between cpus, see RomImage
+    static const int PAGE_SIZE = RomImage::PAGE_SIZE;
+    static const int NUM_PAGES = RomImage::NUM_PAGES;
+    
     //number of general purpose 8-bit registers
     static const int NUM_REGISTERS = 16;
     
@@ -50,9 +63,135 @@ class Chip8
     //more readable format for the carry flag. Instead of this->V[0x0F], we can do this->V[F]
     static const int F = 0x0F;
     
+    //built-in hex digit sprites(0-F, 5 bytes each) live at the start of the interpreter area
+    static const int FONT_START = 0x000;
+    
 	public:
-	    //4K of RAM (4096 bytes)
-	    BYTE ram[RAM_SIZE];
+	    //64x32 monochrome display
+	    static const int DISPLAY_WIDTH = 64;
+	    static const int DISPLAY_HEIGHT = 32;
+	    
+	    //frames of dirty row masks kept for rowsChangedSince()
+	    static const int DIRTY_HISTORY = 64;
+	    
+	    //instructions run per 60Hz frame(about 600 instructions a second)
+	    static const int CYCLES_PER_FRAME = 10;
+	    
+	    /**
+	    * A pre-decoded instruction. Every 16-bit opcode has one of these in the
+	    * dispatch table, with its operands already pulled out of the nibbles so
+	    * the fetch path is a single indexed load and an indirect call.
+	    */
+	    struct Instruction
+	    {
+	        //executes the instruction against a cpu
+	        void (*handler)(Chip8 &cpu, const Instruction &ins);
+	        
+	        //raw opcode this entry was decoded from
+	        unsigned short opcode;
+	        
+	        //lowest 12 bits(nnn)
+	        unsigned short nnn;
+	        
+	        //second nibble(x), third nibble(y), fourth nibble(n) and second byte(kk)
+	        BYTE x;
+	        BYTE y;
+	        BYTE n;
+	        BYTE kk;
+	    };
+	    
+	    //execution state of the cpu
+	    enum Status
+	    {
+	        RUNNING,
+	        
+	        //an unknown opcode was fetched, or a CALL or RET would have run
+	        //the stack over or under. PC is left pointing at it
+	        TRAPPED,
+	        
+	        //stopped at LD Vx, K until a key is pressed. PC is already past it
+	        WAITING_KEY,
+	        
+	        //stopped by the attached Debugger, see Debugger::reason
+	        BREAK
+	    };
+	    
+	    //how run() executes instructions
+	    enum Engine
+	    {
+	        //fetch and dispatch one instruction at a time, like cycle()
+	        ENGINE_INTERPRETER,
+	        
+	        //run pre-decoded blocks from the block cache
+	        ENGINE_BLOCKS,
+	        
+	        //translate hot blocks to native code, falling back to ENGINE_BLOCKS
+	        //when the host is not x86-64
+	        ENGINE_JIT,
+	        
+	        //like ENGINE_INTERPRETER, as threaded code: each handler fetches
+	        //the next instruction and jumps straight to its handler. Needs
+	        //GCC's labels as values, otherwise the same as ENGINE_INTERPRETER
+	        ENGINE_THREADED
+	    };
+	    
+	    /**
+	    * CHIP-8 variant to follow where the variants disagree:
+	    *
+	    *                       8xy6/8xyE   Fx55/Fx65    Bnnn        8xy1/2/3
+	    *   PROFILE_DEFAULT     shift Vx    I unchanged  nnn + V0    VF kept
+	    *   PROFILE_COSMAC_VIP  shift Vy    I += x + 1   nnn + V0    VF = 0
+	    *   PROFILE_CHIP48      shift Vx    I += x       xnn + Vx    VF kept
+	    *   PROFILE_SCHIP       shift Vx    I unchanged  xnn + Vx    VF kept
+	    *   PROFILE_XO_CHIP     shift Vy    I += x + 1   nnn + V0    VF kept
+	    *
+	    * PROFILE_DEFAULT is the behaviour documented on the instructions
+	    * below. Each profile has its own dispatch table whose handlers have
+	    * the choices compiled in, so no handler tests a quirk at run time.
+	    * Only the handlers where a profile differs from the default are
+	    * replaced. Every engine runs the rest exactly as it does for
+	    * PROFILE_DEFAULT; the threaded core and the JIT run the replaced
+	    * ones as plain calls.
+	    */
+	    enum Profile
+	    {
+	        PROFILE_DEFAULT,
+	        PROFILE_COSMAC_VIP,
+	        PROFILE_CHIP48,
+	        PROFILE_SCHIP,
+	        PROFILE_XO_CHIP,
+	        NUM_PROFILES
+	    };
+	    
+	    /**
+	    * Everything needed to put a cpu back exactly where it was: RAM,
+	    * registers, stack, timers, display, RNG, keys and status. Plain data,
+	    * so it can be copied, compared and encoded as bytes. The engine,
+	    * caches and dirty row tracking are not part of it.
+	    */
+	    struct State
+	    {
+	        BYTE ram[RAM_SIZE];
+	        uint64_t display[DISPLAY_HEIGHT];
+	        
+	        BYTE V[NUM_REGISTERS];
+	        unsigned short stack[STACK_SIZE];
+	        unsigned short I;
+	        unsigned short PC;
+	        BYTE SP;
+	        
+	        BYTE delayTimer;
+	        BYTE soundTimer;
+	        unsigned long long delayTimerCycle;
+	        unsigned long long soundTimerCycle;
+	        unsigned long long cycles;
+	        
+	        uint64_t rngState;
+	        unsigned short keys;
+	        Status status;
+	        unsigned short trapOpcode;
+	        BYTE keyRegister;
+	    };
 	    
 	    //16 8-bit general purpose registers referred to as Vx where x is a hex digit 0-F
 	    BYTE V[NUM_REGISTERS];
@@ -60,7 +199,8 @@ class Chip8
 	    //16-bit register used to store memory addresses(only rightmost(lowest) 12 bits are used)
 	    unsigned short I;
         
-        //16-bit program counter
+        //program counter. Only the lowest 12 bits are used: every instruction
+        //that moves it wraps around at the end of RAM, in every engine
         unsigned short PC;
         
         //8-bit stack pointer
@@ -68,17 +208,75 @@ class Chip8
         
         //stack is an array of 16 16-bit values. Allows for up to 16 levels of nested subroutines
         unsigned short stack[STACK_SIZE];
+        
+        /**
+        * Display memory, one 64-bit word per row. Pixel (x, y) is bit 63 - x of
+        * display[y], so the leftmost pixel is the most significant bit and a
+        * sprite byte shifted up by 56 lines up with x = 0.
+        * The whole screen is 256 bytes, four cache lines.
+        */
+        uint64_t display[DISPLAY_HEIGHT];
+        
+        /**
+        * Zobrist-style hashes of RAM and the display, kept up to date by
+        * store(), DRW and CLS. Each is the XOR of a key for every nonzero
+        * byte(or row) and where it is, so a write only has to swap the key
+        * of the old value for the key of the new one. See stateHash().
+        */
+        uint64_t ramHash;
+        uint64_t displayHash;
+        
+        //bit y set if row y of the display changed during the current frame
+        uint32_t dirtyRows;
+        
+        //frames ended with endFrame() since init()
+        unsigned long frame;
+	    
+	    //instructions run since init(), including idle loop passes that were skipped
+	    unsigned long long cycles;
+	    
+	    //cycles stops here in the current run() or cycle(). Idle loops are not skipped past it
+	    unsigned long long cycleLimit;
+	    
+	    //block records run by ENGINE_BLOCKS since init(). A fused record counts once
+	    unsigned long long dispatches;
 	    
 	    /**
 	    * 8-bit delay and sound timers
 	    * When these 2 registers are non-zero, they are automatically decremented 
 	    * at a rate of 60Hz
+	    *
+	    * Nothing is decremented. Each timer is stored as the value it was set to
+	    * and the cycle it was set at, and its current value is worked out from
+	    * the cycle count when it is read. A tick happens every time cycles
+	    * reaches a multiple of CYCLES_PER_FRAME.
 	    */
-	    //8-bit register for delay timer
+	    //value the delay timer was last set to
 	    BYTE delayTimer;
 	    
-	    //8-bit register for sound timer
+	    //cycle the delay timer was last set at
+	    unsigned long long delayTimerCycle;
+	    
+	    //value the sound timer was last set to
 	    BYTE soundTimer;
+	    
+	    //cycle the sound timer was last set at
+	    unsigned long long soundTimerCycle;
+	    
+	    //hex keypad, bit k set while key k is held down
+	    unsigned short keys;
+	    
+	    //xorshift64* state used by RND. Never 0
+	    uint64_t rngState;
+	    
+	    //RUNNING, TRAPPED after an unknown opcode, WAITING_KEY or BREAK
+	    Status status;
+	    
+	    //register the next key press goes into while WAITING_KEY
+	    BYTE keyRegister;
+	    
+	    //opcode that caused the last trap
+	    unsigned short trapOpcode;
 	    	    
 	    Chip8 ();
 		virtual ~Chip8 ();
@@ -86,12 +284,252 @@ class Chip8
 	    //initialize CPU
 	    void init();
 	    
-	    //emulate one cycle
+	    /**
+	    * Seed the random number generator used by RND. init() and load() reset
+	    * it to a fixed seed, so call this after them. Two cpus given the same
+	    * seed and input produce the same run.
+	    */
+	    void seed(uint64_t seed);
+	    
+	    //next value of the random number generator
+	    uint64_t random()
+	    {
+	        this->rngState ^= this->rngState >> 12;
+	        this->rngState ^= this->rngState << 25;
+	        this->rngState ^= this->rngState >> 27;
+	        return this->rngState * 0x2545F4914F6CDD1DULL;
+	    }
+	    
+	    /**
+	    * Initialize the cpu and copy a program into RAM at 0x200.
+	    * Anything that does not fit in RAM is dropped.
+	    */
+	    void load(const unsigned char *program, int size);
+	    
+	    /**
+	    * Initialize the cpu with image as its RAM. Nothing is copied until the
+	    * program writes to a page, so loading one image into many cpus costs
+	    * little more than init() and the RAM they never write is shared.
+	    */
+	    void load(const std::shared_ptr<const RomImage> &image);
+	    
+	    /**
+	    * Memory image with the font and a program at 0x200, for load().
+	    * Anything that does not fit in RAM is dropped.
+	    */
+	    static std::shared_ptr<const RomImage> makeImage(const unsigned char *program, int size);
+	    
+	    //one byte of RAM. The address wraps around at 4K
+	    BYTE read(unsigned short address) const
+	    {
+	        address &= RAM_SIZE - 1;
+	        return this->pages[address / PAGE_SIZE][address % PAGE_SIZE];
+	    }
+	    
+	    //true if both cpus have the same RAM contents
+	    bool sameRam(const Chip8 &other) const;
+	    
+	    //RAM pages this cpu has written to and so has its own copy of
+	    int ownedPageCount() const;
+	    
+	    //current value of the delay timer
+	    BYTE currentDelayTimer() const
+	    {
+	        return timerValue(this->delayTimer, this->delayTimerCycle);
+	    }
+	    
+	    //current value of the sound timer. The buzzer sounds while it is non-zero
+	    BYTE currentSoundTimer() const
+	    {
+	        return timerValue(this->soundTimer, this->soundTimerCycle);
+	    }
+	    
+	    /**
+	    * Cycle at which the next running timer reaches 0, or ~0ULL if both are
+	    * already 0. Nothing timer related changes before then, so a scheduler
+	    * can skip an idle cpu straight to it.
+	    */
+	    unsigned long long nextTimerExpiry() const;
+	    
+	    /**
+	    * Copy the state of the cpu into state. Fields are written one by one,
+	    * so padding in state is left as it was.
+	    */
+	    void save(State &state) const;
+	    
+	    /**
+	    * Put the cpu back in a saved state. Only what differs is written: RAM
+	    * pages that match are skipped, cached blocks are only dropped for
+	    * bytes that changed, and only rows that change are marked dirty.
+	    */
+	    void restore(const State &state);
+	    
+	    /**
+	    * 64-bit hash of everything that decides what the cpu does next: RAM,
+	    * display, registers, stack, timers, RNG, keys and status. Two cpus in
+	    * the same state have the same hash wherever in time they are.
+	    * RAM and the display are hashed as they are written; the rest, under
+	    * 100 bytes, is mixed in here.
+	    */
+	    uint64_t stateHash() const;
+	    
+	    /**
+	    * Recompute ramHash and displayHash from scratch. Call this after
+	    * writing to display directly.
+	    */
+	    void rehash();
+	    
+	    /**
+	    * True if PC is inside a loop that does nothing but wait for the delay
+	    * timer to reach 0, so nothing visible happens before nextTimerExpiry().
+	    */
+	    bool waitingOnDelay() const;
+	    
+	    /**
+	    * End the current display frame. Called by whatever presents or records
+	    * the display, once per frame. Returns the rows that changed during it.
+	    */
+	    uint32_t endFrame();
+	    
+	    /**
+	    * Rows that changed since the end of frame since(a value of frame read
+	    * earlier), including the frame in progress. A consumer that last copied
+	    * the display at that point only needs to copy these rows. If since is
+	    * more than DIRTY_HISTORY frames back every row is returned.
+	    */
+	    uint32_t rowsChangedSince(unsigned long since) const;
+	    
+	    /**
+	    * Press or release key 0-F. A press while WAITING_KEY finishes the
+	    * LD Vx, K that is waiting and sets the cpu running again.
+	    */
+	    void setKey(int key, bool pressed)
+	    {
+	        if(!pressed)
+	        {
+	            this->keys &= ~(1 << (key & 0xF));
+	            return;
+	        }
+	        
+	        this->keys |= 1 << (key & 0xF);
+	        
+	        if(this->status == WAITING_KEY)
+	        {
+	            this->V[this->keyRegister] = key & 0xF;
+	            this->status = RUNNING;
+	        }
+	    }
+	    
+	    //true if pixel (x, y) is on
+	    bool pixel(int x, int y) const
+	    {
+	        return (this->display[y] >> (DISPLAY_WIDTH - 1 - x)) & 1;
+	    }
+	    
+	    /**
+	    * Emulate one cycle. While WAITING_KEY only time passes. Unlike run(),
+	    * a delay timer wait loop is never fast-forwarded, so cycles always
+	    * moves on by exactly 1.
+	    */
 	    void cycle();
 	    
-	    //decode an opcode
+	    /**
+	    * Emulate up to count cycles with the selected engine.
+	    * Stops early if the cpu traps, starts waiting for a key or hits a
+	    * breakpoint of its debugger. Returns the
+	    * number of cycles run. Called while WAITING_KEY, nothing is executed
+	    * but time still passes: cycles(and so the timers) move on by count.
+	    * Busy waits on the delay timer are fast-forwarded(see LDF07), so this
+	    * can be more than the number of instructions actually executed.
+	    */
+	    unsigned long run(unsigned long count);
+	    
+	    //select the engine used by run(). The default is ENGINE_BLOCKS
+	    void setEngine(Engine engine);
+	    
+	    //follow profile from now on. Drops cached blocks and translations
+	    void setProfile(Profile profile);
+	    
+	    Profile currentProfile() const { return this->profile; }
+	    
+	    //name of profile: "default", "vip", "chip48", "schip" or "xochip"
+	    static const char *profileName(Profile profile);
+	    
+	    //profile called name, as profileName gives it. False if there is none
+	    static bool profileNamed(const char *name, Profile &profile);
+	    
+	    /**
+	    * Best guess at the profile program was written for, from instructions
+	    * only a later variant has(SCHIP's scrolling and high resolution,
+	    * XO-CHIP's long I load and register ranges). PROFILE_DEFAULT if it
+	    * uses none of them. Data can look like those instructions too, so
+	    * this is a starting point for a ROM that has no known profile.
+	    */
+	    static Profile guessProfile(const unsigned char *program, int size);
+	    
+	    /**
+	    * Fuse common pairs of instructions into single records when decoding
+	    * blocks(see BlockCache). On by default. Changing it drops the blocks
+	    * decoded so far.
+	    */
+	    void setFusion(bool fusion);
+	    
+	    /**
+	    * Record every instruction run() executes to tracer, or stop with NULL.
+	    * Used by Tracer::start and Tracer::stop.
+	    */
+	    void setTracer(Tracer *tracer) { this->tracer = tracer; }
+	    
+	    /**
+	    * Write one byte of RAM. This is the only way RAM is written: it copies
+	    * a shared page on its first write and throws away cached blocks
+	    * decoded from that byte.
+	    */
+	    void store(unsigned short address, BYTE value);
+	    
+	    //drop all cached blocks and translations
+	    void flushBlocks();
+	    
+	    //decode and execute an opcode
 	    void decode(unsigned short opcode);
 	    
+	    /**
+	    * Dispatch table with one pre-decoded entry for each of the 65536 opcodes.
+	    * Built once, the first time it is asked for.
+	    */
+	    static const Instruction *dispatchTable();
+	    
+	    //dispatch table for profile, built the first time it is asked for
+	    static const Instruction *dispatchTable(Profile profile);
+	    
+	    /**
+	    * 00E0 - CLS
+	    * Clear the display.
+	    */
+	    void CLS();
+	    
+	    /**
+	    * 00EE - RET
+	    * Return from a subroutine.
+	    * The interpreter sets the program counter to the address at the top of the stack,
+	    * then subtracts 1 from the stack pointer.
+	    * With the stack empty the cpu traps instead.
+	    */
+	    void RET();
+	    
+	    /**
+	    * Any opcode that is not part of the instruction set.
+	    * Stops the cpu and records the opcode so it can be reported.
+	    */
+	    void TRAP(unsigned short opcode);
+	    
+	    /**
+	    * Not an instruction: stands in for the instruction at a PC breakpoint
+	    * in decoded blocks. Stops the cpu before it runs, or runs it if the
+	    * debugger is resuming from this breakpoint.
+	    */
+	    void BREAKPOINT(unsigned short opcode);
+	    
 	    /**
         * 1nnn - JP addr
         * Jump to location nnn.
@@ -104,6 +542,7 @@ class Chip8
         * Call subroutine at nnn
         * The interpreter increments the stack pointer, then puts the current PC on 
         * the top of the stack. The PC is then set to nnn.
+        * With all 16 levels in use the cpu traps instead.
         */
 	    void CALL(unsigned short address);
 	    
@@ -337,8 +776,137 @@ class Chip8
 		
 
 	private:
+	    friend class BlockCache;
+	    friend class Jit;
+	    friend class Chip8Batch;
+	    friend class Debugger;
+	    
+	    //dispatch table used by cycle() and decode(), the one for profile
+	    const Instruction *table;
+	    Profile profile;
+	    
+	    //decoded blocks used by run(). Created the first time run() is called
+	    BlockCache *blockCache;
+	    
+	    //engine used by run()
+	    Engine engine;
+	    
+	    //native translations used by ENGINE_JIT. Created by setEngine()
+	    Jit *jit;
+	    
+	    //true if blocks are decoded with fused records
+	    bool fusion;
+	    
+	    //tracer run() reports to, NULL when not tracing
+	    Tracer *tracer;
+	    
+	    /**
+	    * run() while tracing. Every instruction is reported on its own, but
+	    * outside the interpreter they still come from decoded blocks, so a
+	    * step isn't also paying for a fetch and a table lookup.
+	    */
+	    unsigned long runTraced(unsigned long long start);
+	    
+	    //run the instruction at PC and report it to the tracer
+	    void traceStep();
+	    
+	    //debugger that stops this cpu, NULL when not debugging. Set by Debugger::attach
+	    Debugger *debugger;
+	    
+	    //bit p set if the debugger watches reads or writes of a byte in RAM page p
+	    unsigned int readWatches;
+	    unsigned int writeWatches;
+	    
+	    //run() with ENGINE_THREADED
+	    unsigned long runThreaded(unsigned long long start);
+	    
+	    //run() while debugging: decoded blocks, stopping after any instruction
+	    unsigned long runDebugged(unsigned long long start);
+	    
+	    //copy of ins that runs BREAKPOINT instead, decoded into blocks at breakpoints
+	    static Instruction breakRecord(const Instruction &ins);
+	    
+	    //not copyable, each cpu owns its block cache and translations
+	    Chip8 (const Chip8 &);
+	    Chip8 &operator=(const Chip8 &);
+	    
+	    //fill in every entry of the dispatch table
+	    static void buildDispatchTable(Instruction *table);
+	    
+	    //dispatch table with the handlers that depend on Quirks(see Chip8.cpp) built for it
+	    template<class Quirks> static const Instruction *profileTable();
+	    
+	    /**
+	    * RAM, one pointer per page. A page points into image until the first
+	    * write to it, then at this cpu's own copy in owned.
+	    */
+	    const BYTE *pages[NUM_PAGES];
+	    
+	    //copies of written pages, kept across init() so they can be reused
+	    BYTE *owned[NUM_PAGES];
+	    
+	    //image the unwritten pages point into
+	    std::shared_ptr<const RomImage> image;
+	    
+	    //RAM image with only the font, loaded by init()
+	    static const std::shared_ptr<const RomImage> &defaultImage();
+	    
+	    //give a page its own copy before it is written
+	    BYTE *ownPage(int page);
+	    
+	    //drop cached blocks and translations decoded from address
+	    void invalidateCode(unsigned short address);
+	    
+	    //dirty rows of the last DIRTY_HISTORY frames, indexed by frame % DIRTY_HISTORY
+	    uint32_t dirtyHistory[DIRTY_HISTORY];
+	    
+	    //cycle() without resetting cycleLimit, for run() and its engines
+	    void step();
+	    
+	    //move PC on by bytes, wrapping around at the end of RAM
+	    void advance(unsigned short bytes)
+	    {
+	        this->PC = (this->PC + bytes) & (RAM_SIZE - 1);
+	    }
+	    
+	    //move cycles past passes of a delay timer wait loop starting at PC
+	    void skipDelayLoop();
+	    
+	    //true if a delay timer wait loop(see skipDelayLoop) starts at address
+	    bool delayLoopAt(unsigned short address) const;
+	    
+	    //splitmix64 finalizer
+	    static uint64_t mix64(uint64_t z)
+	    {
+	        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	        return z ^ (z >> 31);
+	    }
+	    
+	    //Zobrist key of value at a RAM address. 0 for 0, so empty RAM hashes to 0
+	    static uint64_t ramKey(unsigned short address, BYTE value)
+	    {
+	        return value == 0 ? 0 : mix64(((uint64_t)address << 8 | value) + 0x9E3779B97F4A7C15ULL);
+	    }
+	    
+	    //Zobrist key of a display row. 0 for a blank row
+	    static uint64_t rowKey(int y, uint64_t row)
+	    {
+	        return row == 0 ? 0 : mix64(row ^ mix64(y + 0xD1B54A32D192ED03ULL));
+	    }
 	    
+	    //value of a timer set to value at cycle setAt, as of now
+	    BYTE timerValue(BYTE value, unsigned long long setAt) const
+	    {
+	        unsigned long long ticks = this->cycles / CYCLES_PER_FRAME - setAt / CYCLES_PER_FRAME;
+	        return ticks >= value ? 0 : value - ticks;
+	    }
 	    
+	    //cycle at which a timer set to value at cycle setAt reaches 0
+	    static unsigned long long timerExpiry(BYTE value, unsigned long long setAt)
+	    {
+	        return (setAt / CYCLES_PER_FRAME + value) * CYCLES_PER_FRAME;
+	    }
 };
 
 #endif
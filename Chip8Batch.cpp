@@ -0,0 +1,415 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Chip8Batch.h"
+#include <cstring>
+
+typedef unsigned char BYTE;
+
+/**
+* 16 lanes of bytes. SSE2 when the compiler has it, which every x86-64
+* target does, plain loops otherwise.
+*/
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+typedef __m128i Vec;
+
+static inline Vec load(const BYTE *p)          { return _mm_load_si128((const __m128i *)p); }
+static inline void save(BYTE *p, Vec v)        { _mm_store_si128((__m128i *)p, v); }
+static inline Vec splat(BYTE b)                { return _mm_set1_epi8((char)b); }
+static inline Vec add(Vec a, Vec b)            { return _mm_add_epi8(a, b); }
+static inline Vec sub(Vec a, Vec b)            { return _mm_sub_epi8(a, b); }
+static inline Vec bitOr(Vec a, Vec b)          { return _mm_or_si128(a, b); }
+static inline Vec bitAnd(Vec a, Vec b)         { return _mm_and_si128(a, b); }
+static inline Vec bitXor(Vec a, Vec b)         { return _mm_xor_si128(a, b); }
+static inline Vec equal(Vec a, Vec b)          { return _mm_cmpeq_epi8(a, b); }
+static inline Vec maxUnsigned(Vec a, Vec b)    { return _mm_max_epu8(a, b); }
+
+//mask ? b : a, mask lanes are 0x00 or 0xFF
+static inline Vec select(Vec mask, Vec a, Vec b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+}
+#else
+struct Vec { BYTE b[16]; };
+
+#define LANEWISE(expr) Vec r; for(int i = 0; i < 16; i++) r.b[i] = (expr); return r;
+
+static inline Vec load(const BYTE *p)          { LANEWISE(p[i]) }
+static inline void save(BYTE *p, Vec v)        { for(int i = 0; i < 16; i++) p[i] = v.b[i]; }
+static inline Vec splat(BYTE b)                { LANEWISE(b) }
+static inline Vec add(Vec a, Vec b)            { LANEWISE(a.b[i] + b.b[i]) }
+static inline Vec sub(Vec a, Vec b)            { LANEWISE(a.b[i] - b.b[i]) }
+static inline Vec bitOr(Vec a, Vec b)          { LANEWISE(a.b[i] | b.b[i]) }
+static inline Vec bitAnd(Vec a, Vec b)         { LANEWISE(a.b[i] & b.b[i]) }
+static inline Vec bitXor(Vec a, Vec b)         { LANEWISE(a.b[i] ^ b.b[i]) }
+static inline Vec equal(Vec a, Vec b)          { LANEWISE(a.b[i] == b.b[i] ? 0xFF : 0x00) }
+static inline Vec maxUnsigned(Vec a, Vec b)    { LANEWISE(a.b[i] > b.b[i] ? a.b[i] : b.b[i]) }
+static inline Vec select(Vec mask, Vec a, Vec b) { LANEWISE(mask.b[i] ? b.b[i] : a.b[i]) }
+
+#undef LANEWISE
+#endif
+
+//0xFF in lanes where a > b, unsigned
+static inline Vec greater(Vec a, Vec b)
+{
+    Vec notEqual = bitXor(equal(a, b), splat(0xFF));
+    return bitAnd(equal(maxUnsigned(a, b), a), notEqual);
+}
+
+Chip8Batch::Chip8Batch()
+{
+    this->vectorSteps = 0;
+    this->scalarSteps = 0;
+    this->gather();
+}
+
+void Chip8Batch::gatherLane(int lane)
+{
+    const Chip8 &cpu = this->lanes[lane];
+
+    for(int r = 0; r < NUM_REGISTERS; r++)
+    {
+        this->V[r][lane] = cpu.V[r];
+    }
+    this->PC[lane] = cpu.PC;
+    this->I[lane] = cpu.I;
+}
+
+void Chip8Batch::scatterLane(int lane)
+{
+    Chip8 &cpu = this->lanes[lane];
+
+    for(int r = 0; r < NUM_REGISTERS; r++)
+    {
+        cpu.V[r] = this->V[r][lane];
+    }
+    cpu.PC = this->PC[lane];
+    cpu.I = this->I[lane];
+}
+
+void Chip8Batch::gather()
+{
+    for(int i = 0; i < LANES; i++)
+    {
+        this->gatherLane(i);
+    }
+}
+
+void Chip8Batch::scatter()
+{
+    for(int i = 0; i < LANES; i++)
+    {
+        this->scatterLane(i);
+    }
+}
+
+unsigned long Chip8Batch::run(unsigned long count)
+{
+    const Chip8::Instruction *defaults = Chip8::dispatchTable();
+
+    //cycles run by each lane, and whether it still has cycles left to run
+    unsigned long done[LANES];
+    bool active[LANES];
+
+    //vector ops are only used when every lane has the default handlers
+    bool vectorizable = true;
+
+    //while every lane has the same RAM, the leader's opcode is everyone's opcode
+    bool sharedCode = true;
+
+    unsigned long total = 0;
+
+    for(int i = 0; i < LANES; i++)
+    {
+        Chip8 &cpu = this->lanes[i];
+
+        done[i] = 0;
+        active[i] = count > 0 && cpu.status == Chip8::RUNNING;
+
+        //blocked on a key, the cycles still go by, as they do in Chip8::run
+        if(cpu.status == Chip8::WAITING_KEY)
+        {
+            cpu.cycles += count;
+            total += count;
+        }
+
+        if(cpu.table != defaults)
+            vectorizable = false;
+
+        if(!cpu.sameRam(this->lanes[0]))
+            sharedCode = false;
+    }
+
+    for(;;)
+    {
+        //the lane furthest behind decides what runs next
+        int leader = -1;
+        for(int i = 0; i < LANES; i++)
+        {
+            if(active[i] && (leader < 0 || done[i] < done[leader]))
+                leader = i;
+        }
+
+        if(leader < 0)
+            break;
+
+        unsigned short pc = this->PC[leader] & 0x0FFF;
+        const Chip8 &code = this->lanes[leader];
+
+        //the group: every lane at the same PC running the same opcode
+        BYTE mask[LANES] __attribute__((aligned(16)));
+        unsigned long limit = count;
+        for(int i = 0; i < LANES; i++)
+        {
+            bool member = active[i] && (this->PC[i] & 0x0FFF) == pc;
+
+            if(member && !sharedCode)
+            {
+                const Chip8 &cpu = this->lanes[i];
+                member = cpu.read(pc) == code.read(pc) && cpu.read(pc + 1) == code.read(pc + 1);
+            }
+
+            mask[i] = member ? 0xFF : 0x00;
+            if(member && count - done[i] < limit)
+                limit = count - done[i];
+        }
+
+        //without shared code every lane's opcode has to be checked again each step
+        if(!sharedCode)
+            limit = 1;
+
+        /**
+        * Run the group with vector ops for as long as it stays together: until a
+        * skip splits it, a jump(where other lanes may join), an instruction
+        * with no vector form, or the end of the budget of one of its lanes.
+        */
+        unsigned long steps = 0;
+        bool split = false;
+        while(vectorizable && steps < limit)
+        {
+            unsigned short opcode = (code.read(pc) << 8) | code.read(pc + 1);
+            const Chip8::Instruction &ins = defaults[opcode];
+
+            BYTE skip[LANES] __attribute__((aligned(16)));
+            Step step = this->vectorStep(ins, mask, skip);
+            if(step == NOT_VECTOR)
+                break;
+
+            ++steps;
+
+            if(step == NEXT)
+            {
+                pc = (pc + 2) & 0x0FFF;
+                continue;
+            }
+
+            if(step == JUMP)
+            {
+                pc = ins.nnn;
+                break;
+            }
+
+            //a skip keeps the group together only if every lane made the same choice
+            bool all = true;
+            bool none = true;
+            for(int i = 0; i < LANES; i++)
+            {
+                if(mask[i])
+                {
+                    all = all && skip[i];
+                    none = none && !skip[i];
+                }
+            }
+
+            if(all || none)
+            {
+                pc = (pc + (all ? 4 : 2)) & 0x0FFF;
+                continue;
+            }
+
+            for(int i = 0; i < LANES; i++)
+            {
+                if(mask[i])
+                    this->PC[i] = (pc + (skip[i] ? 4 : 2)) & 0x0FFF;
+            }
+            split = true;
+            break;
+        }
+
+        if(steps > 0)
+        {
+            this->vectorSteps += steps;
+
+            for(int i = 0; i < LANES; i++)
+            {
+                if(!mask[i])
+                    continue;
+
+                if(!split)
+                    this->PC[i] = pc;
+                this->lanes[i].cycles += steps;
+            }
+        }
+        else
+        {
+            //no vector form, run it on each lane on its own
+            steps = 1;
+            for(int i = 0; i < LANES; i++)
+            {
+                if(!mask[i])
+                    continue;
+
+                this->scatterLane(i);
+                this->lanes[i].cycle();
+                this->gatherLane(i);
+                ++this->scalarSteps;
+
+                if(this->lanes[i].status != Chip8::RUNNING)
+                    active[i] = false;
+            }
+
+            //LD B, Vx and LD [I], Vx can leave the lanes with different RAM
+            if(code.read(pc) >= 0xF0 && (code.read(pc + 1) == 0x33 || code.read(pc + 1) == 0x55))
+                sharedCode = false;
+        }
+
+        for(int i = 0; i < LANES; i++)
+        {
+            if(mask[i])
+            {
+                total += steps;
+                done[i] += steps;
+                if(done[i] >= count)
+                    active[i] = false;
+            }
+        }
+    }
+
+    this->scatter();
+    return total;
+}
+
+Chip8Batch::Step Chip8Batch::vectorStep(const Chip8::Instruction &ins, const BYTE *mask, BYTE *skip)
+{
+    const Vec m = load(mask);
+    BYTE *vx = this->V[ins.x];
+    BYTE *vy = this->V[ins.y];
+    BYTE *vf = this->V[0x0F];
+    const Vec one = splat(1);
+
+    switch(ins.opcode & 0xF000)
+    {
+        //1nnn - JP addr
+        case 0x1000:
+        return JUMP;
+
+        //Annn - LD I, addr
+        case 0xA000:
+            for(int i = 0; i < LANES; i++)
+            {
+                if(mask[i])
+                    this->I[i] = ins.nnn;
+            }
+        return NEXT;
+
+        //3xkk - SE Vx, byte
+        case 0x3000:
+            save(skip, equal(load(vx), splat(ins.kk)));
+        return SKIP;
+
+        //4xkk - SNE Vx, byte
+        case 0x4000:
+            save(skip, bitXor(equal(load(vx), splat(ins.kk)), splat(0xFF)));
+        return SKIP;
+
+        //5xy0 - SE Vx, Vy
+        case 0x5000:
+            if(ins.n != 0)
+                return NOT_VECTOR;
+            save(skip, equal(load(vx), load(vy)));
+        return SKIP;
+
+        //9xy0 - SNE Vx, Vy
+        case 0x9000:
+            if(ins.n != 0)
+                return NOT_VECTOR;
+            save(skip, bitXor(equal(load(vx), load(vy)), splat(0xFF)));
+        return SKIP;
+
+        //6xkk - LD Vx, byte
+        case 0x6000:
+            save(vx, select(m, load(vx), splat(ins.kk)));
+        break;
+
+        //7xkk - ADD Vx, byte
+        case 0x7000:
+            save(vx, select(m, load(vx), add(load(vx), splat(ins.kk))));
+        break;
+
+        case 0x8000:
+            switch(ins.n)
+            {
+                //8xy0 - LD Vx, Vy
+                case 0x0:
+                    save(vx, select(m, load(vx), load(vy)));
+                break;
+
+                //8xy1 - OR Vx, Vy
+                case 0x1:
+                    save(vx, select(m, load(vx), bitOr(load(vx), load(vy))));
+                break;
+
+                //8xy2 - AND Vx, Vy
+                case 0x2:
+                    save(vx, select(m, load(vx), bitAnd(load(vx), load(vy))));
+                break;
+
+                //8xy3 - XOR Vx, Vy
+                case 0x3:
+                    save(vx, select(m, load(vx), bitXor(load(vx), load(vy))));
+                break;
+
+                //8xy4 - ADD Vx, Vy. Carry when the sum wrapped below Vx.
+                //VF is written first, then Vx, like ADD8
+                case 0x4:
+                {
+                    Vec a = load(vx);
+                    Vec sum = add(a, load(vy));
+                    Vec carry = bitXor(equal(maxUnsigned(sum, a), sum), splat(0xFF));
+                    save(vf, select(m, load(vf), bitAnd(carry, one)));
+                    save(vx, select(m, load(vx), sum));
+                }
+                break;
+
+                //8xy5 - SUB Vx, Vy. VF = Vx > Vy, then Vx and Vy are read again like SUB8
+                case 0x5:
+                {
+                    Vec flag = greater(load(vx), load(vy));
+                    save(vf, select(m, load(vf), bitAnd(flag, one)));
+                    save(vx, select(m, load(vx), sub(load(vx), load(vy))));
+                }
+                break;
+
+                //8xy7 - SUBN Vx, Vy. VF = Vy > Vx, then Vx = Vy - Vx like SUBN
+                case 0x7:
+                {
+                    Vec flag = greater(load(vy), load(vx));
+                    save(vf, select(m, load(vf), bitAnd(flag, one)));
+                    save(vx, select(m, load(vx), sub(load(vy), load(vx))));
+                }
+                break;
+
+                default:
+                    return NOT_VECTOR;
+            }
+        break;
+
+        default:
+            return NOT_VECTOR;
+    }
+
+    return NEXT;
+}
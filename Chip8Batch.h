@@ -0,0 +1,97 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef CHIP8BATCH_HH
+#define CHIP8BATCH_HH
+
+#include "Chip8.h"
+
+/**
+* Runs LANES instances of Chip8 in lockstep.
+*
+* The registers of all lanes are kept in structure-of-arrays form: V0 of
+* every lane packed together, then V1, and so on, with PC and I the same way.
+* Each step picks the lane that is furthest behind and runs the instruction
+* at its PC on the group of lanes that are at the same PC with the same
+* opcode, for as long as that group stays together.
+* LD/ADD Vx, byte, the 8xyN ALU ops(except the shifts), the register
+* skips, JP and LD I are done across all those lanes at once with SSE2,
+* masked so that lanes at a different PC are left alone. Any other
+* instruction is run on each lane's own Chip8 with the normal handlers.
+*
+* Lanes that diverge(ex. after a RND) are stepped in groups by PC and fall
+* back into a single group once their PCs meet again.
+*/
+class Chip8Batch
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    //number of instances run together, one per byte of an SSE register
+	    static const int LANES = 16;
+
+	    Chip8Batch ();
+
+	    /**
+	    * Instance for a lane. Load programs, seeds and input through it.
+	    * Call gather() after changing its registers directly.
+	    */
+	    Chip8 &lane(int i) { return this->lanes[i]; }
+
+	    //copy the registers of every lane into the batch
+	    void gather();
+
+	    //copy the registers held by the batch back into every lane
+	    void scatter();
+
+	    /**
+	    * Run up to count cycles on every lane. A lane stops early if it traps
+	    * or starts waiting for a key. One that was already waiting for a key
+	    * lets the count cycles go by, like Chip8::run.
+	    * Registers are scattered back to the lanes before returning.
+	    * Returns the total number of cycles run over all lanes.
+	    */
+	    unsigned long run(unsigned long count);
+
+	    //number of vector steps and per-lane scalar steps taken so far
+	    unsigned long vectorSteps;
+	    unsigned long scalarSteps;
+
+	private:
+	    static const int NUM_REGISTERS = 16;
+
+	    //V[r][lane]
+	    BYTE V[NUM_REGISTERS][LANES] __attribute__((aligned(16)));
+	    unsigned short PC[LANES];
+	    unsigned short I[LANES];
+
+	    Chip8 lanes[LANES];
+
+	    void gatherLane(int lane);
+	    void scatterLane(int lane);
+
+	    //how a vector step moves the PC of the lanes it ran on
+	    enum Step
+	    {
+	        //no vector form, nothing was run
+	        NOT_VECTOR,
+
+	        //PC += 2
+	        NEXT,
+
+	        //PC = nnn
+	        JUMP,
+
+	        //PC += 4 where skip is set, PC += 2 elsewhere
+	        SKIP
+	    };
+
+	    /**
+	    * Run ins on the lanes set in mask with vector ops. PC is left to the
+	    * caller. For a SKIP, the lanes that skip are set in skip.
+	    */
+	    Step vectorStep(const Chip8::Instruction &ins, const BYTE *mask, BYTE *skip);
+};
+
+#endif
@@ -0,0 +1,310 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Debugger.h"
+
+Debugger::Debugger()
+{
+    this->cpu = NULL;
+    this->reason = NONE;
+    this->address = 0;
+    this->which = -1;
+    this->stops = 0;
+    this->activeConditions = 0;
+    this->stepOver = -1;
+    this->stepOverCycle = 0;
+
+    for(int i = 0; i < RAM_SIZE / 32; i++)
+    {
+        this->breakpoints[i] = 0;
+    }
+}
+
+Debugger::~Debugger()
+{
+    this->detach();
+}
+
+void Debugger::attach(Chip8 &cpu)
+{
+    this->detach();
+
+    this->cpu = &cpu;
+    cpu.debugger = this;
+    this->reason = NONE;
+    this->stops = 0;
+    this->stepOver = -1;
+
+    //blocks decoded so far have no breakpoints in them
+    cpu.flushBlocks();
+    this->updatePages();
+
+    for(size_t i = 0; i < this->conditions.size(); i++)
+    {
+        this->conditions[i].held = this->holds(this->conditions[i]);
+    }
+}
+
+void Debugger::detach()
+{
+    if(this->cpu == NULL)
+        return;
+
+    Chip8 &cpu = *this->cpu;
+    cpu.debugger = NULL;
+    cpu.readWatches = 0;
+    cpu.writeWatches = 0;
+
+    //take the breakpoint records out of its blocks
+    cpu.flushBlocks();
+
+    if(cpu.status == Chip8::BREAK)
+        cpu.status = Chip8::RUNNING;
+
+    this->cpu = NULL;
+}
+
+void Debugger::addBreakpoint(unsigned short address)
+{
+    address &= RAM_SIZE - 1;
+    this->breakpoints[address >> 5] |= 1u << (address & 31);
+    this->redecode(address);
+}
+
+void Debugger::removeBreakpoint(unsigned short address)
+{
+    address &= RAM_SIZE - 1;
+    this->breakpoints[address >> 5] &= ~(1u << (address & 31));
+    this->redecode(address);
+}
+
+int Debugger::watch(unsigned short address, unsigned short length, bool reads, bool writes)
+{
+    Watch watch;
+    watch.start = address & (RAM_SIZE - 1);
+    watch.length = length > RAM_SIZE ? RAM_SIZE : length;
+    watch.reads = reads;
+    watch.writes = writes;
+    watch.used = true;
+
+    int id = this->watches.size();
+    for(size_t i = 0; i < this->watches.size(); i++)
+    {
+        if(!this->watches[i].used)
+        {
+            id = i;
+            break;
+        }
+    }
+
+    if(id == (int)this->watches.size())
+        this->watches.push_back(watch);
+    else
+        this->watches[id] = watch;
+
+    this->updatePages();
+    return id;
+}
+
+void Debugger::unwatch(int id)
+{
+    if(id < 0 || id >= (int)this->watches.size())
+        return;
+
+    this->watches[id].used = false;
+    this->updatePages();
+}
+
+int Debugger::breakWhen(int reg, Compare compare, unsigned short value)
+{
+    Condition condition;
+    condition.reg = reg;
+    condition.compare = compare;
+    condition.value = value;
+    condition.used = true;
+
+    //already true when it is added, it waits until it turns false first
+    condition.held = this->cpu != NULL && this->holds(condition);
+
+    int id = this->conditions.size();
+    for(size_t i = 0; i < this->conditions.size(); i++)
+    {
+        if(!this->conditions[i].used)
+        {
+            id = i;
+            break;
+        }
+    }
+
+    if(id == (int)this->conditions.size())
+        this->conditions.push_back(condition);
+    else
+        this->conditions[id] = condition;
+
+    ++this->activeConditions;
+    return id;
+}
+
+void Debugger::removeCondition(int id)
+{
+    if(id < 0 || id >= (int)this->conditions.size() || !this->conditions[id].used)
+        return;
+
+    this->conditions[id].used = false;
+    --this->activeConditions;
+}
+
+void Debugger::clear()
+{
+    for(int i = 0; i < RAM_SIZE / 32; i++)
+    {
+        this->breakpoints[i] = 0;
+    }
+
+    this->watches.clear();
+    this->conditions.clear();
+    this->activeConditions = 0;
+
+    if(this->cpu != NULL)
+        this->cpu->flushBlocks();
+    this->updatePages();
+}
+
+void Debugger::resume()
+{
+    if(this->cpu == NULL || this->cpu->status != Chip8::BREAK)
+        return;
+
+    //the breakpoint record at PC runs the instruction instead of stopping again
+    if(this->reason == BREAKPOINT)
+    {
+        this->stepOver = this->cpu->PC;
+        this->stepOverCycle = this->cpu->cycles;
+    }
+
+    this->cpu->status = Chip8::RUNNING;
+}
+
+void Debugger::stop(Reason reason, unsigned short address, int which)
+{
+    //the first thing an instruction hits is the one reported
+    if(this->cpu->status != Chip8::RUNNING)
+        return;
+
+    this->cpu->status = Chip8::BREAK;
+    this->reason = reason;
+    this->address = address;
+    this->which = which;
+    ++this->stops;
+}
+
+void Debugger::read(unsigned short address, int length)
+{
+    for(int k = 0; k < length; k++)
+    {
+        unsigned short a = (address + k) & (RAM_SIZE - 1);
+        if(!(this->cpu->readWatches & (1u << (a / PAGE_SIZE))))
+            continue;
+
+        for(size_t i = 0; i < this->watches.size(); i++)
+        {
+            const Watch &watch = this->watches[i];
+            if(watch.used && watch.reads && ((a - watch.start) & (RAM_SIZE - 1)) < watch.length)
+            {
+                this->stop(READ_WATCH, a, i);
+                return;
+            }
+        }
+    }
+}
+
+void Debugger::written(unsigned short address)
+{
+    for(size_t i = 0; i < this->watches.size(); i++)
+    {
+        const Watch &watch = this->watches[i];
+        if(watch.used && watch.writes && ((address - watch.start) & (RAM_SIZE - 1)) < watch.length)
+        {
+            this->stop(WRITE_WATCH, address, i);
+            return;
+        }
+    }
+}
+
+bool Debugger::checkConditions()
+{
+    bool stopped = false;
+
+    //every condition is updated, even after one stops the cpu, so none of them fires late
+    for(size_t i = 0; i < this->conditions.size(); i++)
+    {
+        Condition &condition = this->conditions[i];
+        if(!condition.used)
+            continue;
+
+        bool held = this->holds(condition);
+        if(held && !condition.held && !stopped)
+        {
+            this->stop(CONDITION, this->cpu->PC, i);
+            stopped = true;
+        }
+        condition.held = held;
+    }
+
+    return stopped;
+}
+
+bool Debugger::holds(const Condition &condition) const
+{
+    unsigned short value = condition.reg == REGISTER_I ? this->cpu->I : this->cpu->V[condition.reg & 0xF];
+
+    switch(condition.compare)
+    {
+        case EQUAL:     return value == condition.value;
+        case NOT_EQUAL: return value != condition.value;
+        case LESS:      return value < condition.value;
+        case GREATER:   return value > condition.value;
+    }
+
+    return false;
+}
+
+void Debugger::updatePages()
+{
+    if(this->cpu == NULL)
+        return;
+
+    unsigned int reads = 0;
+    unsigned int writes = 0;
+
+    for(size_t i = 0; i < this->watches.size(); i++)
+    {
+        const Watch &watch = this->watches[i];
+        if(!watch.used || watch.length == 0)
+            continue;
+
+        //every page the range touches, wrapping at the end of RAM
+        unsigned int pages = 0;
+        int first = watch.start / PAGE_SIZE;
+        int last = (watch.start + watch.length - 1) / PAGE_SIZE;
+        for(int p = first; p <= last; p++)
+        {
+            pages |= 1u << (p % (RAM_SIZE / PAGE_SIZE));
+        }
+
+        if(watch.reads)
+            reads |= pages;
+        if(watch.writes)
+            writes |= pages;
+    }
+
+    this->cpu->readWatches = reads;
+    this->cpu->writeWatches = writes;
+}
+
+void Debugger::redecode(unsigned short address)
+{
+    if(this->cpu != NULL)
+        this->cpu->invalidateCode(address);
+}
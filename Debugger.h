@@ -0,0 +1,180 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef DEBUGGER_HH
+#define DEBUGGER_HH
+
+#include "Chip8.h"
+#include <vector>
+
+/**
+* Breakpoints, watchpoints and register conditions for one cpu.
+*
+* Once attached, the cpu stops with status BREAK when one is hit, and
+* reason, address and which say what it was:
+*   - a PC breakpoint stops before the instruction at it runs. Breakpoints
+*     are decoded into the cpu's blocks as records that stop it, so nothing
+*     compares PC while running.
+*   - a watchpoint stops after the instruction that read or wrote a byte in
+*     its range. Writes are every RAM write(LD B, LD [I] and anything else
+*     going through Chip8::store), reads are LD Vx, [I] and sprite data read
+*     by DRW. Instruction fetches are not reads, use a breakpoint for those.
+*   - a condition stops after the instruction that makes it true. It has to
+*     turn false again before it can stop the cpu a second time.
+*
+* While a debugger is attached, Chip8::run and Chip8::cycle run decoded
+* blocks whatever the engine and look at status after every instruction.
+* An unattached cpu only pays for a test of an empty page bitmap on each
+* RAM write, LD Vx, [I] and DRW, and one pointer test per run() or cycle().
+*
+* Chip8Batch runs the instructions it has vector forms for on its lanes
+* without going through run() or cycle(), so only watchpoints(which are
+* tested on the RAM accesses themselves) work on a lane. Debug a cpu on its
+* own instead.
+*/
+class Debugger
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    //why the cpu last stopped
+	    enum Reason
+	    {
+	        NONE,
+	        BREAKPOINT,
+	        READ_WATCH,
+	        WRITE_WATCH,
+	        CONDITION
+	    };
+
+	    enum Compare
+	    {
+	        EQUAL,
+	        NOT_EQUAL,
+	        LESS,
+	        GREATER
+	    };
+
+	    //register number of I for breakWhen(). 0-F are V0-VF
+	    static const int REGISTER_I = 16;
+
+	    Debugger ();
+
+	    //detaches if still attached
+	    ~Debugger ();
+
+	    //start debugging cpu. A cpu has at most one debugger
+	    void attach(Chip8 &cpu);
+
+	    //stop debugging. A cpu stopped at a break is set running again
+	    void detach();
+
+	    bool attached() const { return this->cpu != NULL; }
+
+	    //stop before the instruction at address runs
+	    void addBreakpoint(unsigned short address);
+	    void removeBreakpoint(unsigned short address);
+
+	    bool breakpointAt(unsigned short address) const
+	    {
+	        address &= RAM_SIZE - 1;
+	        return (this->breakpoints[address >> 5] >> (address & 31)) & 1;
+	    }
+
+	    /**
+	    * Stop after an instruction reads and/or writes any of the length bytes
+	    * from address. Returns an id for unwatch().
+	    */
+	    int watch(unsigned short address, unsigned short length, bool reads, bool writes);
+	    void unwatch(int id);
+
+	    /**
+	    * Stop when register(0-F for Vx, REGISTER_I for I) compared to value
+	    * becomes true. Returns an id for removeCondition().
+	    */
+	    int breakWhen(int reg, Compare compare, unsigned short value);
+	    void removeCondition(int id);
+
+	    //remove every breakpoint, watchpoint and condition
+	    void clear();
+
+	    /**
+	    * Set a cpu stopped at a break running again. Stopped at a PC
+	    * breakpoint, the instruction under it runs once before it can stop
+	    * the cpu again.
+	    */
+	    void resume();
+
+	    //last stop: its reason, the PC or RAM address hit, and the watch or condition id
+	    Reason reason;
+	    unsigned short address;
+	    int which;
+
+	    //stops since attach()
+	    unsigned long stops;
+
+	private:
+	    friend class Chip8;
+
+	    static const int RAM_SIZE = 4096;
+	    static const int PAGE_SIZE = RomImage::PAGE_SIZE;
+
+	    struct Watch
+	    {
+	        unsigned short start;
+	        unsigned short length;
+	        bool reads;
+	        bool writes;
+	        bool used;
+	    };
+
+	    struct Condition
+	    {
+	        int reg;
+	        Compare compare;
+	        unsigned short value;
+
+	        //true as of the last instruction, so it only stops the cpu when it turns true
+	        bool held;
+	        bool used;
+	    };
+
+	    Chip8 *cpu;
+
+	    //one bit per RAM address with a breakpoint
+	    unsigned int breakpoints[RAM_SIZE / 32];
+
+	    std::vector<Watch> watches;
+	    std::vector<Condition> conditions;
+	    int activeConditions;
+
+	    //PC of the breakpoint resume() steps over, -1 for none, and the cycle it
+	    //was resumed at. Stopping at a breakpoint takes no time, so the cpu is
+	    //still at that cycle when it gets there, unless it was moved some other way
+	    int stepOver;
+	    unsigned long long stepOverCycle;
+
+	    //stop the cpu for reason
+	    void stop(Reason reason, unsigned short address, int which);
+
+	    //called by Chip8 when a watched page is read or written
+	    void read(unsigned short address, int length);
+	    void written(unsigned short address);
+
+	    //called by Chip8 after each instruction while there are conditions. True if one stopped the cpu
+	    bool checkConditions();
+
+	    bool holds(const Condition &condition) const;
+
+	    //put the watched pages into the cpu's bitmaps
+	    void updatePages();
+
+	    //drop the cpu's blocks decoded from address so breakpoints are decoded in or out
+	    void redecode(unsigned short address);
+
+	    Debugger (const Debugger &);
+	    Debugger &operator=(const Debugger &);
+};
+
+#endif
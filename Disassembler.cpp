@@ -0,0 +1,102 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Disassembler.h"
+#include <stdio.h>
+
+Disassembler::Disassembler()
+{
+}
+
+void Disassembler::disassembleOpcode(const BYTE *buffer, int pc)
+{
+    unsigned short opcode = buffer[pc] << 8 | buffer[pc + 1];
+
+    //operands, named like the comments in Chip8.h
+    unsigned short nnn = opcode & 0x0FFF;
+    int x = (opcode & 0x0F00) >> 8;
+    int y = (opcode & 0x00F0) >> 4;
+    int n = opcode & 0x000F;
+    int kk = opcode & 0x00FF;
+
+    printf("%04x %02x %02x  ", pc, buffer[pc], buffer[pc + 1]);
+
+    switch(opcode & 0xF000)
+    {
+        case 0x0000:
+            if(opcode == 0x00E0)
+                printf("CLS");
+            else if(opcode == 0x00EE)
+                printf("RET");
+            else
+                printf("SYS  %03x", nnn);
+        return;
+
+        case 0x1000: printf("JP   %03x", nnn); return;
+        case 0x2000: printf("CALL %03x", nnn); return;
+        case 0x3000: printf("SE   V%X, %02x", x, kk); return;
+        case 0x4000: printf("SNE  V%X, %02x", x, kk); return;
+
+        case 0x5000:
+            if(n != 0x0)
+                break;
+            printf("SE   V%X, V%X", x, y);
+        return;
+
+        case 0x6000: printf("LD   V%X, %02x", x, kk); return;
+        case 0x7000: printf("ADD  V%X, %02x", x, kk); return;
+
+        case 0x8000:
+        {
+            static const char *const NAMES[16] =
+            {
+                "LD", "OR", "AND", "XOR", "ADD", "SUB", "SHR", "SUBN",
+                NULL, NULL, NULL, NULL, NULL, NULL, "SHL", NULL
+            };
+
+            if(NAMES[n] == NULL)
+                break;
+            printf("%-4s V%X, V%X", NAMES[n], x, y);
+        }
+        return;
+
+        case 0x9000:
+            if(n != 0x0)
+                break;
+            printf("SNE  V%X, V%X", x, y);
+        return;
+
+        case 0xA000: printf("LD   I, %03x", nnn); return;
+        case 0xB000: printf("JP   V0, %03x", nnn); return;
+        case 0xC000: printf("RND  V%X, %02x", x, kk); return;
+        case 0xD000: printf("DRW  V%X, V%X, %X", x, y, n); return;
+
+        case 0xE000:
+            if(kk == 0x9E)
+                printf("SKP  V%X", x);
+            else if(kk == 0xA1)
+                printf("SKNP V%X", x);
+            else
+                break;
+        return;
+
+        case 0xF000:
+            switch(kk)
+            {
+                case 0x07: printf("LD   V%X, DT", x); return;
+                case 0x0A: printf("LD   V%X, K", x); return;
+                case 0x15: printf("LD   DT, V%X", x); return;
+                case 0x18: printf("LD   ST, V%X", x); return;
+                case 0x1E: printf("ADD  I, V%X", x); return;
+                case 0x29: printf("LD   F, V%X", x); return;
+                case 0x33: printf("LD   B, V%X", x); return;
+                case 0x55: printf("LD   [I], V%X", x); return;
+                case 0x65: printf("LD   V%X, [I]", x); return;
+            }
+        break;
+    }
+
+    //not an instruction, most likely sprite data
+    printf("DW   %04x", opcode);
+}
@@ -0,0 +1,28 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef DISASSEMBLER_HH
+#define DISASSEMBLER_HH
+
+/**
+* Prints Chip-8 instructions in the mnemonics used by the comments in
+* Chip8.h, one per call. Anything that is not an instruction is printed as
+* a data word.
+*/
+class Disassembler
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    Disassembler ();
+
+	    /**
+	    * Print the address, the two opcode bytes and the instruction at pc
+	    * in buffer, without a newline. buffer holds a whole memory image,
+	    * so pc is an address rather than an offset into the program.
+	    */
+	    void disassembleOpcode(const BYTE *buffer, int pc);
+};
+
+#endif
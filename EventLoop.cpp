@@ -0,0 +1,145 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "EventLoop.h"
+
+void EventLoop::KeyPress::await_suspend(std::coroutine_handle<> handle)
+{
+    this->handle = handle;
+    this->loop->keyWaiters[this->cpu] = this;
+}
+
+void EventLoop::TimerExpiry::await_suspend(std::coroutine_handle<> handle)
+{
+    //timers only tick on frame boundaries, so round up to the frame it happens in
+    unsigned long long left = this->cpu->nextTimerExpiry() - this->cpu->cycles;
+    unsigned long frames = (left + Chip8::CYCLES_PER_FRAME - 1) / Chip8::CYCLES_PER_FRAME;
+
+    Sleeper sleeper;
+    sleeper.frame = this->loop->frame + (frames > 0 ? frames : 1);
+    sleeper.handle = handle;
+    this->loop->sleepers.push(sleeper);
+}
+
+EventLoop::EventLoop()
+{
+    this->frame = 0;
+    this->switches = 0;
+}
+
+void EventLoop::spawn(Chip8Task &&task)
+{
+    this->nextWaiters.push_back(task.handle);
+    this->tasks.push_back(std::move(task));
+}
+
+bool EventLoop::pressKey(Chip8 &cpu, int key)
+{
+    std::map<Chip8 *, KeyPress *>::iterator it = this->keyWaiters.find(&cpu);
+    if(it == this->keyWaiters.end())
+        return false;
+
+    it->second->key = key & 0xF;
+    this->nextWaiters.push_back(it->second->handle);
+    this->keyWaiters.erase(it);
+
+    return true;
+}
+
+void EventLoop::step()
+{
+    //anything that awaits while being resumed goes on the fresh nextWaiters
+    this->resuming.clear();
+    this->resuming.swap(this->nextWaiters);
+
+    while(!this->sleepers.empty() && this->sleepers.top().frame <= this->frame)
+    {
+        this->resuming.push_back(this->sleepers.top().handle);
+        this->sleepers.pop();
+    }
+
+    bool finished = false;
+    for(size_t i = 0; i < this->resuming.size(); i++)
+    {
+        this->resuming[i].resume();
+        ++this->switches;
+
+        if(this->resuming[i].done())
+            finished = true;
+    }
+
+    if(finished)
+        this->reap();
+
+    ++this->frame;
+}
+
+void EventLoop::run(unsigned long frames)
+{
+    for(unsigned long i = 0; i < frames && !this->tasks.empty(); i++)
+    {
+        this->step();
+    }
+}
+
+size_t EventLoop::live() const
+{
+    return this->tasks.size();
+}
+
+void EventLoop::reap()
+{
+    size_t kept = 0;
+
+    for(size_t i = 0; i < this->tasks.size(); i++)
+    {
+        if(!this->tasks[i].done())
+            this->tasks[kept++] = std::move(this->tasks[i]);
+    }
+
+    this->tasks.resize(kept);
+}
+
+Chip8Task EventLoop::runCpu(EventLoop &loop, Chip8 &cpu, unsigned long frames)
+{
+    unsigned long end = loop.frame + frames;
+
+    while(loop.frame < end && cpu.status != Chip8::TRAPPED)
+    {
+        unsigned long long frameStart = cpu.cycles;
+        unsigned long startFrame = loop.frame;
+
+        if(cpu.status == Chip8::WAITING_KEY || cpu.waitingOnDelay())
+        {
+            int key = -1;
+
+            if(cpu.status == Chip8::WAITING_KEY)
+                key = co_await loop.keyPress(cpu);
+            else
+                co_await loop.timerExpiry(cpu);
+
+            //catch up on the frames slept through. While still waiting for a
+            //key only time passes, a delay loop is skipped over by run()
+            unsigned long upTo = loop.frame < end ? loop.frame : end;
+            cpu.run(frameStart + (upTo - startFrame) * Chip8::CYCLES_PER_FRAME - cpu.cycles);
+            cpu.endFrame();
+
+            if(key >= 0)
+            {
+                cpu.setKey(key, true);
+                cpu.setKey(key, false);
+            }
+            continue;
+        }
+
+        cpu.run(Chip8::CYCLES_PER_FRAME);
+
+        //stopped at a key wait part way through, the rest of the frame still goes by
+        if(cpu.status == Chip8::WAITING_KEY)
+            cpu.run(frameStart + Chip8::CYCLES_PER_FRAME - cpu.cycles);
+
+        cpu.endFrame();
+        co_await loop.nextFrame();
+    }
+}
@@ -0,0 +1,190 @@
+/**
+* Author: Devon Guinane
+*
+* Needs C++20(-std=c++20) for coroutines.
+*/
+
+#ifndef EVENTLOOP_HH
+#define EVENTLOOP_HH
+
+#include "Chip8.h"
+#include <coroutine>
+#include <exception>
+#include <map>
+#include <queue>
+#include <vector>
+
+/**
+* Coroutine that drives one or more Chip8 instances on an EventLoop.
+* Starts suspended; EventLoop::spawn takes it over and first resumes it on
+* the next frame. Destroying the task destroys the coroutine.
+*/
+class Chip8Task
+{
+	public:
+	    struct promise_type
+	    {
+	        Chip8Task get_return_object()
+	        {
+	            return Chip8Task(std::coroutine_handle<promise_type>::from_promise(*this));
+	        }
+
+	        std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+	        std::suspend_always final_suspend() noexcept { return std::suspend_always(); }
+	        void return_void() {}
+	        void unhandled_exception() { std::terminate(); }
+	    };
+
+	    Chip8Task () : handle(NULL) {}
+	    Chip8Task (Chip8Task &&other) : handle(other.handle) { other.handle = NULL; }
+	    ~Chip8Task () { this->destroy(); }
+
+	    Chip8Task &operator=(Chip8Task &&other)
+	    {
+	        if(this != &other)
+	        {
+	            this->destroy();
+	            this->handle = other.handle;
+	            other.handle = NULL;
+	        }
+	        return *this;
+	    }
+
+	    //true once the coroutine has returned
+	    bool done() const { return !this->handle || this->handle.done(); }
+
+	private:
+	    friend class EventLoop;
+
+	    std::coroutine_handle<promise_type> handle;
+
+	    explicit Chip8Task (std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	    void destroy()
+	    {
+	        if(this->handle)
+	            this->handle.destroy();
+	        this->handle = NULL;
+	    }
+
+	    Chip8Task (const Chip8Task &);
+	    Chip8Task &operator=(const Chip8Task &);
+};
+
+/**
+* Runs any number of Chip8Tasks on the calling thread, one 60Hz frame at a
+* time. A task suspends with co_await on one of:
+*
+*   nextFrame()       - resume on the next frame
+*   keyPress(cpu)     - resume once pressKey() gives cpu the key its
+*                       LD Vx, K is waiting for
+*   timerExpiry(cpu)  - resume on the frame cpu's next running timer
+*                       reaches 0. Gives the number of frames that passed
+*
+* A suspended task costs nothing but its slot in a queue, so thousands of
+* instances can share one thread. Nothing here is thread safe.
+*/
+class EventLoop
+{
+	public:
+	    struct NextFrame
+	    {
+	        EventLoop *loop;
+
+	        bool await_ready() const { return false; }
+	        void await_suspend(std::coroutine_handle<> handle) { this->loop->nextWaiters.push_back(handle); }
+	        void await_resume() const {}
+	    };
+
+	    struct KeyPress
+	    {
+	        EventLoop *loop;
+	        Chip8 *cpu;
+
+	        //filled in by pressKey()
+	        int key;
+	        std::coroutine_handle<> handle;
+
+	        //nothing to wait for unless the cpu is blocked on LD Vx, K
+	        bool await_ready() const { return this->cpu->status != Chip8::WAITING_KEY; }
+	        void await_suspend(std::coroutine_handle<> handle);
+
+	        //key pressed, -1 if the cpu was not waiting
+	        int await_resume() const { return this->key; }
+	    };
+
+	    struct TimerExpiry
+	    {
+	        EventLoop *loop;
+	        Chip8 *cpu;
+	        unsigned long start;
+
+	        bool await_ready() const { return this->cpu->nextTimerExpiry() == ~0ULL; }
+	        void await_suspend(std::coroutine_handle<> handle);
+	        unsigned long await_resume() const { return this->loop->frame - this->start; }
+	    };
+
+	    EventLoop ();
+
+	    NextFrame nextFrame() { NextFrame a = { this }; return a; }
+	    KeyPress keyPress(Chip8 &cpu) { KeyPress a = { this, &cpu, -1, NULL }; return a; }
+	    TimerExpiry timerExpiry(Chip8 &cpu) { TimerExpiry a = { this, &cpu, this->frame }; return a; }
+
+	    //take over task and start it on the next frame
+	    void spawn(Chip8Task &&task);
+
+	    /**
+	    * Hand key to the task waiting in keyPress(cpu), resuming it on the next
+	    * frame. Returns false if no task is waiting for cpu.
+	    */
+	    bool pressKey(Chip8 &cpu, int key);
+
+	    //resume everything due this frame, then move to the next
+	    void step();
+
+	    //step until every task has finished or frames frames have gone by
+	    void run(unsigned long frames);
+
+	    //tasks spawned and not finished
+	    size_t live() const;
+
+	    //frames stepped so far
+	    unsigned long frame;
+
+	    //coroutine resumptions so far
+	    unsigned long long switches;
+
+	    /**
+	    * Task that runs cpu for frames frames: one frame of cycles, then
+	    * co_await nextFrame(). A key wait(LD Vx, K) or a delay timer loop is
+	    * awaited instead of run and the frames that went by are caught up in
+	    * one run() call, so an instance sitting at a menu or in a pause is
+	    * not resumed at all until something happens. Until then its cycles
+	    * lag behind the loop's frame.
+	    */
+	    static Chip8Task runCpu(EventLoop &loop, Chip8 &cpu, unsigned long frames);
+
+	private:
+	    struct Sleeper
+	    {
+	        unsigned long frame;
+	        std::coroutine_handle<> handle;
+
+	        //earliest first in a priority_queue
+	        bool operator<(const Sleeper &other) const { return this->frame > other.frame; }
+	    };
+
+	    std::vector<Chip8Task> tasks;
+
+	    //to resume on the next step(), and a spare list swapped in while resuming
+	    std::vector<std::coroutine_handle<> > nextWaiters;
+	    std::vector<std::coroutine_handle<> > resuming;
+
+	    std::priority_queue<Sleeper> sleepers;
+	    std::map<Chip8 *, KeyPress *> keyWaiters;
+
+	    //drop finished tasks
+	    void reap();
+};
+
+#endif
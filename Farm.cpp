@@ -0,0 +1,292 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Farm.h"
+#include <thread>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//number of workers to start when asked for count, 0 meaning one per core
+static int workersFor(int count)
+{
+    if(count > 0)
+        return count;
+
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+Farm::Farm(int workers, bool pin) : workers(workersFor(workers))
+{
+    this->workerCount = this->workers.size();
+    this->pin = pin;
+    this->runnable = 0;
+    this->queued = 0;
+    this->sleeping = 0;
+    this->nextWorker = 0;
+}
+
+int Farm::add(Chip8 *cpu, unsigned long cycles)
+{
+    Job job;
+    job.cpu = cpu;
+    job.remaining = cycles;
+    job.ran = 0;
+    job.id = this->finished.size();
+
+    Result result = Result();
+    result.id = job.id;
+    this->finished.push_back(result);
+
+    //spread jobs round robin, stealing evens out whatever is left
+    this->workers[this->nextWorker].jobs.push_back(job);
+    this->nextWorker = (this->nextWorker + 1) % this->workerCount;
+    ++this->runnable;
+    ++this->queued;
+
+    return job.id;
+}
+
+void Farm::run()
+{
+    std::vector<std::thread> threads;
+
+    for(int i = 0; i < this->workerCount; i++)
+    {
+        threads.push_back(std::thread(&Farm::work, this, i));
+    }
+
+    for(size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+}
+
+bool Farm::take(int self, Job &job)
+{
+    {
+        Worker &own = this->workers[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+
+        if(!own.jobs.empty())
+        {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            --this->queued;
+            return true;
+        }
+    }
+
+    //steal, starting with the next worker so thieves spread out
+    for(int i = 1; i < this->workerCount; i++)
+    {
+        Worker &victim = this->workers[(self + i) % this->workerCount];
+        std::lock_guard<std::mutex> guard(victim.lock);
+
+        if(!victim.jobs.empty())
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            --this->queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void Farm::work(int self)
+{
+#ifdef __linux__
+    //pinned before anything runs, so no slice starts on the wrong core
+    if(this->pin)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(self % CPU_SETSIZE, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    Job job;
+
+    while(this->runnable > 0)
+    {
+        if(!this->take(self, job))
+        {
+            //every job left is being run by another worker. Sleep until one of
+            //them queues a job again or the last one is done
+            std::unique_lock<std::mutex> guard(this->idleLock);
+            ++this->sleeping;
+            while(this->queued == 0 && this->runnable > 0)
+            {
+                this->wake.wait(guard);
+            }
+            --this->sleeping;
+            continue;
+        }
+
+        unsigned long slice = job.remaining < SLICE ? job.remaining : SLICE;
+        unsigned long ran = job.cpu->run(slice);
+        job.ran += ran;
+        job.remaining -= ran;
+
+        if(job.remaining == 0 || job.cpu->status == Chip8::TRAPPED)
+        {
+            this->finish(job);
+            continue;
+        }
+
+        //anything else that stops the cpu ends the slice too, or the job would
+        //be queued again and run for 0 cycles forever. remaining is kept for
+        //when pressKey() or resume() sets it running
+        if(job.cpu->status != Chip8::RUNNING)
+        {
+            this->park(job);
+            continue;
+        }
+
+        //on the front: this worker takes from the back, so its other jobs run
+        //first, and it is the first job another worker steals
+        this->queue(self, job, true);
+    }
+}
+
+void Farm::queue(int worker, const Job &job, bool front)
+{
+    {
+        Worker &own = this->workers[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+
+        if(front)
+            own.jobs.push_front(job);
+        else
+            own.jobs.push_back(job);
+    }
+
+    ++this->queued;
+
+    if(this->sleeping > 0)
+    {
+        //taking the lock orders this with a worker between testing queued and waiting
+        std::lock_guard<std::mutex> guard(this->idleLock);
+        this->wake.notify_one();
+    }
+}
+
+void Farm::wakeAll()
+{
+    if(this->sleeping > 0)
+    {
+        std::lock_guard<std::mutex> guard(this->idleLock);
+        this->wake.notify_all();
+    }
+}
+
+void Farm::finish(const Job &job)
+{
+    this->record(job);
+
+    //the last job done lets the sleeping workers return
+    if(--this->runnable == 0)
+        this->wakeAll();
+}
+
+void Farm::park(const Job &job)
+{
+    this->record(job);
+
+    {
+        std::lock_guard<std::mutex> guard(this->parkedLock);
+        this->parked[job.id] = job;
+    }
+
+    if(--this->runnable == 0)
+        this->wakeAll();
+}
+
+bool Farm::unpark(int id, Chip8::Status status, Job &job)
+{
+    std::lock_guard<std::mutex> guard(this->parkedLock);
+    std::map<int, Job>::iterator it = this->parked.find(id);
+
+    if(it == this->parked.end() || it->second.cpu->status != status)
+        return false;
+
+    job = it->second;
+    this->parked.erase(it);
+    return true;
+}
+
+bool Farm::pressKey(int id, int key)
+{
+    Job job;
+    if(!this->unpark(id, Chip8::WAITING_KEY, job))
+        return false;
+
+    //parked, so no worker is touching the cpu
+    job.cpu->setKey(key, true);
+    job.cpu->setKey(key, false);
+
+    //counted before it is queued so the workers can't all stop in between
+    ++this->runnable;
+    this->queue(id % this->workerCount, job, false);
+
+    return true;
+}
+
+bool Farm::resume(int id)
+{
+    //the debugger sets a cpu it resumes back to RUNNING
+    Job job;
+    if(!this->unpark(id, Chip8::RUNNING, job))
+        return false;
+
+    ++this->runnable;
+    this->queue(id % this->workerCount, job, false);
+
+    return true;
+}
+
+int Farm::parkedCount()
+{
+    std::lock_guard<std::mutex> guard(this->parkedLock);
+    return this->parked.size();
+}
+
+void Farm::record(const Job &job)
+{
+    const Chip8 &cpu = *job.cpu;
+
+    //each job owns its own slot, no other thread writes it
+    Result &result = this->finished[job.id];
+    result.status = cpu.status;
+    result.PC = cpu.PC;
+    result.I = cpu.I;
+    for(int i = 0; i < 16; i++)
+    {
+        result.V[i] = cpu.V[i];
+    }
+    result.cycles = job.ran;
+    result.displayHash = hashDisplay(cpu);
+}
+
+uint64_t Farm::hashDisplay(const Chip8 &cpu)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    for(int row = 0; row < Chip8::DISPLAY_HEIGHT; row++)
+    {
+        for(int i = 0; i < 8; i++)
+        {
+            hash ^= (cpu.display[row] >> (8 * i)) & 0xFF;
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
@@ -0,0 +1,163 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef FARM_HH
+#define FARM_HH
+
+#include "Chip8.h"
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <atomic>
+
+/**
+* Runs many headless Chip8 instances on a pool of worker threads.
+*
+* Each worker owns a deque of jobs. It takes a job from the back of its own
+* deque, runs it for one time slice(SLICE cycles) with Chip8::run, and puts
+* it back on the front if it still has cycles left. A worker whose deque is
+* empty steals from the front of another worker's deque. A job is only ever
+* touched by the worker holding it, so running a slice needs no locking;
+* the deque locks are only taken between slices. A worker with nothing to
+* take or steal sleeps until a job is queued or the last one is done.
+*
+* A job whose cpu stops at LD Vx, K(Chip8::WAITING_KEY) is parked: it is
+* taken off the deques and costs nothing until pressKey() gives it a key.
+* One stopped by its debugger(Chip8::BREAK) is parked the same way, with
+* the cycles it has left, until resume() queues it again. A trapped job is
+* finished.
+*
+* The farm does not own the cpus it is given.
+*/
+class Farm
+{
+	public:
+	    //cycles a job runs before it goes back on its worker's deque
+	    static const unsigned long SLICE = 20000;
+
+	    //final state of one instance, filled in when its job finishes
+	    struct Result
+	    {
+	        //id returned by add()
+	        int id;
+
+	        Chip8::Status status;
+	        unsigned short PC;
+	        unsigned short I;
+	        unsigned char V[16];
+
+	        //cycles actually run
+	        unsigned long cycles;
+
+	        //hash of the display, see hashDisplay()
+	        uint64_t displayHash;
+	    };
+
+	    /**
+	    * workers - number of threads, 0 for one per core
+	    * pin - pin worker i to core i, before it runs anything
+	    */
+	    Farm (int workers = 0, bool pin = false);
+
+	    /**
+	    * Queue cpu to run for cycles cycles. Returns the id of its result.
+	    * Must not be called while run() is running.
+	    */
+	    int add(Chip8 *cpu, unsigned long cycles);
+
+	    //run until every job has either finished or is parked
+	    void run();
+	    
+	    /**
+	    * Press and release key for job id. Returns false, doing nothing, if
+	    * the job is not parked waiting for a key. Safe to call from any
+	    * thread, including while run() is running; a job woken after run()
+	    * has returned runs on the next run().
+	    */
+	    bool pressKey(int id, int key);
+	    
+	    /**
+	    * Queue job id again after its debugger has set it running(see
+	    * Debugger::resume). Returns false, doing nothing, if the job is not
+	    * parked at a break or is still stopped. Safe to call from any thread,
+	    * like pressKey().
+	    */
+	    bool resume(int id);
+	    
+	    //jobs parked waiting for a key or at a break
+	    int parkedCount();
+
+	    /**
+	    * One entry per added cpu, indexed by id. Filled in when a job
+	    * finishes, and also when it parks(with status WAITING_KEY or BREAK).
+	    */
+	    const std::vector<Result> &results() const { return this->finished; }
+
+	    //FNV-1a hash of the display rows
+	    static uint64_t hashDisplay(const Chip8 &cpu);
+
+	private:
+	    struct Job
+	    {
+	        Chip8 *cpu;
+	        unsigned long remaining;
+	        unsigned long ran;
+	        int id;
+	    };
+
+	    //one per thread, on its own cache line so workers never share one
+	    struct alignas(64) Worker
+	    {
+	        std::mutex lock;
+	        std::deque<Job> jobs;
+	    };
+
+	    int workerCount;
+	    bool pin;
+
+	    std::vector<Worker> workers;
+	    std::vector<Result> finished;
+
+	    //jobs on a deque or being run, the workers stop when this reaches 0
+	    std::atomic<long> runnable;
+	    
+	    //jobs on a deque, waiting for a worker to take them
+	    std::atomic<long> queued;
+	    
+	    //workers with nothing to do wait on wake until queued or runnable changes
+	    std::mutex idleLock;
+	    std::condition_variable wake;
+	    std::atomic<int> sleeping;
+	    
+	    //jobs waiting for a key, keyed by id
+	    std::mutex parkedLock;
+	    std::map<int, Job> parked;
+
+	    //where the next added job goes
+	    int nextWorker;
+
+	    void work(int self);
+
+	    //take a job from the back of worker self, or steal one from the front of another
+	    bool take(int self, Job &job);
+
+	    //put job on the front or back of worker's deque and wake a sleeping worker for it
+	    void queue(int worker, const Job &job, bool front);
+	    
+	    //wake the sleeping workers, if there are any
+	    void wakeAll();
+	    
+	    void finish(const Job &job);
+	    void park(const Job &job);
+	    
+	    //take job id off the parked jobs if it was parked with status. False if it wasn't
+	    bool unpark(int id, Chip8::Status status, Job &job);
+	    
+	    //copy the state of a job's cpu into its result
+	    void record(const Job &job);
+};
+
+#endif
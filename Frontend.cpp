@@ -0,0 +1,137 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Frontend.h"
+#include <chrono>
+
+Frontend::Frontend(Chip8 &cpu) : cpu(cpu)
+{
+    this->framesRun = 0;
+    this->samplesDropped = 0;
+    this->running = false;
+    this->paced = true;
+    this->deferredRelease = 0;
+    this->squarePhase = 0;
+}
+
+Frontend::~Frontend()
+{
+    this->stop();
+}
+
+void Frontend::start(bool paced)
+{
+    if(this->running)
+        return;
+
+    this->paced = paced;
+    this->running = true;
+    this->thread = std::thread(&Frontend::emulate, this);
+}
+
+void Frontend::stop()
+{
+    this->running = false;
+
+    if(this->thread.joinable())
+        this->thread.join();
+}
+
+void Frontend::emulate()
+{
+    typedef std::chrono::steady_clock Clock;
+
+    const Clock::duration period = std::chrono::microseconds(1000000 / 60);
+    Clock::time_point next = Clock::now();
+
+    while(this->running)
+    {
+        this->drainKeys();
+        this->cpu.run(Chip8::CYCLES_PER_FRAME);
+        this->cpu.endFrame();
+
+        bool sound = this->cpu.currentSoundTimer() > 0;
+        this->publishFrame(sound);
+        this->mixAudio(sound);
+        ++this->framesRun;
+
+        if(!this->paced)
+            continue;
+
+        next += period;
+        Clock::time_point now = Clock::now();
+
+        //more than a frame behind(ex. the thread was descheduled), don't try to catch up
+        if(now > next + period)
+            next = now;
+        else
+            std::this_thread::sleep_until(next);
+    }
+}
+
+void Frontend::drainKeys()
+{
+    this->cpu.keys &= ~this->deferredRelease;
+    this->deferredRelease = 0;
+
+    unsigned short pressed = 0;
+    KeyEvent event;
+
+    while(this->keyEvents.pop(event))
+    {
+        unsigned short bit = 1 << event.key;
+
+        if(event.pressed)
+        {
+            this->cpu.setKey(event.key, true);
+            pressed |= bit;
+            this->deferredRelease &= ~bit;
+        }
+        else if(pressed & bit)
+        {
+            //a tap shorter than a frame still has to be seen for one frame
+            this->deferredRelease |= bit;
+        }
+        else
+        {
+            this->cpu.setKey(event.key, false);
+        }
+    }
+}
+
+void Frontend::publishFrame(bool sound)
+{
+    Frame &frame = this->frames.back();
+
+    //the back slot was last filled a couple of frames ago, only update what changed since
+    for(uint32_t rows = this->cpu.rowsChangedSince(frame.number); rows != 0; rows &= rows - 1)
+    {
+        int y = __builtin_ctz(rows);
+        frame.display[y] = this->cpu.display[y];
+    }
+
+    frame.number = this->cpu.frame;
+    frame.sound = sound;
+    this->frames.publish();
+}
+
+void Frontend::mixAudio(bool sound)
+{
+    short samples[SAMPLES_PER_FRAME];
+
+    for(int i = 0; i < SAMPLES_PER_FRAME; i++)
+    {
+        if(!sound)
+        {
+            samples[i] = 0;
+            continue;
+        }
+
+        samples[i] = this->squarePhase < SQUARE_HALF_PERIOD ? SQUARE_VOLUME : -SQUARE_VOLUME;
+        this->squarePhase = (this->squarePhase + 1) % (2 * SQUARE_HALF_PERIOD);
+    }
+
+    size_t pushed = this->audio.push(samples, SAMPLES_PER_FRAME);
+    this->samplesDropped += SAMPLES_PER_FRAME - pushed;
+}
@@ -0,0 +1,143 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef FRONTEND_HH
+#define FRONTEND_HH
+
+#include "Chip8.h"
+#include "SpscRing.h"
+#include "TripleBuffer.h"
+#include <atomic>
+#include <thread>
+
+/**
+* Runs a Chip8 on its own emulation thread and connects it to the rest of a
+* frontend without locks:
+*
+*  - key events go from the input thread to the emulation thread through an
+*    SpscRing, and are applied at the start of the next frame, so a key
+*    reaches the cpu less than one frame after it is pressed
+*  - each finished frame is published to the presentation thread through a
+*    TripleBuffer, which always has the newest frame ready and never makes
+*    the emulation thread wait for the presentation thread
+*  - sound is rendered as a square wave into a PCM SpscRing for the audio
+*    thread. If the audio thread falls behind, samples are dropped
+*
+* The frontend does not own the cpu. Nothing else may touch the cpu between
+* start() and stop().
+*/
+class Frontend
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    //PCM output, signed 16-bit mono
+	    static const int SAMPLE_RATE = 44100;
+	    static const int SAMPLES_PER_FRAME = SAMPLE_RATE / 60;
+
+	    //buzzer pitch, as samples per half period(about 441Hz)
+	    static const int SQUARE_HALF_PERIOD = 50;
+	    static const short SQUARE_VOLUME = 8000;
+
+	    //one frame handed to the presentation thread
+	    struct Frame
+	    {
+	        //blank, with a number that makes the first publish copy every row
+	        Frame () : number(~0UL), sound(false)
+	        {
+	            for(int i = 0; i < Chip8::DISPLAY_HEIGHT; i++)
+	            {
+	                this->display[i] = 0;
+	            }
+	        }
+
+	        uint64_t display[Chip8::DISPLAY_HEIGHT];
+
+	        //Chip8::frame when it was taken
+	        unsigned long number;
+
+	        //true if the buzzer was sounding
+	        bool sound;
+	    };
+
+	    Frontend (Chip8 &cpu);
+	    ~Frontend ();
+
+	    /**
+	    * Start the emulation thread. If paced, frames are run at 60Hz,
+	    * otherwise as fast as possible.
+	    */
+	    void start(bool paced = true);
+
+	    //stop the emulation thread and wait for it to finish
+	    void stop();
+
+	    //called by the input thread only
+	    void pressKey(int key) { this->keyEvents.push(KeyEvent(key, true)); }
+	    void releaseKey(int key) { this->keyEvents.push(KeyEvent(key, false)); }
+
+	    /**
+	    * Called by the presentation thread only. Newest published frame, and
+	    * whether it is different from the one the last call returned.
+	    */
+	    const Frame &latestFrame(bool *changed = NULL)
+	    {
+	        bool fresh = this->frames.update();
+	        if(changed != NULL)
+	            *changed = fresh;
+	        return this->frames.front();
+	    }
+
+	    //called by the audio thread only. Takes up to count samples, returns how many
+	    size_t readAudio(short *out, size_t count) { return this->audio.pop(out, count); }
+
+	    //frames run and PCM samples dropped because the audio ring was full
+	    std::atomic<unsigned long> framesRun;
+	    std::atomic<unsigned long> samplesDropped;
+
+	private:
+	    struct KeyEvent
+	    {
+	        KeyEvent () {}
+	        KeyEvent (int key, bool pressed) : key(key & 0xF), pressed(pressed) {}
+
+	        BYTE key;
+	        bool pressed;
+	    };
+
+	    Chip8 &cpu;
+
+	    SpscRing<KeyEvent, 256> keyEvents;
+	    TripleBuffer<Frame> frames;
+
+	    //about 0.19 seconds of sound
+	    SpscRing<short, 8192> audio;
+
+	    std::thread thread;
+	    std::atomic<bool> running;
+	    bool paced;
+
+	    //keys pressed and released within one frame, released at the next one
+	    unsigned short deferredRelease;
+
+	    //position in the square wave, so it continues smoothly across frames
+	    int squarePhase;
+
+	    void emulate();
+
+	    //apply the key events queued since the last frame
+	    void drainKeys();
+
+	    //copy the display into the back frame and publish it
+	    void publishFrame(bool sound);
+
+	    //push one frame of PCM
+	    void mixAudio(bool sound);
+
+	    //not copyable, it owns the thread
+	    Frontend (const Frontend &);
+	    Frontend &operator=(const Frontend &);
+};
+
+#endif
@@ -0,0 +1,481 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Jit.h"
+#include <cstring>
+#include <cstddef>
+#include <mutex>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+/**
+* Writes x86-64 machine code into the buffer. Every memory operand is
+* [rbx + disp32], rbx holding the Chip8 pointer for the whole block.
+*/
+class Emitter
+{
+	public:
+	    unsigned char *p;
+
+	    Emitter(unsigned char *start) : p(start) {}
+
+	    void byte(unsigned char b) { *this->p++ = b; }
+
+	    void imm16(unsigned short v)
+	    {
+	        this->byte(v & 0xFF);
+	        this->byte(v >> 8);
+	    }
+
+	    void imm32(unsigned int v)
+	    {
+	        for(int i = 0; i < 4; i++)
+	            this->byte((v >> (8 * i)) & 0xFF);
+	    }
+
+	    void imm64(unsigned long long v)
+	    {
+	        for(int i = 0; i < 8; i++)
+	            this->byte((v >> (8 * i)) & 0xFF);
+	    }
+
+	    //opcode with a ModRM of [rbx + disp32] and the given reg field
+	    void rbxOperand(unsigned char opcode, unsigned char reg, int disp)
+	    {
+	        this->byte(opcode);
+	        this->byte(0x80 | (reg << 3) | 3);
+	        this->imm32(disp);
+	    }
+};
+
+//x86 register numbers used in the ModRM reg field
+static const unsigned char AL = 0;
+static const unsigned char CL = 1;
+
+/**
+* Executable memory for every Jit in the process. It is mapped a region at
+* a time and handed out in chunks, so ten thousand cpus share a few large
+* mappings instead of each mapping a buffer of its own. Chunks given back
+* are handed out again, never unmapped.
+*
+* A chunk is never writable and executable at once: it is mapped
+* read/write, and a Jit makes it writable only while emitting into it,
+* then read/execute again before anything in it runs(see protect).
+*/
+class CodeArena
+{
+	public:
+	    //a chunk of size bytes, NULL if no more can be mapped
+	    static unsigned char *take(int size)
+	    {
+	        std::lock_guard<std::mutex> guard(lock());
+
+	        std::vector<unsigned char *> &chunks = spare();
+	        if(chunks.empty() && !map(size, chunks))
+	            return NULL;
+
+	        unsigned char *chunk = chunks.back();
+	        chunks.pop_back();
+	        return chunk;
+	    }
+
+	    static void give(unsigned char *chunk)
+	    {
+	        std::lock_guard<std::mutex> guard(lock());
+	        spare().push_back(chunk);
+	    }
+
+	    //make a chunk read/write to emit into it, or read/execute to run it. False if it can't be changed
+	    static bool protect(unsigned char *chunk, int size, bool writable)
+	    {
+#ifdef JIT_X86_64
+	        return mprotect(chunk, size, writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC) == 0;
+#else
+	        (void)chunk;
+	        (void)size;
+	        (void)writable;
+	        return false;
+#endif
+	    }
+
+	private:
+	    //chunks mapped at once
+	    static const int CHUNKS_PER_REGION = 256;
+
+	    static std::mutex &lock()
+	    {
+	        static std::mutex lock;
+	        return lock;
+	    }
+
+	    static std::vector<unsigned char *> &spare()
+	    {
+	        static std::vector<unsigned char *> chunks;
+	        return chunks;
+	    }
+
+	    //map a new region and add its chunks to chunks
+	    static bool map(int size, std::vector<unsigned char *> &chunks)
+	    {
+#ifdef JIT_X86_64
+	        void *memory = mmap(NULL, (size_t)size * CHUNKS_PER_REGION, PROT_READ | PROT_WRITE,
+	                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	        if(memory == MAP_FAILED)
+	            return false;
+
+	        for(int i = CHUNKS_PER_REGION - 1; i >= 0; i--)
+	        {
+	            chunks.push_back((unsigned char *)memory + (size_t)size * i);
+	        }
+	        return true;
+#else
+	        (void)size;
+	        (void)chunks;
+	        return false;
+#endif
+	    }
+};
+
+Jit::Jit()
+{
+    this->flush();
+}
+
+Jit::~Jit()
+{
+    for(size_t i = 0; i < this->chunks.size(); i++)
+    {
+        CodeArena::give(this->chunks[i]);
+    }
+}
+
+bool Jit::supported()
+{
+#ifdef JIT_X86_64
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Jit::flush()
+{
+    //the chunks are kept and filled again from the first one
+    this->current = 0;
+    this->used = 0;
+
+    for(int i = 0; i < RAM_SIZE; i++)
+    {
+        this->entry[i] = NULL;
+        this->length[i] = 0;
+        this->heat[i] = 0;
+    }
+
+    for(int i = 0; i < RAM_SIZE / 32; i++)
+    {
+        this->covered[i] = 0;
+    }
+}
+
+unsigned long Jit::execute(Chip8 &cpu, const BlockCache::Block &block)
+{
+    Code code = this->entry[block.start];
+
+    if(code == NULL)
+    {
+        if(++this->heat[block.start] < HOT_THRESHOLD)
+            return 0;
+
+        this->heat[block.start] = 0;
+        code = this->translate(cpu, block);
+        if(code == NULL)
+            return 0;
+    }
+
+    return code(&cpu);
+}
+
+Jit::Code Jit::translate(const Chip8 &cpu, const BlockCache::Block &block)
+{
+    unsigned char *start = this->room();
+    if(start == NULL)
+        return NULL;
+
+    //the chunk holds code other blocks may be running, it is only writable until this one is emitted
+    unsigned char *chunk = this->chunks[this->current];
+    if(!CodeArena::protect(chunk, CHUNK_SIZE, true))
+        return NULL;
+
+    //offsets of the members the translated code works on
+    const unsigned char *base = (const unsigned char *)&cpu;
+    const int V = (const unsigned char *)cpu.V - base;
+    const int I = (const unsigned char *)&cpu.I - base;
+    const int PC = (const unsigned char *)&cpu.PC - base;
+    const int CYCLES = (const unsigned char *)&cpu.cycles - base;
+    const int VF = V + 0x0F;
+
+    //only the default handlers have a native translation
+    const Chip8::Instruction *defaults = Chip8::dispatchTable();
+
+    Emitter emit(start);
+
+    //push rbx; mov rbx, rdi
+    emit.byte(0x53);
+    emit.byte(0x48); emit.byte(0x89); emit.byte(0xFB);
+
+    //set by a call-out to the last record, which moves PC itself
+    bool pcWritten = false;
+
+    //instructions run since cycles was last brought up to date. Handlers
+    //read cycles(for the timers), so it is synced before every call-out
+    int unsynced = 0;
+
+    //fused records are translated as the instructions they were made from,
+    //most of which have native code. RAM still holds them: any write to it
+    //would have dropped the block
+    for(int i = 0; i < block.instructions; i++, unsynced++)
+    {
+        unsigned short address = block.start + 2 * i;
+        const Chip8::Instruction &ins = cpu.table[(cpu.read(address) << 8) | cpu.read(address + 1)];
+        bool native = ins.handler == defaults[ins.opcode].handler;
+
+        switch(native ? ins.opcode & 0xF000 : 0xFFFF)
+        {
+            //6xkk - LD Vx, byte: mov byte [Vx], kk
+            case 0x6000:
+                emit.rbxOperand(0xC6, 0, V + ins.x);
+                emit.byte(ins.kk);
+            continue;
+
+            //7xkk - ADD Vx, byte: add byte [Vx], kk
+            case 0x7000:
+                emit.rbxOperand(0x80, 0, V + ins.x);
+                emit.byte(ins.kk);
+            continue;
+
+            //Annn - LD I, addr: mov word [I], nnn
+            case 0xA000:
+                emit.byte(0x66);
+                emit.rbxOperand(0xC7, 0, I);
+                emit.imm16(ins.nnn);
+            continue;
+
+            //1nnn - JP addr: mov word [PC], nnn
+            case 0x1000:
+                emit.byte(0x66);
+                emit.rbxOperand(0xC7, 0, PC);
+                emit.imm16(ins.nnn);
+                pcWritten = true;
+            continue;
+
+            case 0x8000:
+                switch(ins.n)
+                {
+                    //8xy0 - LD Vx, Vy: mov al, [Vy]; mov [Vx], al
+                    case 0x0:
+                        emit.rbxOperand(0x8A, AL, V + ins.y);
+                        emit.rbxOperand(0x88, AL, V + ins.x);
+                    continue;
+
+                    //8xy1/2/3 - OR/AND/XOR Vx, Vy: mov al, [Vy]; op [Vx], al
+                    case 0x1:
+                    case 0x2:
+                    case 0x3:
+                    {
+                        static const unsigned char ops[] = { 0, 0x08, 0x20, 0x30 };
+                        emit.rbxOperand(0x8A, AL, V + ins.y);
+                        emit.rbxOperand(ops[ins.n], AL, V + ins.x);
+                    }
+                    continue;
+
+                    //8xy4 - ADD Vx, Vy: al = Vx + Vy, VF = carry, then Vx = al
+                    case 0x4:
+                        emit.rbxOperand(0x8A, AL, V + ins.x);
+                        emit.rbxOperand(0x02, AL, V + ins.y);
+                        emit.byte(0x0F); emit.byte(0x92); emit.byte(0xC1);
+                        emit.rbxOperand(0x88, CL, VF);
+                        emit.rbxOperand(0x88, AL, V + ins.x);
+                    continue;
+
+                    //8xy5 - SUB Vx, Vy: VF = Vx > Vy, then Vx = Vx - Vy
+                    //Vx and Vy are read again after VF is set, like SUB8 does
+                    case 0x5:
+                        emit.rbxOperand(0x8A, AL, V + ins.x);
+                        emit.rbxOperand(0x3A, AL, V + ins.y);
+                        emit.byte(0x0F); emit.byte(0x97); emit.byte(0xC1);
+                        emit.rbxOperand(0x88, CL, VF);
+                        emit.rbxOperand(0x8A, AL, V + ins.x);
+                        emit.rbxOperand(0x2A, AL, V + ins.y);
+                        emit.rbxOperand(0x88, AL, V + ins.x);
+                    continue;
+
+                    //8xy7 - SUBN Vx, Vy: VF = Vy > Vx, then Vx = Vy - Vx
+                    case 0x7:
+                        emit.rbxOperand(0x8A, AL, V + ins.y);
+                        emit.rbxOperand(0x3A, AL, V + ins.x);
+                        emit.byte(0x0F); emit.byte(0x97); emit.byte(0xC1);
+                        emit.rbxOperand(0x88, CL, VF);
+                        emit.rbxOperand(0x8A, AL, V + ins.y);
+                        emit.rbxOperand(0x2A, AL, V + ins.x);
+                        emit.rbxOperand(0x88, AL, V + ins.x);
+                    continue;
+                }
+            break;
+        }
+
+        //add qword [cycles], unsynced
+        if(unsynced > 0)
+        {
+            emit.byte(0x48);
+            emit.rbxOperand(0x81, 0, CYCLES);
+            emit.imm32(unsynced);
+            unsynced = 0;
+        }
+
+        //a call-out that can stop the cpu(TRAP, LD Vx, K, CALL or RET running
+        //the stack over or under) always ends its block, so run() tests the
+        //status before anything else runs. It leaves PC at the instruction
+        //
+        //call-out: mov word [PC], address; mov rdi, rbx; mov rsi, &ins; mov rax, handler; call rax
+        emit.byte(0x66);
+        emit.rbxOperand(0xC7, 0, PC);
+        emit.imm16(address);
+        emit.byte(0x48); emit.byte(0x89); emit.byte(0xDF);
+        emit.byte(0x48); emit.byte(0xBE); emit.imm64((unsigned long long)&cpu.table[ins.opcode]);
+        emit.byte(0x48); emit.byte(0xB8); emit.imm64((unsigned long long)ins.handler);
+        emit.byte(0xFF); emit.byte(0xD0);
+        pcWritten = i == block.instructions - 1;
+    }
+
+    //fell off the end of the block: mov word [PC], next address
+    if(!pcWritten)
+    {
+        emit.byte(0x66);
+        emit.rbxOperand(0xC7, 0, PC);
+        emit.imm16((block.start + 2 * block.instructions) & (RAM_SIZE - 1));
+    }
+
+    if(unsynced > 0)
+    {
+        emit.byte(0x48);
+        emit.rbxOperand(0x81, 0, CYCLES);
+        emit.imm32(unsynced);
+    }
+
+    //mov eax, length; pop rbx; ret
+    emit.byte(0xB8); emit.imm32(block.instructions);
+    emit.byte(0x5B);
+    emit.byte(0xC3);
+
+    //the blocks already in the chunk can't run from it either, drop them all
+    if(!CodeArena::protect(chunk, CHUNK_SIZE, false))
+    {
+        this->flush();
+        return NULL;
+    }
+
+    this->used += emit.p - start;
+
+    //remember which bytes the translation was made from
+    for(int i = 0; i < 2 * block.instructions; i++)
+    {
+        unsigned short address = (block.start + i) & (RAM_SIZE - 1);
+        this->covered[address >> 5] |= 1u << (address & 31);
+    }
+
+    this->entry[block.start] = (Code)start;
+    this->length[block.start] = block.instructions;
+    return (Code)start;
+}
+
+unsigned char *Jit::room()
+{
+    //the chunk being filled is full, go on to the next
+    if(this->current < (int)this->chunks.size() && this->used + MAX_BLOCK_CODE > CHUNK_SIZE)
+    {
+        ++this->current;
+        this->used = 0;
+    }
+
+    if(this->current == (int)this->chunks.size())
+    {
+        unsigned char *chunk = (int)this->chunks.size() < MAX_CHUNKS ? CodeArena::take(CHUNK_SIZE) : NULL;
+
+        if(chunk != NULL)
+            this->chunks.push_back(chunk);
+        else if(this->chunks.empty())
+            return NULL;
+        //out of room, start over in the first chunk
+        else
+            this->flush();
+    }
+
+    return this->chunks[this->current] + this->used;
+}
+
+void Jit::invalidateCovering(unsigned short address)
+{
+    for(int distance = 0; distance < 2 * BlockCache::MAX_BLOCK_LENGTH; distance++)
+    {
+        unsigned short start = (address - distance) & (RAM_SIZE - 1);
+
+        if(this->entry[start] != NULL && distance < 2 * this->length[start])
+            this->entry[start] = NULL;
+    }
+}
+
+//true if the two cpus are in exactly the same state
+static bool sameState(const Chip8 &a, const Chip8 &b)
+{
+    return a.sameRam(b)
+        && memcmp(a.V, b.V, sizeof(a.V)) == 0
+        && memcmp(a.stack, b.stack, sizeof(a.stack)) == 0
+        && a.I == b.I
+        && a.PC == b.PC
+        && a.SP == b.SP
+        && a.cycles == b.cycles
+        && a.delayTimer == b.delayTimer
+        && a.delayTimerCycle == b.delayTimerCycle
+        && a.soundTimer == b.soundTimer
+        && a.soundTimerCycle == b.soundTimerCycle
+        && memcmp(a.display, b.display, sizeof(a.display)) == 0
+        && a.rngState == b.rngState
+        && a.status == b.status
+        && (a.status != Chip8::WAITING_KEY || a.keyRegister == b.keyRegister);
+}
+
+bool Jit::runDifferential(Chip8 &jitCpu, Chip8 &reference, unsigned long count,
+                          unsigned long step, unsigned long &divergedAt)
+{
+    jitCpu.setEngine(Chip8::ENGINE_JIT);
+
+    unsigned long done = 0;
+    while(done < count)
+    {
+        unsigned long chunk = step;
+        if(chunk > count - done)
+            chunk = count - done;
+
+        unsigned long ran = jitCpu.run(chunk);
+        for(unsigned long i = 0; i < ran; i++)
+        {
+            reference.cycle();
+        }
+        done += ran;
+
+        if(!sameState(jitCpu, reference))
+        {
+            divergedAt = done;
+            return false;
+        }
+
+        if(ran < chunk)
+            break;
+    }
+
+    return true;
+}
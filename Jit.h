@@ -0,0 +1,110 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef JIT_HH
+#define JIT_HH
+
+#include "Chip8.h"
+#include "BlockCache.h"
+#include <vector>
+
+/**
+* x86-64 dynamic recompiler.
+*
+* Blocks from the BlockCache that have run HOT_THRESHOLD times are translated
+* into native code in chunks of memory shared by every Jit in the
+* process(see CodeArena in Jit.cpp), taken as they fill and only writable
+* while a block is being emitted into them. A Jit that never translates
+* anything has no code space at all. The translated code keeps the cpu
+* pointer in rbx and works directly on the V[], I and PC members of the
+* Chip8 object. Register loads, ALU ops, LD I and JP are emitted inline.
+* Everything else(DRW, RND, key ops, skips, stores...) is a call-out to the
+* same handler the interpreter would use.
+*
+* Writes to RAM reach invalidate() through Chip8::store, which drops every
+* translation made from the written byte.
+*/
+class Jit
+{
+	public:
+	    //times a block has to run before it is translated
+	    static const int HOT_THRESHOLD = 2;
+
+	    Jit ();
+	    virtual ~Jit ();
+
+	    //true if the host can run translated code
+	    static bool supported();
+
+	    /**
+	    * Run block through its translation, translating it first if it has
+	    * become hot. Returns the number of cycles run, or 0 if there is no
+	    * translation yet and the caller should interpret the block.
+	    */
+	    unsigned long execute(Chip8 &cpu, const BlockCache::Block &block);
+
+	    //drop every translation made from address
+	    void invalidate(unsigned short address)
+	    {
+	        if(this->covered[address >> 5] & (1u << (address & 31)))
+	            this->invalidateCovering(address);
+	    }
+
+	    //drop every translation and reuse the chunks they were in
+	    void flush();
+
+	    /**
+	    * Differential mode. Runs count cycles on jitCpu with the JIT and on
+	    * reference with the plain interpreter, comparing the full state every
+	    * step cycles. Both cpus must start in the same state.
+	    * Returns true if they never diverge. On divergence, the cycle it was
+	    * found at is stored in divergedAt.
+	    */
+	    static bool runDifferential(Chip8 &jitCpu, Chip8 &reference, unsigned long count,
+	                                unsigned long step, unsigned long &divergedAt);
+
+	private:
+	    typedef unsigned int (*Code)(Chip8 *cpu);
+
+	    static const int RAM_SIZE = 4096;
+
+	    //size of the chunks code space is taken in
+	    static const int CHUNK_SIZE = 4096;
+
+	    //most code space one Jit takes before it starts over
+	    static const int MAX_CHUNKS = 64;
+
+	    //most bytes a single block can translate to
+	    static const int MAX_BLOCK_CODE = 64 * BlockCache::MAX_BLOCK_LENGTH + 32;
+
+	    //chunks taken so far, the one being filled and the bytes used in it
+	    std::vector<unsigned char *> chunks;
+	    int current;
+	    int used;
+
+	    //room for one more block, taking a chunk or starting over if needed. NULL if there is no code space
+	    unsigned char *room();
+
+	    //translation for each start address, NULL if none
+	    Code entry[RAM_SIZE];
+
+	    //number of instructions in each translated block
+	    unsigned char length[RAM_SIZE];
+
+	    //times each block has run without a translation
+	    unsigned char heat[RAM_SIZE];
+
+	    //one bit per RAM byte, set if some translation was made from it
+	    unsigned int covered[RAM_SIZE / 32];
+
+	    Code translate(const Chip8 &cpu, const BlockCache::Block &block);
+
+	    void invalidateCovering(unsigned short address);
+
+	    //not copyable, each Jit owns its chunks
+	    Jit (const Jit &);
+	    Jit &operator=(const Jit &);
+};
+
+#endif
@@ -0,0 +1,242 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Rewind.h"
+#include <string.h>
+#include <algorithm>
+
+//what keyframes are XORed against
+static const Chip8::State ZERO_STATE = Chip8::State();
+
+static size_t putVarint(unsigned char *out, size_t value)
+{
+    size_t n = 0;
+    while(value >= 0x80)
+    {
+        out[n++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out[n++] = value;
+    return n;
+}
+
+static size_t getVarint(const unsigned char *&in)
+{
+    size_t value = 0;
+    int shift = 0;
+    while(*in & 0x80)
+    {
+        value |= (size_t)(*in++ & 0x7F) << shift;
+        shift += 7;
+    }
+    value |= (size_t)*in++ << shift;
+    return value;
+}
+
+Rewind::Rewind(size_t bytes, int frames) : entries(frames > 0 ? frames : 1)
+{
+    //room for at least a couple of whole states
+    this->arenaSize = std::max(bytes, 2 * MAX_RECORD);
+    this->arena = new BYTE[this->arenaSize];
+
+    //padding in the states is never written by Chip8::save, so it has to start equal
+    this->previous = new Chip8::State();
+    this->current = new Chip8::State();
+
+    this->clear();
+}
+
+Rewind::~Rewind()
+{
+    delete[] this->arena;
+    delete this->previous;
+    delete this->current;
+}
+
+void Rewind::clear()
+{
+    this->start = 0;
+    this->end = 0;
+    this->first = 0;
+    this->count = 0;
+    this->sinceKeyframe = 0;
+}
+
+size_t Rewind::bytesUsed() const
+{
+    if(this->count == 0)
+        return 0;
+
+    if(this->end > this->start)
+        return this->end - this->start;
+
+    return this->arenaSize - this->start + this->end;
+}
+
+void Rewind::capture(const Chip8 &cpu)
+{
+    cpu.save(*this->current);
+
+    bool keyframe = this->count == 0 || this->sinceKeyframe + 1 >= KEYFRAME_INTERVAL;
+    size_t size;
+    size_t offset;
+
+    for(;;)
+    {
+        const Chip8::State &base = keyframe ? ZERO_STATE : *this->previous;
+        size = encode((const uint64_t *)this->current, (const uint64_t *)&base, this->scratch);
+
+        while(this->count == (int)this->entries.size())
+        {
+            this->dropOldest();
+        }
+        offset = this->allocate(size);
+
+        //making room can drop the keyframe a delta needs, then it becomes one
+        if(keyframe || this->count > 0)
+            break;
+        keyframe = true;
+    }
+
+    memcpy(this->arena + offset, this->scratch, size);
+
+    Entry &added = this->entry(this->count);
+    added.offset = offset;
+    added.size = size;
+    added.keyframe = keyframe;
+    ++this->count;
+
+    if(this->count == 1)
+        this->start = offset;
+    this->end = offset + size;
+    this->sinceKeyframe = keyframe ? 0 : this->sinceKeyframe + 1;
+
+    std::swap(this->previous, this->current);
+}
+
+bool Rewind::rewind(Chip8 &cpu, int frames)
+{
+    if(frames < 0 || frames >= this->count)
+        return false;
+
+    int target = this->count - 1 - frames;
+
+    //the first entry is always a keyframe
+    int key = target;
+    while(!this->entry(key).keyframe)
+    {
+        --key;
+    }
+
+    Chip8::State &state = *this->current;
+    memset(&state, 0, sizeof(state));
+    for(int i = key; i <= target; i++)
+    {
+        decode(this->arena + this->entry(i).offset, (uint64_t *)&state);
+    }
+
+    cpu.restore(state);
+
+    //carry on capturing from the restored frame
+    this->count = target + 1;
+    this->end = this->entry(target).offset + this->entry(target).size;
+    this->sinceKeyframe = target - key;
+    std::swap(this->previous, this->current);
+
+    return true;
+}
+
+size_t Rewind::encode(const uint64_t *cur, const uint64_t *prev, BYTE *out)
+{
+    size_t n = 0;
+    size_t i = 0;
+
+    while(i < WORDS)
+    {
+        size_t same = i;
+        while(same < WORDS && cur[same] == prev[same])
+        {
+            ++same;
+        }
+
+        size_t changed = same;
+        while(changed < WORDS && cur[changed] != prev[changed])
+        {
+            ++changed;
+        }
+
+        n += putVarint(out + n, same - i);
+        n += putVarint(out + n, changed - same);
+
+        for(size_t j = same; j < changed; j++)
+        {
+            uint64_t x = cur[j] ^ prev[j];
+            memcpy(out + n, &x, 8);
+            n += 8;
+        }
+
+        i = changed;
+    }
+
+    return n;
+}
+
+void Rewind::decode(const BYTE *in, uint64_t *state)
+{
+    size_t i = 0;
+
+    while(i < WORDS)
+    {
+        i += getVarint(in);
+        size_t changed = getVarint(in);
+
+        for(size_t j = 0; j < changed; j++, i++)
+        {
+            uint64_t x;
+            memcpy(&x, in, 8);
+            in += 8;
+            state[i] ^= x;
+        }
+    }
+}
+
+size_t Rewind::allocate(size_t size)
+{
+    for(;;)
+    {
+        if(this->count == 0)
+        {
+            this->start = 0;
+            this->end = 0;
+            return 0;
+        }
+
+        //end never catches up with start, so end == start only ever means empty
+        if(this->end > this->start)
+        {
+            if(this->arenaSize - this->end >= size)
+                return this->end;
+            if(this->start > size)
+                return 0;
+        }
+        else if(this->start - this->end > size)
+        {
+            return this->end;
+        }
+
+        this->dropOldest();
+    }
+}
+
+void Rewind::dropOldest()
+{
+    do
+    {
+        this->first = (this->first + 1) % this->entries.size();
+        --this->count;
+    } while(this->count > 0 && !this->entry(0).keyframe);
+
+    if(this->count > 0)
+        this->start = this->entry(0).offset;
+}
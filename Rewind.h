@@ -0,0 +1,114 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef REWIND_HH
+#define REWIND_HH
+
+#include "Chip8.h"
+#include <vector>
+
+/**
+* Keeps the last few seconds of a cpu's states so it can be rewound a
+* number of frames.
+*
+* capture() is called once per frame. Every KEYFRAME_INTERVAL frames the
+* whole Chip8::State is stored, and in between only its XOR against the
+* previous frame's state. Both are run-length encoded a 64-bit word at a
+* time: runs of unchanged words, then runs of changed words stored as
+* their XOR. A frame usually changes a handful of words(cycles, a timer,
+* a few registers), so a delta is well under 100 bytes.
+*
+* Records go into one fixed size circular arena. When it or the frame
+* limit is full, the oldest keyframe is dropped along with the deltas
+* that depend on it, so memory never grows past what was asked for.
+*/
+class Rewind
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    //frames between full states
+	    static const int KEYFRAME_INTERVAL = 60;
+
+	    /**
+	    * bytes - size of the arena records are kept in
+	    * frames - most frames kept(60 per second)
+	    */
+	    Rewind (size_t bytes = 1 << 20, int frames = 60 * 60);
+	    ~Rewind ();
+
+	    //record the state of cpu at the end of a frame
+	    void capture(const Chip8 &cpu);
+
+	    /**
+	    * Put cpu back in the state captured frames frames before the latest
+	    * capture(0 is the latest itself). Later captures are dropped, so
+	    * capturing continues from there. Returns false, leaving cpu alone,
+	    * if that frame is no longer kept.
+	    */
+	    bool rewind(Chip8 &cpu, int frames);
+
+	    //frames that can be rewound, counting the latest capture
+	    int available() const { return this->count; }
+
+	    //forget every capture
+	    void clear();
+
+	    //bytes of the arena holding records
+	    size_t bytesUsed() const;
+
+	private:
+	    static const size_t WORDS = sizeof(Chip8::State) / 8;
+
+	    //what a state encodes to at worst: every other word changed
+	    static const size_t MAX_RECORD = WORDS * 8 + (WORDS / 2 + 2) * 2 * 3;
+
+	    struct Entry
+	    {
+	        size_t offset;
+	        size_t size;
+	        bool keyframe;
+	    };
+
+	    BYTE *arena;
+	    size_t arenaSize;
+
+	    //oldest record starts at start, the next one is written at end
+	    size_t start;
+	    size_t end;
+
+	    //ring of captured frames, oldest at first
+	    std::vector<Entry> entries;
+	    int first;
+	    int count;
+
+	    //frames since the last keyframe
+	    int sinceKeyframe;
+
+	    //the last captured state and a scratch one, swapped on every capture
+	    Chip8::State *previous;
+	    Chip8::State *current;
+
+	    BYTE scratch[MAX_RECORD];
+
+	    //encode the XOR of cur and prev(prev NULL for all zero) into out. Returns the size
+	    static size_t encode(const uint64_t *cur, const uint64_t *prev, BYTE *out);
+
+	    //XOR an encoded record into state
+	    static void decode(const BYTE *in, uint64_t *state);
+
+	    //make room for size contiguous bytes and return where they go
+	    size_t allocate(size_t size);
+
+	    //drop the oldest keyframe and the deltas after it
+	    void dropOldest();
+
+	    Entry &entry(int i) { return this->entries[(this->first + i) % this->entries.size()]; }
+
+	    //not copyable, it owns the arena
+	    Rewind (const Rewind &);
+	    Rewind &operator=(const Rewind &);
+};
+
+#endif
@@ -0,0 +1,23 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "RomImage.h"
+#include <string.h>
+
+RomImage::RomImage(const BYTE *memory, uint64_t ramHash) : ramHash(ramHash)
+{
+    memcpy(this->data, memory, SIZE);
+
+    for(int i = 0; i < NUM_PAGES; i++)
+    {
+        const BYTE *page = this->data + i * PAGE_SIZE;
+        this->pages[i] = memcmp(page, zeroPage(), PAGE_SIZE) == 0 ? zeroPage() : page;
+    }
+}
+
+const unsigned char *RomImage::zeroPage()
+{
+    static const BYTE zeros[PAGE_SIZE] = { 0 };
+    return zeros;
+}
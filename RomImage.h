@@ -0,0 +1,48 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef ROMIMAGE_HH
+#define ROMIMAGE_HH
+
+#include <stdint.h>
+#include <memory>
+
+/**
+* Read-only image of a whole 4K Chip8 memory(font plus program), split into
+* 256 byte pages. Any number of cpus can load the same image: their RAM
+* pages point into it and a page is only copied the first time a cpu
+* writes to it. Pages that are all zero point at one zero page shared by
+* every image, so most of a cpu's RAM is in cache lines other cpus use too.
+*
+* Build one with Chip8::makeImage and share it with a shared_ptr.
+*/
+class RomImage
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    static const int SIZE = 4096;
+	    static const int PAGE_SIZE = 256;
+	    static const int NUM_PAGES = SIZE / PAGE_SIZE;
+
+	    //copy a whole SIZE byte memory image
+	    RomImage (const BYTE *memory, uint64_t ramHash);
+
+	    const BYTE *page(int i) const { return this->pages[i]; }
+
+	    //Chip8::ramHash of the image, so loading it doesn't have to hash it again
+	    const uint64_t ramHash;
+
+	    //page of PAGE_SIZE zero bytes
+	    static const BYTE *zeroPage();
+
+	private:
+	    BYTE data[SIZE];
+	    const BYTE *pages[NUM_PAGES];
+
+	    RomImage (const RomImage &);
+	    RomImage &operator=(const RomImage &);
+};
+
+#endif
@@ -0,0 +1,33 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "RunAhead.h"
+#include <string.h>
+
+RunAhead::RunAhead(Chip8 &cpu, int frames) : cpu(cpu), saved()
+{
+    this->setFrames(frames);
+    memset(this->presented, 0, sizeof(this->presented));
+}
+
+const uint64_t *RunAhead::runFrame()
+{
+    this->cpu.run(Chip8::CYCLES_PER_FRAME);
+    this->cpu.endFrame();
+
+    if(this->frames == 0)
+        return this->cpu.display;
+
+    this->cpu.save(this->saved);
+
+    for(int i = 0; i < this->frames; i++)
+    {
+        this->cpu.run(Chip8::CYCLES_PER_FRAME);
+    }
+    memcpy(this->presented, this->cpu.display, sizeof(this->presented));
+
+    this->cpu.restore(this->saved);
+
+    return this->presented;
+}
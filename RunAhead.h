@@ -0,0 +1,50 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef RUNAHEAD_HH
+#define RUNAHEAD_HH
+
+#include "Chip8.h"
+
+/**
+* Cuts input latency by showing frames from the future.
+*
+* Many programs take a frame or two between reading a key and drawing the
+* result. Each frame, RunAhead runs the real frame, saves the state, runs
+* frames more frames with the same keys held and keeps that display to be
+* presented, then restores the saved state. What is shown is the display
+* frames frames ahead of the real cpu, so a key press shows up that many
+* frames sooner. The cost is frames extra frames of emulation plus a save
+* and restore, each of which only touches what changed.
+*/
+class RunAhead
+{
+	public:
+	    //cpu - the cpu to run. frames - frames to run ahead, 0 to turn it off
+	    RunAhead (Chip8 &cpu, int frames = 1);
+
+	    void setFrames(int frames) { this->frames = frames > 0 ? frames : 0; }
+	    int getFrames() const { return this->frames; }
+
+	    /**
+	    * Run one frame with the keys currently set on the cpu and return the
+	    * display to present, DISPLAY_HEIGHT rows. Valid until the next call.
+	    */
+	    const uint64_t *runFrame();
+
+	private:
+	    Chip8 &cpu;
+	    int frames;
+
+	    //state after the real frame, put back after running ahead
+	    Chip8::State saved;
+
+	    uint64_t presented[Chip8::DISPLAY_HEIGHT];
+
+	    //not copyable, it holds a reference to its cpu
+	    RunAhead (const RunAhead &);
+	    RunAhead &operator=(const RunAhead &);
+};
+
+#endif
@@ -0,0 +1,109 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef SPSCRING_HH
+#define SPSCRING_HH
+
+#include <atomic>
+#include <stddef.h>
+
+/**
+* Fixed size lock-free queue for exactly one producer thread and one
+* consumer thread.
+*
+* head is only written by the consumer and tail only by the producer, each
+* on its own cache line. Neither side ever waits: push() fails when the ring
+* is full and pop() fails when it is empty. SIZE must be a power of 2, and
+* SIZE - 1 items fit.
+*/
+template <typename T, size_t SIZE>
+class SpscRing
+{
+	public:
+	    SpscRing () : head(0), tail(0) {}
+
+	    //add item. Returns false, dropping it, if the ring is full
+	    bool push(const T &item)
+	    {
+	        size_t t = this->tail.load(std::memory_order_relaxed);
+	        size_t next = (t + 1) & MASK;
+
+	        if(next == this->head.load(std::memory_order_acquire))
+	            return false;
+
+	        this->items[t] = item;
+	        this->tail.store(next, std::memory_order_release);
+	        return true;
+	    }
+
+	    //add up to count items. Returns how many fit
+	    size_t push(const T *src, size_t count)
+	    {
+	        size_t t = this->tail.load(std::memory_order_relaxed);
+	        size_t room = (this->head.load(std::memory_order_acquire) - t - 1) & MASK;
+
+	        if(count > room)
+	            count = room;
+
+	        for(size_t i = 0; i < count; i++)
+	        {
+	            this->items[(t + i) & MASK] = src[i];
+	        }
+
+	        this->tail.store((t + count) & MASK, std::memory_order_release);
+	        return count;
+	    }
+
+	    //take the oldest item. Returns false if the ring is empty
+	    bool pop(T &item)
+	    {
+	        size_t h = this->head.load(std::memory_order_relaxed);
+
+	        if(h == this->tail.load(std::memory_order_acquire))
+	            return false;
+
+	        item = this->items[h];
+	        this->head.store((h + 1) & MASK, std::memory_order_release);
+	        return true;
+	    }
+
+	    //take up to count items. Returns how many were taken
+	    size_t pop(T *dst, size_t count)
+	    {
+	        size_t h = this->head.load(std::memory_order_relaxed);
+	        size_t ready = (this->tail.load(std::memory_order_acquire) - h) & MASK;
+
+	        if(count > ready)
+	            count = ready;
+
+	        for(size_t i = 0; i < count; i++)
+	        {
+	            dst[i] = this->items[(h + i) & MASK];
+	        }
+
+	        this->head.store((h + count) & MASK, std::memory_order_release);
+	        return count;
+	    }
+
+	    //items waiting. Only exact when called from the producer or the consumer
+	    size_t size() const
+	    {
+	        return (this->tail.load(std::memory_order_acquire) -
+	                this->head.load(std::memory_order_acquire)) & MASK;
+	    }
+
+	private:
+	    static_assert((SIZE & (SIZE - 1)) == 0 && SIZE >= 2, "SIZE must be a power of 2");
+	    static const size_t MASK = SIZE - 1;
+
+	    //next item to pop, written by the consumer
+	    alignas(64) std::atomic<size_t> head;
+
+	    //next free slot, written by the producer
+	    alignas(64) std::atomic<size_t> tail;
+
+	    alignas(64) T items[SIZE];
+};
+
+#endif
@@ -0,0 +1,656 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "Tracer.h"
+#include "Checkpoint.h"
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef unsigned char BYTE;
+
+static const char MAGIC[4] = {'C', '8', 'T', 'R'};
+static const size_t FILE_HEADER = 8;
+
+static const int STACK_ENTRIES = sizeof(((Chip8::State *)0)->stack) / sizeof(unsigned short);
+static const size_t RAM_BYTES = sizeof(((Chip8::State *)0)->ram);
+
+//the low bytes of value, little endian. A store per byte is slow enough to show up per step
+static BYTE *put(BYTE *out, uint64_t value, int bytes)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(out, &value, bytes);
+    return out + bytes;
+#else
+    for(int i = 0; i < bytes; i++)
+    {
+        *out++ = value >> (8 * i);
+    }
+    return out;
+#endif
+}
+
+static BYTE *putVarint(BYTE *out, unsigned long long value)
+{
+    while(value >= 0x80)
+    {
+        *out++ = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    *out++ = value;
+    return out;
+}
+
+/**
+* Reads from a trace without going past end. Past it every byte reads as 0,
+* so a damaged record gives garbage values rather than a crash.
+*/
+struct Cursor
+{
+    const BYTE *in;
+    const BYTE *end;
+
+    BYTE byte() { return this->in < this->end ? *this->in++ : 0; }
+
+    uint64_t get(int bytes)
+    {
+        uint64_t value = 0;
+        for(int i = 0; i < bytes; i++)
+        {
+            value |= (uint64_t)this->byte() << (8 * i);
+        }
+        return value;
+    }
+
+    unsigned long long varint()
+    {
+        unsigned long long value = 0;
+        for(int shift = 0; shift < 64; shift += 7)
+        {
+            BYTE b = this->byte();
+            value |= (unsigned long long)(b & 0x7F) << shift;
+            if(!(b & 0x80))
+                break;
+        }
+        return value;
+    }
+};
+
+Tracer::Tracer() : shadow()
+{
+    this->cpu = NULL;
+    this->file = NULL;
+    this->failed = false;
+    this->buffer = new BYTE[BLOCK_SIZE + MAX_RECORD];
+    this->used = 0;
+    this->blockSteps = 0;
+    this->blockCycle = 0;
+    this->storeLength = 0;
+    this->outside = false;
+    this->steps = 0;
+    this->bytes = 0;
+}
+
+Tracer::~Tracer()
+{
+    this->stop();
+    delete[] this->buffer;
+}
+
+bool Tracer::start(const char *path, Chip8 &cpu)
+{
+    this->stop();
+
+    this->file = fopen(path, "wb");
+    if(this->file == NULL)
+        return false;
+
+    BYTE header[FILE_HEADER];
+    memcpy(header, MAGIC, 4);
+    put(header + 4, VERSION, 2);
+    put(header + 6, 0, 2);
+
+    if(fwrite(header, 1, FILE_HEADER, this->file) != FILE_HEADER)
+    {
+        fclose(this->file);
+        this->file = NULL;
+        return false;
+    }
+
+    this->failed = false;
+    this->bytes = FILE_HEADER;
+    this->steps = 0;
+    this->cpu = &cpu;
+    this->beginBlock();
+
+    cpu.setTracer(this);
+    return true;
+}
+
+bool Tracer::stop()
+{
+    if(this->cpu == NULL)
+        return !this->failed;
+
+    this->writeBlock();
+    if(fclose(this->file) != 0)
+        this->failed = true;
+
+    this->cpu->setTracer(NULL);
+    this->cpu = NULL;
+    this->file = NULL;
+
+    return !this->failed;
+}
+
+void Tracer::beginBlock()
+{
+    this->used = BLOCK_HEADER;
+    this->blockSteps = 0;
+    this->blockCycle = this->cpu->cycles;
+
+    //the checkpoint is also what the first step is compared against
+    this->cpu->save(this->shadow);
+    this->shadowRamHash = this->cpu->ramHash;
+    this->shadowDisplayHash = this->cpu->displayHash;
+    this->storeLength = 0;
+
+    std::vector<BYTE> record;
+    Checkpoint::encode(0, this->shadow, record);
+    memcpy(this->buffer + this->used, &record[0], record.size());
+    this->used += record.size();
+}
+
+void Tracer::writeBlock()
+{
+    if(this->blockSteps == 0)
+        return;
+
+    BYTE *out = put(this->buffer, this->used - 4, 4);
+    out = put(out, this->blockSteps, 4);
+    out = put(out, this->blockCycle, 8);
+    put(out, this->shadow.cycles, 8);
+
+    if(fwrite(this->buffer, 1, this->used, this->file) != this->used)
+        this->failed = true;
+    this->bytes += this->used;
+}
+
+void Tracer::sync()
+{
+    const Chip8 &cpu = *this->cpu;
+    const Chip8::State &last = this->shadow;
+
+    //keys, or a register written by a key press finishing LD Vx, K
+    this->outside = true;
+
+    //registers, timers and the display are diffed by every step anyway,
+    //but a step can't say where PC was before it or what RAM was written
+    if(cpu.PC == last.PC && cpu.cycles >= last.cycles && cpu.ramHash == this->shadowRamHash &&
+       memcmp(cpu.stack, last.stack, sizeof(last.stack)) == 0)
+        return;
+
+    this->writeBlock();
+    this->beginBlock();
+}
+
+void Tracer::step(unsigned short opcode, unsigned long long cycle)
+{
+    const Chip8 &cpu = *this->cpu;
+    Chip8::State &last = this->shadow;
+
+    BYTE *record = this->buffer + this->used;
+    BYTE *out = record + 3;
+    BYTE changed = 0;
+
+    record[0] = opcode >> 8;
+    record[1] = opcode;
+
+    if(cycle != last.cycles)
+    {
+        changed |= CHANGED_GAP;
+        out = putVarint(out, cycle - last.cycles);
+    }
+
+    if(cpu.PC != (unsigned short)(last.PC + 2))
+    {
+        changed |= CHANGED_PC;
+        out = put(out, cpu.PC, 2);
+    }
+    last.PC = cpu.PC;
+
+    //an instruction only writes Vx and VF, apart from the Fx loads that can
+    //write V0 to Vx. Comparing all 16 every step would cost more than the
+    //instruction itself, so only those are looked at
+    bool everything = this->outside || (opcode & 0xF000) == 0xF000;
+    this->outside = false;
+
+    unsigned short written = 0;
+    if(everything)
+    {
+        for(int x = 0; x < 16; x++)
+        {
+            written |= (cpu.V[x] != last.V[x]) << x;
+        }
+    }
+    else
+    {
+        int x = (opcode >> 8) & 0xF;
+        written = (cpu.V[x] != last.V[x]) << x | (cpu.V[15] != last.V[15]) << 15;
+    }
+
+    if(written != 0)
+    {
+        changed |= CHANGED_REGISTERS;
+        out = put(out, written, 2);
+
+        for(unsigned bits = written; bits != 0; bits &= bits - 1)
+        {
+            int x = __builtin_ctz(bits);
+            *out++ = cpu.V[x];
+            last.V[x] = cpu.V[x];
+        }
+    }
+
+    if(cpu.I != last.I)
+    {
+        changed |= CHANGED_I;
+        out = put(out, cpu.I, 2);
+        last.I = cpu.I;
+    }
+
+    if(cpu.SP != last.SP)
+    {
+        changed |= CHANGED_STACK;
+        *out++ = cpu.SP;
+
+        //a push wrote the entry below the new SP, a pop wrote nothing
+        if(cpu.SP > last.SP && cpu.SP <= STACK_ENTRIES)
+        {
+            out = put(out, cpu.stack[cpu.SP - 1], 2);
+            last.stack[cpu.SP - 1] = cpu.stack[cpu.SP - 1];
+        }
+        last.SP = cpu.SP;
+    }
+
+    if(this->storeLength > 0)
+    {
+        changed |= CHANGED_MEMORY;
+
+        size_t length = this->storeHigh - this->storeLow + 1;
+        out = putVarint(out, this->storeLow);
+        out = putVarint(out, length);
+
+        for(size_t i = 0; i < length; i++)
+        {
+            BYTE value = cpu.read(this->storeLow + i);
+            *out++ = value;
+            last.ram[this->storeLow + i] = value;
+        }
+
+        this->storeLength = 0;
+        this->shadowRamHash = cpu.ramHash;
+    }
+
+    if(cpu.displayHash != this->shadowDisplayHash)
+    {
+        changed |= CHANGED_DISPLAY;
+
+        BYTE *mask = out;
+        out += 4;
+
+        uint32_t rows = 0;
+        for(int y = 0; y < Chip8::DISPLAY_HEIGHT; y++)
+        {
+            if(cpu.display[y] == last.display[y])
+                continue;
+
+            rows |= 1u << y;
+            out = put(out, cpu.display[y], 8);
+            last.display[y] = cpu.display[y];
+        }
+        put(mask, rows, 4);
+
+        this->shadowDisplayHash = cpu.displayHash;
+    }
+
+    unsigned long long extra = cpu.cycles - cycle - 1;
+
+    //timers are only set by the Fx group and the RNG only moved by Cxkk.
+    //Any instruction can trap, which changes status
+    bool other = extra != 0 || cpu.status != last.status;
+    if(everything || (opcode & 0xF000) == 0xC000)
+    {
+        other = other || cpu.rngState != last.rngState || cpu.keys != last.keys ||
+                cpu.delayTimerCycle != last.delayTimerCycle || cpu.delayTimer != last.delayTimer ||
+                cpu.soundTimerCycle != last.soundTimerCycle || cpu.soundTimer != last.soundTimer ||
+                cpu.keyRegister != last.keyRegister || cpu.trapOpcode != last.trapOpcode;
+    }
+
+    if(other)
+    {
+        changed |= CHANGED_OTHER;
+
+        BYTE *flags = out++;
+        BYTE other = 0;
+
+        if(cpu.delayTimer != last.delayTimer || cpu.delayTimerCycle != last.delayTimerCycle)
+        {
+            other |= OTHER_DELAY;
+            *out++ = cpu.delayTimer;
+            out = putVarint(out, cpu.delayTimerCycle);
+            last.delayTimer = cpu.delayTimer;
+            last.delayTimerCycle = cpu.delayTimerCycle;
+        }
+
+        if(cpu.soundTimer != last.soundTimer || cpu.soundTimerCycle != last.soundTimerCycle)
+        {
+            other |= OTHER_SOUND;
+            *out++ = cpu.soundTimer;
+            out = putVarint(out, cpu.soundTimerCycle);
+            last.soundTimer = cpu.soundTimer;
+            last.soundTimerCycle = cpu.soundTimerCycle;
+        }
+
+        if(cpu.rngState != last.rngState)
+        {
+            other |= OTHER_RNG;
+            out = put(out, cpu.rngState, 8);
+            last.rngState = cpu.rngState;
+        }
+
+        if(cpu.keys != last.keys)
+        {
+            other |= OTHER_KEYS;
+            out = put(out, cpu.keys, 2);
+            last.keys = cpu.keys;
+        }
+
+        if(cpu.status != last.status || cpu.keyRegister != last.keyRegister || cpu.trapOpcode != last.trapOpcode)
+        {
+            other |= OTHER_STATUS;
+            *out++ = cpu.status;
+            *out++ = cpu.keyRegister;
+            out = put(out, cpu.trapOpcode, 2);
+            last.status = cpu.status;
+            last.keyRegister = cpu.keyRegister;
+            last.trapOpcode = cpu.trapOpcode;
+        }
+
+        if(extra != 0)
+        {
+            other |= OTHER_LONG;
+            out = putVarint(out, extra);
+        }
+
+        *flags = other;
+    }
+
+    last.cycles = cpu.cycles;
+
+    record[2] = changed;
+    this->used = out - this->buffer;
+    ++this->blockSteps;
+    ++this->steps;
+
+    if(this->used >= BLOCK_SIZE)
+    {
+        this->writeBlock();
+        this->beginBlock();
+    }
+}
+
+TraceReader::TraceReader()
+{
+    this->data = NULL;
+    this->size = 0;
+    this->damaged = false;
+    this->block = 0;
+    this->position = 0;
+    this->current = new Chip8::State();
+}
+
+TraceReader::~TraceReader()
+{
+    this->close();
+    delete this->current;
+}
+
+bool TraceReader::open(const char *path)
+{
+    this->close();
+
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat info;
+    if(fstat(fd, &info) != 0 || info.st_size < (off_t)FILE_HEADER)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void *mapped = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED)
+        return false;
+
+    this->data = (const BYTE *)mapped;
+    this->size = info.st_size;
+
+    Cursor header = {this->data + 4, this->data + FILE_HEADER};
+    if(memcmp(this->data, MAGIC, 4) != 0 || header.get(2) != Tracer::VERSION)
+    {
+        this->close();
+        return false;
+    }
+
+    //a trace cut short by a crash still has its whole blocks
+    size_t offset = FILE_HEADER;
+    while(offset < this->size)
+    {
+        Cursor in = {this->data + offset, this->data + this->size};
+        Block block;
+
+        block.end = offset + 4 + in.get(4);
+        block.steps = in.get(4);
+        block.firstCycle = in.get(8);
+        block.endCycle = in.get(8);
+        block.checkpoint = in.in - this->data;
+
+        size_t record = 0;
+        if(block.end <= this->size && block.checkpoint < block.end)
+            record = Checkpoint::check(this->data + block.checkpoint, block.end - block.checkpoint);
+
+        if(record == 0)
+        {
+            this->damaged = true;
+            break;
+        }
+
+        block.records = block.checkpoint + record;
+        this->blocks.push_back(block);
+        offset = block.end;
+    }
+
+    if(!this->blocks.empty())
+        this->enter(0);
+
+    return true;
+}
+
+void TraceReader::close()
+{
+    if(this->data != NULL)
+        munmap((void *)this->data, this->size);
+
+    this->data = NULL;
+    this->size = 0;
+    this->damaged = false;
+    this->blocks.clear();
+    this->block = 0;
+    this->position = 0;
+}
+
+void TraceReader::enter(size_t i)
+{
+    this->block = i;
+    this->position = this->blocks[i].records;
+    Checkpoint::decode(this->data + this->blocks[i].checkpoint, *this->current);
+}
+
+unsigned long long TraceReader::peekCycle() const
+{
+    Cursor in = {this->data + this->position, this->data + this->blocks[this->block].end};
+    in.get(2);
+
+    unsigned long long cycle = this->current->cycles;
+    if(in.byte() & Tracer::CHANGED_GAP)
+        cycle += in.varint();
+
+    return cycle;
+}
+
+bool TraceReader::seek(unsigned long long cycle)
+{
+    for(size_t i = 0; i < this->blocks.size(); i++)
+    {
+        if(this->blocks[i].endCycle <= cycle)
+            continue;
+
+        this->enter(i);
+
+        TraceStep step;
+        while(this->position < this->blocks[i].end)
+        {
+            if(this->peekCycle() >= cycle)
+                return true;
+            this->next(step);
+        }
+    }
+
+    return false;
+}
+
+bool TraceReader::next(TraceStep &step)
+{
+    if(this->blocks.empty())
+        return false;
+
+    //a new block starts from its own checkpoint
+    while(this->position >= this->blocks[this->block].end)
+    {
+        if(this->block + 1 >= this->blocks.size())
+            return false;
+        this->enter(this->block + 1);
+    }
+
+    Chip8::State &state = *this->current;
+    Cursor in = {this->data + this->position, this->data + this->blocks[this->block].end};
+
+    step.opcode = in.byte() << 8;
+    step.opcode |= in.byte();
+    step.changed = in.byte();
+    step.other = 0;
+    step.registers = 0;
+    step.memory = 0;
+    step.memoryLength = 0;
+    step.rows = 0;
+
+    if(step.changed & Tracer::CHANGED_GAP)
+        state.cycles += in.varint();
+
+    step.cycle = state.cycles;
+    step.PC = state.PC;
+
+    if(step.changed & Tracer::CHANGED_PC)
+        state.PC = in.get(2);
+    else
+        state.PC += 2;
+
+    if(step.changed & Tracer::CHANGED_REGISTERS)
+    {
+        step.registers = in.get(2);
+        for(int x = 0; x < 16; x++)
+        {
+            if(step.registers & (1 << x))
+                state.V[x] = in.byte();
+        }
+    }
+
+    if(step.changed & Tracer::CHANGED_I)
+        state.I = in.get(2);
+
+    if(step.changed & Tracer::CHANGED_STACK)
+    {
+        BYTE SP = in.byte();
+        if(SP > state.SP && SP <= STACK_ENTRIES)
+            state.stack[SP - 1] = in.get(2);
+        state.SP = SP;
+    }
+
+    if(step.changed & Tracer::CHANGED_MEMORY)
+    {
+        step.memory = in.varint() % RAM_BYTES;
+        unsigned long long length = in.varint();
+        step.memoryLength = length < RAM_BYTES ? length : RAM_BYTES;
+
+        for(unsigned i = 0; i < step.memoryLength; i++)
+        {
+            state.ram[(step.memory + i) % RAM_BYTES] = in.byte();
+        }
+    }
+
+    if(step.changed & Tracer::CHANGED_DISPLAY)
+    {
+        step.rows = in.get(4);
+        for(int y = 0; y < Chip8::DISPLAY_HEIGHT; y++)
+        {
+            if(step.rows & (1u << y))
+                state.display[y] = in.get(8);
+        }
+    }
+
+    unsigned long long extra = 0;
+    if(step.changed & Tracer::CHANGED_OTHER)
+    {
+        step.other = in.byte();
+
+        if(step.other & Tracer::OTHER_DELAY)
+        {
+            state.delayTimer = in.byte();
+            state.delayTimerCycle = in.varint();
+        }
+
+        if(step.other & Tracer::OTHER_SOUND)
+        {
+            state.soundTimer = in.byte();
+            state.soundTimerCycle = in.varint();
+        }
+
+        if(step.other & Tracer::OTHER_RNG)
+            state.rngState = in.get(8);
+
+        if(step.other & Tracer::OTHER_KEYS)
+            state.keys = in.get(2);
+
+        if(step.other & Tracer::OTHER_STATUS)
+        {
+            state.status = (Chip8::Status)in.byte();
+            state.keyRegister = in.byte();
+            state.trapOpcode = in.get(2);
+        }
+
+        if(step.other & Tracer::OTHER_LONG)
+            extra = in.varint();
+    }
+
+    state.cycles += 1 + extra;
+    this->position = in.in - this->data;
+
+    return true;
+}
@@ -0,0 +1,254 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef TRACER_HH
+#define TRACER_HH
+
+#include "Chip8.h"
+#include <stdio.h>
+#include <vector>
+
+/**
+* Records every instruction a cpu runs to a trace file(.c8t).
+*
+* The file is "C8TR", a 16-bit version and 2 reserved bytes, then blocks:
+*     u32 size of the rest of the block, u32 steps, u64 first cycle,
+*     u64 cycles after the last step, a checkpoint record(see Checkpoint.h)
+*     of the state before the first step, then one record per step.
+* A step record is the opcode(big endian, as in RAM), a byte of CHANGED_
+* flags and, in flag order, what the step changed:
+*     GAP       varint cycles that went by before it(waiting for a key)
+*     PC        u16 PC after, when it is not PC + 2
+*     REGISTERS u16 mask of V registers written, then their values
+*     I         u16 I
+*     STACK     u8 SP, then if SP went up the u16 it pushed
+*     MEMORY    varint address, varint length, the bytes written
+*     DISPLAY   u32 mask of rows changed, then each row as a u64
+*     OTHER     a byte of OTHER_ flags, then for each: delay and sound
+*               timers(u8 value, varint cycle set at), RNG(u64), keys(u16),
+*               status(u8 status, u8 keyRegister, u16 trapOpcode) and
+*               varint extra cycles the step took(a skipped delay loop)
+* Numbers are little endian. Most steps are 3 to 5 bytes.
+*
+* Steps go into a BLOCK_SIZE buffer that is written out whole. A tracer
+* belongs to one cpu, so the buffer is only ever touched by the thread
+* running that cpu and nothing is locked. Every block starts from a full
+* state, so a reader can start at any block.
+*
+* While a tracer is attached, Chip8::run reports one instruction at a time:
+* the interpreter fetches each one, every other engine runs them from
+* decoded blocks, with fused pairs split and nothing translated. It only
+* checks for a tracer once per run(), so an unattached cpu pays nothing
+* per instruction. Keys pressed and registers written between run() calls
+* are recorded with the next step.
+*/
+class Tracer
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    static const unsigned short VERSION = 1;
+
+	    //bytes of records buffered before a block is written
+	    static const size_t BLOCK_SIZE = 1 << 20;
+
+	    //flags byte of a step record
+	    static const BYTE CHANGED_GAP = 0x01;
+	    static const BYTE CHANGED_PC = 0x02;
+	    static const BYTE CHANGED_REGISTERS = 0x04;
+	    static const BYTE CHANGED_I = 0x08;
+	    static const BYTE CHANGED_STACK = 0x10;
+	    static const BYTE CHANGED_MEMORY = 0x20;
+	    static const BYTE CHANGED_DISPLAY = 0x40;
+	    static const BYTE CHANGED_OTHER = 0x80;
+
+	    //flags byte following CHANGED_OTHER
+	    static const BYTE OTHER_DELAY = 0x01;
+	    static const BYTE OTHER_SOUND = 0x02;
+	    static const BYTE OTHER_RNG = 0x04;
+	    static const BYTE OTHER_KEYS = 0x08;
+	    static const BYTE OTHER_STATUS = 0x10;
+	    static const BYTE OTHER_LONG = 0x20;
+
+	    Tracer ();
+
+	    //stops tracing if it still is
+	    ~Tracer ();
+
+	    //create path and start tracing cpu. Returns false if the file can't be created or written
+	    bool start(const char *path, Chip8 &cpu);
+
+	    //write what is buffered, close the file and detach from the cpu. Returns false if a write failed
+	    bool stop();
+
+	    bool tracing() const { return this->cpu != NULL; }
+
+	    /**
+	    * Called by Chip8::run before stepping. Anything changed from outside
+	    * since the last step that a step record can't describe(restore(),
+	    * init(), a jump or a RAM write made directly) starts a new block.
+	    */
+	    void sync();
+
+	    //called by Chip8::run after each instruction, with its opcode and the cycle it ran at
+	    void step(unsigned short opcode, unsigned long long cycle);
+
+	    //called by Chip8::store for every RAM write
+	    void stored(unsigned short address)
+	    {
+	        if(this->storeLength == 0)
+	        {
+	            this->storeLow = address;
+	            this->storeHigh = address;
+	            this->storeLength = 1;
+	            return;
+	        }
+
+	        if(address < this->storeLow)
+	            this->storeLow = address;
+	        if(address > this->storeHigh)
+	            this->storeHigh = address;
+	    }
+
+	    //steps recorded and bytes written to the file
+	    unsigned long long steps;
+	    unsigned long long bytes;
+
+	private:
+	    //longest record: every field present and all of RAM written
+	    static const size_t MAX_RECORD = 8192;
+
+	    //block header before the checkpoint record
+	    static const size_t BLOCK_HEADER = 24;
+
+	    Chip8 *cpu;
+	    FILE *file;
+	    bool failed;
+
+	    //block being built, BLOCK_SIZE plus room for one more record and a checkpoint
+	    BYTE *buffer;
+	    size_t used;
+	    unsigned long blockSteps;
+	    unsigned long long blockCycle;
+
+	    //state as of the last record, to find what a step changed. RAM is
+	    //only updated with what stored() reports
+	    Chip8::State shadow;
+	    uint64_t shadowRamHash;
+	    uint64_t shadowDisplayHash;
+
+	    /**
+	    * Set by sync(): keys or registers may have been changed between
+	    * steps, so the next step compares everything instead of only what
+	    * its instruction can write.
+	    */
+	    bool outside;
+	    
+	    //range of RAM written by the current step
+	    unsigned short storeLow;
+	    unsigned short storeHigh;
+	    int storeLength;
+
+	    //start a block with the cpu's current state
+	    void beginBlock();
+
+	    //finish the block header and write the block
+	    void writeBlock();
+
+	    //not copyable, it owns the file and the buffer
+	    Tracer (const Tracer &);
+	    Tracer &operator=(const Tracer &);
+};
+
+//one step read back from a trace
+struct TraceStep
+{
+	//cycles when it ran, and where
+	unsigned long long cycle;
+	unsigned short PC;
+	unsigned short opcode;
+
+	//Tracer::CHANGED_ and Tracer::OTHER_ flags of what it changed
+	unsigned char changed;
+	unsigned char other;
+
+	//V registers written, bit x for Vx
+	unsigned short registers;
+
+	//RAM written, memoryLength bytes from memory
+	unsigned short memory;
+	unsigned short memoryLength;
+
+	//display rows changed, bit y for row y
+	uint32_t rows;
+};
+
+/**
+* Reads a trace file back, a step at a time, keeping the cpu state as of
+* the last step read. The file is mapped, and a block index built by
+* open() lets seek() start from the nearest block's full state.
+*/
+class TraceReader
+{
+	public:
+	    TraceReader ();
+	    ~TraceReader ();
+
+	    //map path and index its blocks. Returns false if it isn't a trace
+	    bool open(const char *path);
+	    void close();
+
+	    /**
+	    * Move to the first step that runs at or after cycle, with state() as
+	    * it was just before it. Returns false if no step does.
+	    */
+	    bool seek(unsigned long long cycle);
+
+	    //read the next step and apply it to state(). Returns false at the end
+	    bool next(TraceStep &step);
+
+	    //state after the last step read. Load it into a cpu with Chip8::restore
+	    const Chip8::State &state() const { return *this->current; }
+
+	    //whole blocks in the file
+	    size_t blockCount() const { return this->blocks.size(); }
+	    
+	    //true if the file ends in a block that was cut short or is damaged
+	    bool truncated() const { return this->damaged; }
+
+	private:
+	    struct Block
+	    {
+	        //offset of the first step record and the end of the block
+	        size_t records;
+	        size_t end;
+	        unsigned long steps;
+	        unsigned long long firstCycle;
+	        unsigned long long endCycle;
+	        size_t checkpoint;
+	    };
+
+	    const unsigned char *data;
+	    size_t size;
+	    bool damaged;
+
+	    std::vector<Block> blocks;
+
+	    //block being read and where in it
+	    size_t block;
+	    size_t position;
+
+	    Chip8::State *current;
+
+	    //start reading block i from its first step
+	    void enter(size_t i);
+
+	    //cycle the step at position runs at, without reading it
+	    unsigned long long peekCycle() const;
+
+	    TraceReader (const TraceReader &);
+	    TraceReader &operator=(const TraceReader &);
+};
+
+#endif
@@ -0,0 +1,67 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef TRIPLEBUFFER_HH
+#define TRIPLEBUFFER_HH
+
+#include <atomic>
+
+/**
+* Hands the latest value of T from one writer thread to one reader thread
+* without either of them waiting.
+*
+* There are three slots. The writer fills its back slot and publish() swaps
+* it with the middle slot. The reader's update() swaps the middle slot with
+* its front slot if something new was published since the last update().
+* The writer and reader never touch the same slot, and a reader that falls
+* behind just skips the values it missed.
+*/
+template <typename T>
+class TripleBuffer
+{
+	public:
+	    TripleBuffer () : middle(1), backIndex(0), frontIndex(2) {}
+
+	    //slot the writer fills before publish()
+	    T &back() { return this->slots[this->backIndex]; }
+
+	    //make the back slot the newest value and start a new back slot
+	    void publish()
+	    {
+	        int old = this->middle.exchange(this->backIndex | FRESH, std::memory_order_acq_rel);
+	        this->backIndex = old & INDEX;
+	    }
+
+	    //move to the newest published value if there is one. Returns true if front() changed
+	    bool update()
+	    {
+	        if(!(this->middle.load(std::memory_order_relaxed) & FRESH))
+	            return false;
+
+	        int old = this->middle.exchange(this->frontIndex, std::memory_order_acq_rel);
+	        this->frontIndex = old & INDEX;
+	        return true;
+	    }
+
+	    //slot the reader reads, stable until the next update()
+	    const T &front() const { return this->slots[this->frontIndex]; }
+
+	private:
+	    //set in middle when it holds a value the reader has not taken yet
+	    static const int FRESH = 4;
+	    static const int INDEX = 3;
+
+	    T slots[3];
+
+	    //index of the middle slot, plus FRESH
+	    alignas(64) std::atomic<int> middle;
+
+	    //only used by the writer
+	    alignas(64) int backIndex;
+
+	    //only used by the reader
+	    alignas(64) int frontIndex;
+};
+
+#endif
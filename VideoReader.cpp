@@ -0,0 +1,135 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "VideoReader.h"
+#include <string.h>
+
+VideoReader::VideoReader()
+{
+    this->file = NULL;
+    this->frames = 0;
+    this->error = NULL;
+    this->repeats = 0;
+}
+
+VideoReader::~VideoReader()
+{
+    this->close();
+}
+
+bool VideoReader::open(const char *path)
+{
+    this->close();
+
+    this->file = fopen(path, "rb");
+    if(this->file == NULL)
+        return false;
+
+    this->frames = 0;
+    this->error = NULL;
+    this->repeats = 0;
+
+    for(int i = 0; i < Chip8::DISPLAY_HEIGHT; i++)
+    {
+        this->current[i] = 0;
+    }
+
+    BYTE header[6];
+    if(fread(header, 1, sizeof(header), this->file) != sizeof(header) || memcmp(header, "C8V", 3) != 0 ||
+       header[3] != VideoRecorder::VERSION || header[4] != Chip8::DISPLAY_WIDTH || header[5] != Chip8::DISPLAY_HEIGHT)
+    {
+        this->close();
+        return false;
+    }
+
+    return true;
+}
+
+void VideoReader::close()
+{
+    if(this->file != NULL)
+        fclose(this->file);
+    this->file = NULL;
+}
+
+bool VideoReader::next(uint64_t *display)
+{
+    if(this->file == NULL || this->error != NULL)
+        return false;
+
+    while(this->repeats == 0)
+    {
+        int tag = fgetc(this->file);
+        if(tag == EOF)
+            return false;
+
+        if(tag == VideoRecorder::TAG_EMPTY)
+        {
+            //varint, 7 bits at a time, low bits first
+            unsigned long n = 0;
+            int shift = 0;
+            int b;
+            do
+            {
+                if(!this->readByte(b))
+                    return false;
+                n |= (unsigned long)(b & 0x7F) << shift;
+                shift += 7;
+            } while(b & 0x80);
+
+            this->repeats = n;
+        }
+        else if(tag == VideoRecorder::TAG_DELTA)
+        {
+            uint32_t rows = 0;
+            int b;
+            for(int i = 0; i < 4; i++)
+            {
+                if(!this->readByte(b))
+                    return false;
+                rows |= (uint32_t)b << (8 * i);
+            }
+
+            for(; rows != 0; rows &= rows - 1)
+            {
+                int y = __builtin_ctz(rows);
+                int mask;
+                if(!this->readByte(mask))
+                    return false;
+
+                for(int i = 0; i < 8; i++)
+                {
+                    if(!(mask & (1 << i)))
+                        continue;
+
+                    if(!this->readByte(b))
+                        return false;
+                    this->current[y] ^= (uint64_t)b << (56 - 8 * i);
+                }
+            }
+
+            this->repeats = 1;
+        }
+        else
+        {
+            this->error = "bad record tag";
+            return false;
+        }
+    }
+
+    --this->repeats;
+    ++this->frames;
+    memcpy(display, this->current, sizeof(this->current));
+    return true;
+}
+
+bool VideoReader::readByte(int &b)
+{
+    b = fgetc(this->file);
+    if(b != EOF)
+        return true;
+
+    this->error = "recording cut short";
+    return false;
+}
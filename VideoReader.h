@@ -0,0 +1,56 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef VIDEOREADER_HH
+#define VIDEOREADER_HH
+
+#include "VideoRecorder.h"
+#include <stdio.h>
+
+/**
+* Reads back a file written by VideoRecorder(see there for the format),
+* one frame per next() call. c8vdecode is built on it.
+*/
+class VideoReader
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    VideoReader ();
+	    ~VideoReader ();
+
+	    //open the recording at path. Returns false if it can't be read or isn't one this version can read
+	    bool open(const char *path);
+	    void close();
+
+	    /**
+	    * Decode the next frame into display. Returns false at the end of the
+	    * recording, or if it is damaged, in which case error says how.
+	    */
+	    bool next(uint64_t *display);
+
+	    //frames decoded so far
+	    unsigned long frames;
+
+	    //why next() stopped early, NULL if the recording ended where a record did
+	    const char *error;
+
+	private:
+	    FILE *file;
+
+	    //display as of the last frame decoded
+	    uint64_t current[Chip8::DISPLAY_HEIGHT];
+
+	    //frames left of an empty record
+	    unsigned long repeats;
+
+	    //next byte of a record. False, with error set, if the recording ends first
+	    bool readByte(int &b);
+
+	    //not copyable, it owns the file
+	    VideoReader (const VideoReader &);
+	    VideoReader &operator=(const VideoReader &);
+};
+
+#endif
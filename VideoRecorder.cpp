@@ -0,0 +1,161 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "VideoRecorder.h"
+
+VideoRecorder::VideoRecorder()
+{
+    this->file = NULL;
+    this->failed = false;
+    this->used = 0;
+    this->frames = 0;
+    this->bytes = 0;
+    this->seenFrame = 0;
+    this->unchanged = 0;
+}
+
+VideoRecorder::~VideoRecorder()
+{
+    this->close();
+}
+
+bool VideoRecorder::open(const char *path)
+{
+    this->close();
+
+    this->file = fopen(path, "wb");
+    if(this->file == NULL)
+        return false;
+
+    this->failed = false;
+    this->used = 0;
+    this->frames = 0;
+    this->bytes = 0;
+    this->unchanged = 0;
+
+    for(int i = 0; i < Chip8::DISPLAY_HEIGHT; i++)
+    {
+        this->previous[i] = 0;
+    }
+
+    const BYTE header[] = { 'C', '8', 'V', VERSION, Chip8::DISPLAY_WIDTH, Chip8::DISPLAY_HEIGHT };
+    for(unsigned int i = 0; i < sizeof(header); i++)
+    {
+        this->buffer[this->used++] = header[i];
+    }
+    this->bytes += sizeof(header);
+
+    return true;
+}
+
+void VideoRecorder::record(const Chip8 &cpu)
+{
+    if(this->file == NULL)
+        return;
+
+    //rows that could differ from the previous frame, all of them for the first
+    uint32_t rows = this->frames == 0 ? 0xFFFFFFFF : cpu.rowsChangedSince(this->seenFrame);
+    this->seenFrame = cpu.frame;
+    ++this->frames;
+
+    //drop rows that were drawn over but ended up the same
+    uint64_t delta[Chip8::DISPLAY_HEIGHT];
+    uint32_t changed = 0;
+    for(uint32_t left = rows; left != 0; left &= left - 1)
+    {
+        int y = __builtin_ctz(left);
+        delta[y] = cpu.display[y] ^ this->previous[y];
+
+        if(delta[y] != 0)
+        {
+            changed |= 1u << y;
+            this->previous[y] = cpu.display[y];
+        }
+    }
+
+    if(changed == 0)
+    {
+        ++this->unchanged;
+        return;
+    }
+
+    this->flushUnchanged();
+    this->reserve();
+
+    BYTE *out = this->buffer + this->used;
+    BYTE *start = out;
+
+    *out++ = TAG_DELTA;
+    *out++ = changed & 0xFF;
+    *out++ = (changed >> 8) & 0xFF;
+    *out++ = (changed >> 16) & 0xFF;
+    *out++ = changed >> 24;
+
+    for(uint32_t left = changed; left != 0; left &= left - 1)
+    {
+        uint64_t row = delta[__builtin_ctz(left)];
+        BYTE *mask = out++;
+        *mask = 0;
+
+        //byte 0 is the leftmost 8 pixels, the top byte of the row
+        for(int i = 0; i < 8; i++)
+        {
+            BYTE b = (row >> (56 - 8 * i)) & 0xFF;
+            if(b != 0)
+            {
+                *mask |= 1 << i;
+                *out++ = b;
+            }
+        }
+    }
+
+    this->used += out - start;
+    this->bytes += out - start;
+}
+
+bool VideoRecorder::close()
+{
+    if(this->file == NULL)
+        return !this->failed;
+
+    this->flushUnchanged();
+    this->flush();
+
+    if(fclose(this->file) != 0)
+        this->failed = true;
+    this->file = NULL;
+
+    return !this->failed;
+}
+
+void VideoRecorder::flushUnchanged()
+{
+    if(this->unchanged == 0)
+        return;
+
+    this->reserve();
+
+    int start = this->used;
+    this->buffer[this->used++] = TAG_EMPTY;
+
+    //varint, 7 bits at a time, low bits first
+    unsigned long n = this->unchanged;
+    while(n >= 0x80)
+    {
+        this->buffer[this->used++] = (n & 0x7F) | 0x80;
+        n >>= 7;
+    }
+    this->buffer[this->used++] = n;
+
+    this->bytes += this->used - start;
+    this->unchanged = 0;
+}
+
+void VideoRecorder::flush()
+{
+    if(this->used > 0 && fwrite(this->buffer, 1, this->used, this->file) != (size_t)this->used)
+        this->failed = true;
+
+    this->used = 0;
+}
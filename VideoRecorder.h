@@ -0,0 +1,93 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef VIDEORECORDER_HH
+#define VIDEORECORDER_HH
+
+#include "Chip8.h"
+#include <stdio.h>
+
+/**
+* Streams the display of a Chip8 to a file, one frame per record() call.
+*
+* File format(.c8v):
+*   header  "C8V" VERSION width height
+*   then a sequence of records, each starting with a tag byte:
+*   TAG_EMPTY  varint n        - n frames the same as the one before
+*   TAG_DELTA  4 byte row mask - little endian, bit y set for each row stored
+*              then per row a byte mask(bit i set if byte i is stored) and
+*              the nonzero bytes of the row XOR the previous frame's row
+*
+* Byte i of a row holds pixels 8i to 8i + 7, leftmost pixel in the high bit,
+* the same packing PBM uses. The frame before the first one is blank.
+*
+* Records are built in a fixed buffer that is written out only when it
+* fills, so recording a frame never allocates or makes a system call.
+* Rows are only compared if the cpu marked them dirty since the last frame
+* recorded.
+*/
+class VideoRecorder
+{
+	typedef unsigned char BYTE;
+
+	public:
+	    static const BYTE VERSION = 1;
+
+	    static const BYTE TAG_EMPTY = 0x00;
+	    static const BYTE TAG_DELTA = 0x01;
+
+	    //size of the write buffer
+	    static const int BUFFER_SIZE = 65536;
+
+	    VideoRecorder ();
+	    ~VideoRecorder ();
+
+	    //start a new file at path. Returns false if it can't be created
+	    bool open(const char *path);
+
+	    //append the current display of cpu as the next frame
+	    void record(const Chip8 &cpu);
+
+	    //write out everything buffered and close the file. Returns false if a write failed
+	    bool close();
+
+	    //frames recorded and bytes written(or buffered) so far
+	    unsigned long frames;
+	    unsigned long bytes;
+
+	private:
+	    //longest record: tag, row mask, then a byte mask and 8 bytes per row
+	    static const int MAX_RECORD = 1 + 4 + Chip8::DISPLAY_HEIGHT * 9;
+
+	    FILE *file;
+	    bool failed;
+
+	    BYTE buffer[BUFFER_SIZE];
+	    int used;
+
+	    //display as of the last frame recorded
+	    uint64_t previous[Chip8::DISPLAY_HEIGHT];
+
+	    //cpu frame number when the last frame was recorded
+	    unsigned long seenFrame;
+
+	    //frames the same as the one before, not written yet
+	    unsigned long unchanged;
+
+	    void flushUnchanged();
+	    void flush();
+
+	    //make sure there is room for a whole record in buffer
+	    void reserve()
+	    {
+	        if(this->used > BUFFER_SIZE - MAX_RECORD)
+	            this->flush();
+	    }
+
+	    //not copyable, it owns the file
+	    VideoRecorder (const VideoRecorder &);
+	    VideoRecorder &operator=(const VideoRecorder &);
+};
+
+#endif
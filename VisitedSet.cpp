@@ -0,0 +1,105 @@
+/**
+* Author: Devon Guinane
+*/
+
+#include "VisitedSet.h"
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+VisitedSet::VisitedSet(size_t expected)
+{
+    //smallest power of 2 that holds expected without passing the load limit
+    size_t capacity = 16;
+    while(capacity * MAX_LOAD_PERCENT / 100 < expected)
+    {
+        capacity *= 2;
+    }
+
+    this->slots = NULL;
+    this->allocate(capacity);
+}
+
+VisitedSet::~VisitedSet()
+{
+    free(this->slots);
+}
+
+void VisitedSet::allocate(size_t capacity)
+{
+    //calloc gets big tables straight from the OS already zeroed
+    this->slots = (uint64_t *)calloc(capacity, sizeof(uint64_t));
+    if(this->slots == NULL)
+        throw std::bad_alloc();
+
+    this->mask = capacity - 1;
+    this->shift = 64 - __builtin_ctzll(capacity);
+    this->count = 0;
+    this->limit = capacity * MAX_LOAD_PERCENT / 100;
+}
+
+bool VisitedSet::insert(uint64_t hash)
+{
+    if(hash == 0)
+        hash = EMPTY_STANDIN;
+
+    size_t i = this->slotFor(hash);
+    while(this->slots[i] != 0)
+    {
+        if(this->slots[i] == hash)
+            return false;
+        i = (i + 1) & this->mask;
+    }
+
+    this->slots[i] = hash;
+
+    if(++this->count > this->limit)
+        this->grow();
+
+    return true;
+}
+
+bool VisitedSet::contains(uint64_t hash) const
+{
+    if(hash == 0)
+        hash = EMPTY_STANDIN;
+
+    for(size_t i = this->slotFor(hash); this->slots[i] != 0; i = (i + 1) & this->mask)
+    {
+        if(this->slots[i] == hash)
+            return true;
+    }
+
+    return false;
+}
+
+void VisitedSet::clear()
+{
+    memset(this->slots, 0, (this->mask + 1) * sizeof(uint64_t));
+    this->count = 0;
+}
+
+void VisitedSet::grow()
+{
+    uint64_t *old = this->slots;
+    size_t oldCapacity = this->mask + 1;
+    size_t count = this->count;
+
+    this->allocate(oldCapacity * 2);
+
+    for(size_t i = 0; i < oldCapacity; i++)
+    {
+        if(old[i] == 0)
+            continue;
+
+        size_t j = this->slotFor(old[i]);
+        while(this->slots[j] != 0)
+        {
+            j = (j + 1) & this->mask;
+        }
+        this->slots[j] = old[i];
+    }
+
+    this->count = count;
+    free(old);
+}
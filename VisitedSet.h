@@ -0,0 +1,69 @@
+/**
+* Author: Devon Guinane
+*/
+
+#ifndef VISITEDSET_HH
+#define VISITEDSET_HH
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+* Set of 64-bit state hashes(see Chip8::stateHash) for deduplicating states
+* while searching.
+*
+* Open addressing with linear probing in one flat array of hashes, 8 bytes
+* per slot and nothing else. Slot value 0 marks an empty slot; a hash of 0
+* is stored as EMPTY_STANDIN.
+*
+* The table doubles when it gets MAX_LOAD_PERCENT full, and the old table
+* is only freed once every hash is in the new one, so memory peaks at 1.5
+* times the table while it grows. 50 million states need 2^26 slots
+* (75% of 2^26 is 50.3 million), a 512MiB table, with a peak of 768MiB
+* during the doubling that reaches it.
+*/
+class VisitedSet
+{
+	public:
+	    static const int MAX_LOAD_PERCENT = 75;
+
+	    //expected - number of hashes to make room for up front
+	    VisitedSet (size_t expected = 1024);
+	    ~VisitedSet ();
+
+	    //add hash. Returns true if it was not in the set already
+	    bool insert(uint64_t hash);
+
+	    bool contains(uint64_t hash) const;
+
+	    //remove every hash, keeping the memory
+	    void clear();
+
+	    size_t size() const { return this->count; }
+	    size_t capacity() const { return this->mask + 1; }
+
+	private:
+	    //what a hash of 0 is stored as
+	    static const uint64_t EMPTY_STANDIN = 0x9E3779B97F4A7C15ULL;
+
+	    uint64_t *slots;
+	    size_t mask;
+	    int shift;
+	    size_t count;
+	    size_t limit;
+
+	    //allocate an empty table of capacity slots(a power of 2)
+	    void allocate(size_t capacity);
+
+	    //double the table and put every hash back in
+	    void grow();
+
+	    //Fibonacci hashing, in case the hashes are not as well mixed as they should be
+	    size_t slotFor(uint64_t hash) const { return (hash * 0x9E3779B97F4A7C15ULL) >> this->shift; }
+
+	    //not copyable, it owns the table
+	    VisitedSet (const VisitedSet &);
+	    VisitedSet &operator=(const VisitedSet &);
+};
+
+#endif
@@ -0,0 +1,675 @@
+/**
+* Author: Devon Guinane
+*
+* Headless throughput benchmark.
+*
+* usage: bench [-c cycles] [-p profile] [rom ...]
+*
+* Runs each ROM for a fixed number of cycles with every engine, then runs
+* the built-in microbenchmarks. -p picks the quirk profile they run with,
+* by name(see Chip8::profileNamed) or "guess" for Chip8::guessProfile's
+* pick for each program; the default is "default".
+* Each measurement is the best of REPEATS runs.
+* miss/ins is branch mispredictions per emulated instruction, from the
+* hardware counters where the kernel allows it and n/a elsewhere.
+* The state column is a hash of the registers and display after the run,
+* so output from two builds can be diffed to spot behaviour changes as well
+* as speed changes. An engine that ends in a different state from the
+* interpreter is marked DIFFERS.
+*
+* Then it runs each program again with a Tracer attached, to show what
+* recording every instruction costs against the fastest untraced engine,
+* and with and without fused block records, to show how many dispatches a
+* frame fusing saves, and with each quirk profile, and a frame at a time
+* with and without a VideoRecorder, to show what recording the display
+* costs and how big the recording gets.
+*
+* Last, it times many instances run a frame at a time by a plain loop and
+* by EventLoop coroutines, to show what a coroutine switch costs, and
+* measures how many frames of input latency RunAhead saves.
+*/
+
+#include "Chip8.h"
+#include "EventLoop.h"
+#include "RunAhead.h"
+#include "Tracer.h"
+#include "Debugger.h"
+#include "VideoRecorder.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::vector;
+using std::string;
+
+//runs of each measurement, the fastest is reported
+static const int REPEATS = 3;
+
+//cycles run by each ROM unless -c is given
+static const unsigned long DEFAULT_CYCLES = 50000000;
+
+struct Program
+{
+    string name;
+    vector<unsigned char> code;
+};
+
+struct EngineInfo
+{
+    const char *name;
+    Chip8::Engine engine;
+};
+
+static const EngineInfo ENGINES[] =
+{
+    { "interpreter", Chip8::ENGINE_INTERPRETER },
+    { "blocks",      Chip8::ENGINE_BLOCKS },
+    { "jit",         Chip8::ENGINE_JIT },
+    { "threaded",    Chip8::ENGINE_THREADED }
+};
+
+static const int NUM_ENGINES = sizeof(ENGINES) / sizeof(ENGINES[0]);
+
+static double now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/**
+* Counter of branch mispredictions in this thread, or -1 where the host or
+* kernel doesn't allow one(no PMU, perf_event_paranoid, not Linux).
+*/
+static int openBranchMisses()
+{
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+static void startCounter(int counter)
+{
+#ifdef __linux__
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+//count since startCounter(), 0 without a counter
+static unsigned long long stopCounter(int counter)
+{
+    unsigned long long count = 0;
+#ifdef __linux__
+    if(counter >= 0)
+    {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if(read(counter, &count, sizeof(count)) != sizeof(count))
+            count = 0;
+    }
+#endif
+    return count;
+}
+
+//FNV-1a over everything a program can observably change
+static unsigned long long stateHash(const Chip8 &cpu)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    const unsigned char *parts[] = { cpu.V, (const unsigned char *)&cpu.I,
+                                     (const unsigned char *)&cpu.PC, (const unsigned char *)cpu.display };
+    const size_t sizes[] = { sizeof(cpu.V), sizeof(cpu.I), sizeof(cpu.PC), sizeof(cpu.display) };
+
+    for(int p = 0; p < 4; p++)
+    {
+        for(size_t i = 0; i < sizes[p]; i++)
+        {
+            hash ^= parts[p][i];
+            hash *= 1099511628211ULL;
+        }
+    }
+
+    return hash;
+}
+
+static Program program(const char *name, const unsigned short *opcodes, int count)
+{
+    Program p;
+    p.name = name;
+
+    for(int i = 0; i < count; i++)
+    {
+        p.code.push_back(opcodes[i] >> 8);
+        p.code.push_back(opcodes[i] & 0xFF);
+    }
+
+    return p;
+}
+
+#define PROGRAM(name, ...) \
+    do { \
+        static const unsigned short ops[] = { __VA_ARGS__ }; \
+        programs.push_back(program(name, ops, sizeof(ops) / sizeof(ops[0]))); \
+    } while(0)
+
+//one small loop per handler family, each ending with a JP back to the top of its loop
+static void microbenchmarks(vector<Program> &programs)
+{
+    //JP to itself
+    PROGRAM("micro/JP", 0x1200);
+
+    //CALL a subroutine that returns straight away
+    PROGRAM("micro/CALL", 0x2204, 0x1200, 0x00EE);
+
+    //every 8xyN ALU op
+    PROGRAM("micro/8xyN", 0x6123, 0x6245, 0x8010, 0x8011, 0x8012, 0x8013, 0x8014,
+            0x8025, 0x8016, 0x8027, 0x801E, 0x1204);
+
+    //store and load all 16 registers
+    PROGRAM("micro/LDF55-LDF65", 0xA400, 0xFF55, 0xFF65, 0x7001, 0x1200);
+
+    //draw the 8 digit sprite, 15 rows, moving one column each time
+    PROGRAM("micro/DRW", 0x6208, 0xF229, 0xD01F, 0x7001, 0x1204);
+
+    //the pairs blocks fuse: set up two registers, then LD I and DRW and a
+    //loop counter tested with SE, starting over when it reaches 64
+    PROGRAM("micro/fused", 0x6000, 0x6100, 0xA000, 0xD015, 0x7004, 0x3040, 0x1204, 0x1200);
+}
+
+//instances and frames for the coroutine switch benchmark
+static const int SWITCH_INSTANCES = 1000;
+static const unsigned long SWITCH_FRAMES = 1000;
+
+//task that does nothing but wait for frames
+static Chip8Task idleTask(EventLoop &loop, unsigned long frames)
+{
+    for(unsigned long i = 0; i < frames; i++)
+    {
+        co_await loop.nextFrame();
+    }
+}
+
+static void switchBenchmark()
+{
+    //the 8xyN ALU loop, so every frame does some real work
+    static const unsigned char code[] = { 0x61, 0x23, 0x62, 0x45, 0x80, 0x14, 0x80, 0x25, 0x12, 0x04 };
+
+    vector<Chip8 *> cpus;
+    for(int i = 0; i < SWITCH_INSTANCES; i++)
+    {
+        cpus.push_back(new Chip8());
+        cpus.back()->load(code, sizeof(code));
+    }
+
+    //plain loop over every instance, one frame each per pass
+    double start = now();
+    for(unsigned long f = 0; f < SWITCH_FRAMES; f++)
+    {
+        for(int i = 0; i < SWITCH_INSTANCES; i++)
+        {
+            cpus[i]->run(Chip8::CYCLES_PER_FRAME);
+            cpus[i]->endFrame();
+        }
+    }
+    double plain = now() - start;
+
+    //the same frames run by one runCpu task per instance
+    EventLoop loop;
+    for(int i = 0; i < SWITCH_INSTANCES; i++)
+    {
+        loop.spawn(EventLoop::runCpu(loop, *cpus[i], SWITCH_FRAMES));
+    }
+
+    start = now();
+    loop.run(SWITCH_FRAMES + 1);
+    double tasks = now() - start;
+    unsigned long long switches = loop.switches;
+
+    //switches with no work in between
+    EventLoop idle;
+    for(int i = 0; i < SWITCH_INSTANCES; i++)
+    {
+        idle.spawn(idleTask(idle, SWITCH_FRAMES));
+    }
+
+    start = now();
+    idle.run(SWITCH_FRAMES + 1);
+    double bare = now() - start;
+
+    double frames = (double)SWITCH_INSTANCES * SWITCH_FRAMES;
+    printf("\ncoroutines: %d instances x %lu frames\n", SWITCH_INSTANCES, SWITCH_FRAMES);
+    printf("%-24s %10.1f ns/frame\n", "plain loop", plain * 1e9 / frames);
+    printf("%-24s %10.1f ns/frame\n", "event loop", tasks * 1e9 / frames);
+    printf("%-24s %10.1f ns/switch\n", "overhead", (tasks - plain) * 1e9 / switches);
+    printf("%-24s %10.1f ns/switch\n", "bare switch", bare * 1e9 / idle.switches);
+
+    for(int i = 0; i < SWITCH_INSTANCES; i++)
+    {
+        delete cpus[i];
+    }
+}
+
+//most frames run ahead in the latency benchmark
+static const int MAX_RUN_AHEAD = 3;
+
+/**
+* A program that, like many games, waits for the next frame with the delay
+* timer, reads key 5 in one frame and draws in reaction to it the frame
+* after. Measures the frames from pressing the key to the first presented
+* frame showing the drawing(1 being the frame the key went down in), with
+* each amount of run-ahead.
+*/
+static void runAheadBenchmark()
+{
+    static const unsigned char code[] =
+    {
+        0x60, 0x01,     //200: LD V0, 1
+        0xF0, 0x15,     //202: LD DT, V0
+        0xF1, 0x07,     //204: LD V1, DT
+        0x31, 0x00,     //206: SE V1, 0
+        0x12, 0x04,     //208: JP 204
+        0x46, 0x01,     //20A: SNE V6, 1
+        0x12, 0x16,     //20C: JP 216
+        0x62, 0x05,     //20E: LD V2, 5
+        0xE2, 0xA1,     //210: SKNP V2
+        0x66, 0x01,     //212: LD V6, 1
+        0x12, 0x00,     //214: JP 200
+        0xF2, 0x29,     //216: LD F, V2
+        0xD3, 0x45,     //218: DRW V3, V4, 5
+        0x66, 0x00,     //21A: LD V6, 0
+        0x12, 0x00      //21C: JP 200
+    };
+
+    //frame the key goes down on
+    static const int PRESS_FRAME = 30;
+    static const int FRAMES = 600;
+
+    printf("\nrun-ahead: key press to first presented change\n");
+
+    for(int ahead = 0; ahead <= MAX_RUN_AHEAD; ahead++)
+    {
+        Chip8 cpu;
+        cpu.load(code, sizeof(code));
+        RunAhead runner(cpu, ahead);
+
+        int latency = -1;
+        double start = now();
+        for(int f = 0; f < FRAMES; f++)
+        {
+            if(f == PRESS_FRAME)
+                cpu.setKey(5, true);
+
+            const uint64_t *display = runner.runFrame();
+            if(latency < 0 && display[0] != 0)
+                latency = f - PRESS_FRAME + 1;
+        }
+        double seconds = now() - start;
+
+        char label[32] = "off";
+        if(ahead > 0)
+            snprintf(label, sizeof(label), "%d frame%s ahead", ahead, ahead > 1 ? "s" : "");
+
+        printf("%-24s %4d frames %6.1f ms %8.2f us/frame\n", label, latency, latency * 1000.0 / 60,
+               seconds * 1e6 / FRAMES);
+    }
+}
+
+//seconds to run cpu for cycles, best of REPEATS, each on a fresh cpu
+static double timeRun(const Program &p, Chip8::Engine engine, unsigned long cycles, Tracer *tracer,
+                      Debugger *debugger = NULL)
+{
+    double best = 0;
+
+    for(int r = 0; r < REPEATS; r++)
+    {
+        Chip8 *cpu = new Chip8();
+        cpu->load(&p.code[0], p.code.size());
+        cpu->setEngine(engine);
+
+        //the trace is only written, never kept
+        if(tracer != NULL)
+            tracer->start("/dev/null", *cpu);
+        if(debugger != NULL)
+            debugger->attach(*cpu);
+
+        double start = now();
+        cpu->run(cycles);
+        double seconds = now() - start;
+
+        if(tracer != NULL)
+            tracer->stop();
+        if(debugger != NULL)
+            debugger->detach();
+
+        if(r == 0 || seconds < best)
+            best = seconds;
+        delete cpu;
+    }
+
+    return best;
+}
+
+static void traceBenchmark(const vector<Program> &programs, unsigned long cycles)
+{
+    printf("\ntracing: every instruction recorded, against untraced engines\n");
+    printf("%-24s %10s %10s %10s %8s %10s\n", "program", "interp ns", "blocks ns", "traced ns", "ratio", "bytes/step");
+
+    Tracer tracer;
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        double interpreter = timeRun(programs[p], Chip8::ENGINE_INTERPRETER, cycles, NULL);
+        double blocks = timeRun(programs[p], Chip8::ENGINE_BLOCKS, cycles, NULL);
+        double traced = timeRun(programs[p], Chip8::ENGINE_BLOCKS, cycles, &tracer);
+
+        printf("%-24s %10.2f %10.2f %10.2f %7.2fx %10.2f\n", programs[p].name.c_str(),
+               interpreter * 1e9 / cycles, blocks * 1e9 / cycles, traced * 1e9 / cycles,
+               traced / (blocks < interpreter ? blocks : interpreter),
+               tracer.steps > 0 ? (double)tracer.bytes / tracer.steps : 0.0);
+    }
+}
+
+static void debugBenchmark(const vector<Program> &programs, unsigned long cycles)
+{
+    printf("\ndebugger: attached with a breakpoint and watchpoint that are never hit\n");
+    printf("%-24s %10s %10s %8s\n", "program", "blocks ns", "debug ns", "ratio");
+
+    //the last instruction slot and page of RAM, which none of the programs touch
+    Debugger debugger;
+    debugger.addBreakpoint(0xFFE);
+    debugger.watch(0xF00, 0x10, true, true);
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        double blocks = timeRun(programs[p], Chip8::ENGINE_BLOCKS, cycles, NULL);
+        double debugged = timeRun(programs[p], Chip8::ENGINE_BLOCKS, cycles, NULL, &debugger);
+
+        printf("%-24s %10.2f %10.2f %7.2fx\n", programs[p].name.c_str(),
+               blocks * 1e9 / cycles, debugged * 1e9 / cycles, debugged / blocks);
+    }
+}
+
+static void fusionBenchmark(const vector<Program> &programs, unsigned long cycles)
+{
+    printf("\nfusion: block records dispatched per frame, without and with fused pairs\n");
+    printf("%-24s %10s %10s %8s %10s %10s %6s\n", "program", "plain", "fused", "saved", "plain ns", "fused ns", "same");
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        double seconds[2];
+        unsigned long long dispatches[2];
+        unsigned long long hash[2];
+
+        for(int fused = 0; fused < 2; fused++)
+        {
+            for(int r = 0; r < REPEATS; r++)
+            {
+                Chip8 *cpu = new Chip8();
+                cpu->load(&programs[p].code[0], programs[p].code.size());
+                cpu->setFusion(fused);
+
+                //a frame at a time, like a frontend runs it
+                double start = now();
+                for(unsigned long c = 0; c < cycles; c += Chip8::CYCLES_PER_FRAME)
+                {
+                    cpu->run(Chip8::CYCLES_PER_FRAME);
+                }
+                double elapsed = now() - start;
+
+                if(r == 0 || elapsed < seconds[fused])
+                    seconds[fused] = elapsed;
+                dispatches[fused] = cpu->dispatches;
+                hash[fused] = cpu->stateHash();
+                delete cpu;
+            }
+        }
+
+        double frames = (double)cycles / Chip8::CYCLES_PER_FRAME;
+        printf("%-24s %10.2f %10.2f %7.1f%% %10.2f %10.2f %6s\n", programs[p].name.c_str(),
+               dispatches[0] / frames, dispatches[1] / frames,
+               dispatches[0] > 0 ? 100.0 * (dispatches[0] - dispatches[1]) / dispatches[0] : 0.0,
+               seconds[0] * 1e9 / cycles, seconds[1] * 1e9 / cycles, hash[0] == hash[1] ? "yes" : "NO");
+    }
+}
+
+static void profileBenchmark(const vector<Program> &programs, unsigned long cycles)
+{
+    printf("\nprofiles: interpreter ns/instr with each profile's dispatch table\n");
+    printf("%-24s", "program");
+    for(int q = 0; q < Chip8::NUM_PROFILES; q++)
+    {
+        printf(" %9s", Chip8::profileName((Chip8::Profile)q));
+    }
+    printf("\n");
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        printf("%-24s", programs[p].name.c_str());
+
+        for(int q = 0; q < Chip8::NUM_PROFILES; q++)
+        {
+            double best = 0;
+            for(int r = 0; r < REPEATS; r++)
+            {
+                Chip8 *cpu = new Chip8();
+                cpu->setProfile((Chip8::Profile)q);
+                cpu->load(&programs[p].code[0], programs[p].code.size());
+                cpu->setEngine(Chip8::ENGINE_INTERPRETER);
+
+                double start = now();
+                cpu->run(cycles);
+                double seconds = now() - start;
+
+                if(r == 0 || seconds < best)
+                    best = seconds;
+                delete cpu;
+            }
+            printf(" %9.2f", best * 1e9 / cycles);
+        }
+        printf("\n");
+    }
+}
+
+/**
+* Seconds to run p a frame at a time for cycles, ending every frame, best
+* of REPEATS. With a recorder each frame is recorded too, to /dev/null.
+*/
+static double timeFrames(const Program &p, unsigned long cycles, VideoRecorder *recorder)
+{
+    double best = 0;
+
+    for(int r = 0; r < REPEATS; r++)
+    {
+        Chip8 *cpu = new Chip8();
+        cpu->load(&p.code[0], p.code.size());
+
+        if(recorder != NULL)
+            recorder->open("/dev/null");
+
+        double start = now();
+        for(unsigned long c = 0; c < cycles; c += Chip8::CYCLES_PER_FRAME)
+        {
+            cpu->run(Chip8::CYCLES_PER_FRAME);
+            cpu->endFrame();
+            if(recorder != NULL)
+                recorder->record(*cpu);
+        }
+
+        //closing writes the last buffer, which is part of the cost
+        if(recorder != NULL)
+            recorder->close();
+        double seconds = now() - start;
+
+        if(r == 0 || seconds < best)
+            best = seconds;
+        delete cpu;
+    }
+
+    return best;
+}
+
+static void recordBenchmark(const vector<Program> &programs, unsigned long cycles)
+{
+    printf("\nrecording: display recorded every frame, against only ending frames\n");
+    printf("%-24s %10s %10s %9s %10s %10s\n", "program", "plain us", "record us", "overhead", "bytes/frm", "MB/hour");
+
+    VideoRecorder recorder;
+    double frames = (double)cycles / Chip8::CYCLES_PER_FRAME;
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        double plain = timeFrames(programs[p], cycles, NULL);
+        double recorded = timeFrames(programs[p], cycles, &recorder);
+
+        //60 frames a second
+        double perFrame = (double)recorder.bytes / recorder.frames;
+        printf("%-24s %10.3f %10.3f %8.2f%% %10.2f %10.2f\n", programs[p].name.c_str(),
+               plain * 1e6 / frames, recorded * 1e6 / frames, 100.0 * (recorded - plain) / plain,
+               perFrame, perFrame * 60 * 3600 / 1e6);
+    }
+}
+
+static bool readRom(const char *path, Program &p)
+{
+    FILE *f = fopen(path, "rb");
+    if(f == NULL)
+        return false;
+
+    unsigned char buffer[4096];
+    size_t size = fread(buffer, 1, sizeof(buffer), f);
+    fclose(f);
+
+    p.name = path;
+    p.code.assign(buffer, buffer + size);
+    return true;
+}
+
+int main(int argc, const char *argv[])
+{
+    unsigned long cycles = DEFAULT_CYCLES;
+    vector<Program> programs;
+    Chip8::Profile profile = Chip8::PROFILE_DEFAULT;
+    bool guess = false;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+        {
+            cycles = strtoul(argv[++i], NULL, 10);
+            continue;
+        }
+
+        if(strcmp(argv[i], "-p") == 0 && i + 1 < argc)
+        {
+            ++i;
+            guess = strcmp(argv[i], "guess") == 0;
+            if(!guess && !Chip8::profileNamed(argv[i], profile))
+            {
+                printf("error: No profile called %s\n", argv[i]);
+                return 1;
+            }
+            continue;
+        }
+
+        Program p;
+        if(!readRom(argv[i], p))
+        {
+            printf("error: Couldn't open %s\n", argv[i]);
+            return 1;
+        }
+        programs.push_back(p);
+    }
+
+    microbenchmarks(programs);
+
+    int branchMisses = openBranchMisses();
+
+    printf("%-24s %-12s %12s %10s %9s %10s %9s %16s\n",
+           "program", "engine", "cycles", "Minstr/s", "ns/instr", "frames/s", "miss/ins", "state");
+
+    for(size_t p = 0; p < programs.size(); p++)
+    {
+        //every engine has to end where the interpreter does
+        unsigned long long expected = 0;
+
+        if(guess)
+            profile = Chip8::guessProfile(&programs[p].code[0], programs[p].code.size());
+
+        for(int e = 0; e < NUM_ENGINES; e++)
+        {
+            double best = 0;
+            unsigned long ran = 0;
+            unsigned long long hash = 0;
+            unsigned long long misses = 0;
+
+            for(int r = 0; r < REPEATS; r++)
+            {
+                Chip8 *cpu = new Chip8();
+                cpu->setProfile(profile);
+                cpu->load(&programs[p].code[0], programs[p].code.size());
+                cpu->setEngine(ENGINES[e].engine);
+
+                startCounter(branchMisses);
+                double start = now();
+                ran = cpu->run(cycles);
+                double seconds = now() - start;
+                unsigned long long counted = stopCounter(branchMisses);
+
+                if(r == 0 || seconds < best)
+                {
+                    best = seconds;
+                    misses = counted;
+                }
+                hash = stateHash(*cpu);
+                delete cpu;
+            }
+
+            if(e == 0)
+                expected = hash;
+
+            char missColumn[16];
+            if(branchMisses >= 0 && ran > 0)
+                snprintf(missColumn, sizeof(missColumn), "%.4f", (double)misses / ran);
+            else
+                snprintf(missColumn, sizeof(missColumn), "n/a");
+
+            double ips = best > 0 ? ran / best : 0;
+            printf("%-24s %-12s %12lu %10.1f %9.2f %10.0f %9s %016llx%s\n",
+                   programs[p].name.c_str(), ENGINES[e].name, ran, ips / 1e6,
+                   ips > 0 ? 1e9 / ips : 0, ips / Chip8::CYCLES_PER_FRAME, missColumn, hash,
+                   hash == expected ? "" : " DIFFERS");
+        }
+    }
+
+    traceBenchmark(programs, cycles / 10);
+    debugBenchmark(programs, cycles / 10);
+    fusionBenchmark(programs, cycles / 10);
+    profileBenchmark(programs, cycles / 10);
+    recordBenchmark(programs, cycles / 10);
+    switchBenchmark();
+    runAheadBenchmark();
+
+    return 0;
+}
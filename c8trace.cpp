@@ -0,0 +1,168 @@
+/**
+* Author: Devon Guinane
+*
+* Prints and queries an execution trace made by Tracer.
+*
+* usage: c8trace [-c cycle] [-n steps] [-p pc] [-o opcode[/mask]] [-s] [-w out.c8ck] trace.c8t
+*
+* Reads steps from the first one at or after cycle(default the start) and
+* prints them, at most steps of them(default all, 0 for none). -p and -o
+* only print steps at that PC or whose opcode matches under mask(hex,
+* e.g. -o D000/F000 for every DRW). Every step read is still applied, so
+* -s prints the state after the last one and -w saves it as a checkpoint
+* that Chip8::restore can resume from.
+*/
+
+#include "Tracer.h"
+#include "Checkpoint.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void printStep(const TraceStep &step, const Chip8::State &state)
+{
+    printf("%10llu %03X %04X", step.cycle, step.PC, step.opcode);
+
+    for(int x = 0; x < 16; x++)
+    {
+        if(step.registers & (1 << x))
+            printf(" V%X=%02X", x, state.V[x]);
+    }
+
+    if(step.changed & Tracer::CHANGED_I)
+        printf(" I=%03X", state.I);
+    if(step.changed & Tracer::CHANGED_STACK)
+        printf(" SP=%d", state.SP);
+    if(step.changed & Tracer::CHANGED_PC)
+        printf(" PC=%03X", state.PC);
+    if(step.changed & Tracer::CHANGED_MEMORY)
+        printf(" [%03X+%d]", step.memory, step.memoryLength);
+    if(step.changed & Tracer::CHANGED_DISPLAY)
+        printf(" rows=%08X", step.rows);
+    if(step.other & Tracer::OTHER_DELAY)
+        printf(" DT=%d", state.delayTimer);
+    if(step.other & Tracer::OTHER_SOUND)
+        printf(" ST=%d", state.soundTimer);
+    if(step.other & Tracer::OTHER_KEYS)
+        printf(" keys=%04X", state.keys);
+    if(step.other & Tracer::OTHER_STATUS)
+        printf(" status=%d", state.status);
+    if(step.other & Tracer::OTHER_LONG)
+        printf(" cycles=%llu", state.cycles);
+
+    printf("\n");
+}
+
+static void printState(const Chip8::State &state)
+{
+    printf("cycles:%llu PC:%03X I:%03X SP:%d DT:%d@%llu ST:%d@%llu keys:%04X status:%d\n",
+           state.cycles, state.PC, state.I, state.SP, state.delayTimer, state.delayTimerCycle,
+           state.soundTimer, state.soundTimerCycle, state.keys, state.status);
+
+    for(int x = 0; x < 16; x++)
+    {
+        printf("V%X:%02X%c", x, state.V[x], x == 15 ? '\n' : ' ');
+    }
+
+    for(int i = 0; i < state.SP && i < 16; i++)
+    {
+        printf("stack[%d]:%03X%c", i, state.stack[i], i + 1 == state.SP ? '\n' : ' ');
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    unsigned long long cycle = 0;
+    long long steps = -1;
+    long pc = -1;
+    long opcode = -1;
+    long mask = 0xFFFF;
+    bool showState = false;
+    const char *save = NULL;
+    int arg = 1;
+
+    for(; arg < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg++)
+    {
+        if(strcmp(argv[arg], "-s") == 0)
+        {
+            showState = true;
+            continue;
+        }
+
+        if(arg + 1 >= argc)
+            break;
+
+        const char *value = argv[++arg];
+        if(strcmp(argv[arg - 1], "-c") == 0)
+            cycle = strtoull(value, NULL, 10);
+        else if(strcmp(argv[arg - 1], "-n") == 0)
+            steps = strtoll(value, NULL, 10);
+        else if(strcmp(argv[arg - 1], "-p") == 0)
+            pc = strtol(value, NULL, 16);
+        else if(strcmp(argv[arg - 1], "-o") == 0)
+        {
+            char *end;
+            opcode = strtol(value, &end, 16);
+            if(*end == '/')
+                mask = strtol(end + 1, NULL, 16);
+        }
+        else if(strcmp(argv[arg - 1], "-w") == 0)
+            save = value;
+        else
+        {
+            --arg;
+            break;
+        }
+    }
+
+    if(argc - arg != 1)
+    {
+        fprintf(stderr, "usage: c8trace [-c cycle] [-n steps] [-p pc] [-o opcode[/mask]] [-s] [-w out.c8ck] trace.c8t\n");
+        return 1;
+    }
+
+    TraceReader reader;
+    if(!reader.open(argv[arg]))
+    {
+        fprintf(stderr, "error: %s is not a trace this version can read\n", argv[arg]);
+        return 1;
+    }
+
+    if(reader.truncated())
+        fprintf(stderr, "warning: %s ends in a damaged block, it is ignored\n", argv[arg]);
+
+    if(cycle > 0 && !reader.seek(cycle))
+    {
+        fprintf(stderr, "error: Nothing runs at or after cycle %llu\n", cycle);
+        return 1;
+    }
+
+    TraceStep step;
+    for(long long n = 0; (steps < 0 || n < steps) && reader.next(step); n++)
+    {
+        if(pc >= 0 && step.PC != pc)
+            continue;
+        if(opcode >= 0 && (step.opcode & mask) != (opcode & mask))
+            continue;
+
+        printStep(step, reader.state());
+    }
+
+    if(showState)
+        printState(reader.state());
+
+    if(save != NULL)
+    {
+        std::vector<unsigned char> record;
+        Checkpoint::encode(0, reader.state(), record);
+
+        FILE *out = fopen(save, "wb");
+        if(out == NULL || fwrite(&record[0], 1, record.size(), out) != record.size() || fclose(out) != 0)
+        {
+            fprintf(stderr, "error: Couldn't write %s\n", save);
+            return 1;
+        }
+    }
+
+    return 0;
+}
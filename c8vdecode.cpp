@@ -0,0 +1,119 @@
+/**
+* Author: Devon Guinane
+*
+* Converts a display recording made by VideoRecorder to PBM images.
+*
+* usage: c8vdecode [-e every] [-s scale] recording.c8v out
+*
+* Writes every every-th frame(default 1) as out000000.pbm, out000001.pbm, ...
+* or, if out is -, as one stream of PBM images on stdout. Each pixel is
+* drawn as a scale x scale square(default 1).
+*/
+
+#include "VideoReader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned char BYTE;
+
+static const int WIDTH = Chip8::DISPLAY_WIDTH;
+static const int HEIGHT = Chip8::DISPLAY_HEIGHT;
+
+static bool writeFrame(FILE *out, const uint64_t *display, int scale)
+{
+    fprintf(out, "P4\n%d %d\n", WIDTH * scale, HEIGHT * scale);
+
+    BYTE line[WIDTH * 16 / 8];
+    int lineBytes = (WIDTH * scale + 7) / 8;
+
+    for(int y = 0; y < HEIGHT; y++)
+    {
+        memset(line, 0, sizeof(line));
+
+        for(int x = 0; x < WIDTH * scale; x++)
+        {
+            if((display[y] >> (WIDTH - 1 - x / scale)) & 1)
+                line[x / 8] |= 0x80 >> (x % 8);
+        }
+
+        for(int i = 0; i < scale; i++)
+        {
+            if(fwrite(line, 1, lineBytes, out) != (size_t)lineBytes)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+//write frame number index, if it is one of the frames wanted
+static bool emit(const char *prefix, unsigned long index, int every, int scale, const uint64_t *display)
+{
+    if(index % every != 0)
+        return true;
+
+    if(strcmp(prefix, "-") == 0)
+        return writeFrame(stdout, display, scale);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s%06lu.pbm", prefix, index / every);
+
+    FILE *out = fopen(path, "wb");
+    if(out == NULL)
+    {
+        fprintf(stderr, "error: Couldn't create %s\n", path);
+        return false;
+    }
+
+    bool ok = writeFrame(out, display, scale);
+    return fclose(out) == 0 && ok;
+}
+
+int main(int argc, const char *argv[])
+{
+    int every = 1;
+    int scale = 1;
+    int arg = 1;
+
+    for(; arg + 1 < argc && argv[arg][0] == '-' && argv[arg][1] != '\0'; arg += 2)
+    {
+        if(strcmp(argv[arg], "-e") == 0)
+            every = atoi(argv[arg + 1]);
+        else if(strcmp(argv[arg], "-s") == 0)
+            scale = atoi(argv[arg + 1]);
+        else
+            break;
+    }
+
+    if(argc - arg != 2 || every < 1 || scale < 1 || scale > 16)
+    {
+        fprintf(stderr, "usage: c8vdecode [-e every] [-s scale] recording.c8v out\n");
+        return 1;
+    }
+
+    VideoReader reader;
+    if(!reader.open(argv[arg]))
+    {
+        fprintf(stderr, "error: %s is not a recording this version can read\n", argv[arg]);
+        return 1;
+    }
+    const char *prefix = argv[arg + 1];
+
+    uint64_t display[HEIGHT];
+    while(reader.next(display))
+    {
+        if(!emit(prefix, reader.frames - 1, every, scale, display))
+            return 1;
+    }
+
+    if(reader.error != NULL)
+    {
+        fprintf(stderr, "error: %s in frame %lu\n", reader.error, reader.frames);
+        return 1;
+    }
+
+    fprintf(stderr, "%lu frames\n", reader.frames);
+
+    return 0;
+}
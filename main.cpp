@@ -10,7 +10,6 @@
 #include <fstream>
 #include <string>
 #include <cstdlib>
-#include <ctime>
 
 
 using std::ifstream;
@@ -28,12 +27,14 @@ int main(int argc, const char *argv[])
 	//cpu.dump();
 	
 	
-	srand(time(0));
-	int randByte = rand() % 255 + 1;
-	cout << "RANDOM BYTE:" << randByte << endl;
-	
 	Disassembler d;
 	
+	if(argc < 2)
+	{
+		printf("usage: %s rom\n", argv[0]);
+		exit(1);
+	}
+	
 	FILE *f= fopen(argv[1], "rb");
 	if (f==NULL)
 	{
@@ -50,7 +51,8 @@ int main(int argc, const char *argv[])
 	// They will all have hardcoded addresses expecting that
 	//
 	//Read the file into memory at 0x200 and close it.
-	unsigned char *buffer=(unsigned char*)malloc(fsize+0x200);
+	//One spare byte, so an odd sized file still ends in a whole opcode
+	unsigned char *buffer=(unsigned char*)calloc(fsize+0x200+1, 1);
 	fread(buffer+0x200, fsize, 1, f);
 	fclose(f);
 
@@ -0,0 +1,2643 @@
+/**
+* Author: Devon Guinane
+*
+* Tests, built and run by make test.
+*
+* usage: tests [seed]
+*
+* Each test prints its name and ok, or FAIL and what went wrong. Most of
+* them run random programs(see randomProgram) on two engines, or an engine
+* and some other way of getting the same result, and compare the states
+* they end in. The seed picks the programs; a failure prints the seed to
+* run again with. Exits with 1 if any test failed.
+*/
+
+#include "Chip8.h"
+#include "Chip8Batch.h"
+#include "Checkpoint.h"
+#include "Debugger.h"
+#include "EventLoop.h"
+#include "Farm.h"
+#include "Frontend.h"
+#include "Jit.h"
+#include "Rewind.h"
+#include "RunAhead.h"
+#include "SpscRing.h"
+#include "Tracer.h"
+#include "VideoReader.h"
+#include "VideoRecorder.h"
+#include "VisitedSet.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <unistd.h>
+
+using std::vector;
+
+typedef unsigned char BYTE;
+
+//program space from 0x200 to the end of RAM
+static const int MAX_PROGRAM = 0x1000 - 0x200;
+
+//random programs each engine test runs
+static const int PROGRAMS = 2000;
+
+static uint64_t seed = 1;
+
+//xorshift64, so a seed gives the same programs on every host
+static uint64_t nextRandom()
+{
+    seed ^= seed << 13;
+    seed ^= seed >> 7;
+    seed ^= seed << 17;
+    return seed;
+}
+
+static unsigned randomBelow(unsigned limit)
+{
+    return nextRandom() % limit;
+}
+
+/**
+* Fill program with size bytes of random instructions, the last two jumps
+* back to the start(so a skip can't step over it). Jumps and calls land inside the program and I points
+* past it, so most programs run for a while instead of trapping at once.
+* One word in 32 is left fully random to reach traps, waits on keys and
+* whatever else the rest doesn't.
+*/
+static void randomProgram(vector<BYTE> &program, int size)
+{
+    program.resize(size);
+
+    for(int i = 0; i + 1 < size; i += 2)
+    {
+        unsigned short target = 0x200 + (randomBelow(size) & ~1);
+        unsigned short x = randomBelow(16) << 8;
+        unsigned short y = randomBelow(16) << 4;
+        unsigned short opcode;
+
+        switch(randomBelow(32))
+        {
+            case 0:  opcode = 0x1000 | target; break;
+            case 1:  opcode = randomBelow(8) == 0 ? 0x00EE : 0x2000 | target; break;
+            case 2:  opcode = 0x3000 | x | randomBelow(4); break;
+            case 3:  opcode = 0x4000 | x | randomBelow(4); break;
+            case 4:  opcode = (randomBelow(2) ? 0x5000 : 0x9000) | x | y; break;
+            case 5:  opcode = 0x6000 | x | randomBelow(256); break;
+            case 6:  opcode = 0x7000 | x | randomBelow(256); break;
+            case 7:
+            case 8:
+            {
+                static const unsigned short ALU[] = { 0x0, 0x1, 0x2, 0x3, 0x4, 0x5, 0x6, 0x7, 0xE };
+                opcode = 0x8000 | x | y | ALU[randomBelow(9)];
+            }
+            break;
+            case 9:  opcode = 0xA000 | (0x200 + size + randomBelow(0x1000 - 0x200 - size + 1)) % 0x1000; break;
+            case 10: opcode = 0xB000 | target; break;
+            case 11: opcode = 0xC000 | x | randomBelow(256); break;
+            case 12: opcode = 0xD000 | x | y | randomBelow(16); break;
+            case 13:
+            {
+                static const unsigned short FX[] = { 0x07, 0x15, 0x18, 0x1E, 0x29, 0x33, 0x55, 0x65 };
+                opcode = 0xF000 | x | FX[randomBelow(8)];
+            }
+            break;
+            case 14: opcode = 0x00E0; break;
+            case 15: opcode = randomBelow(0x10000); break;
+            
+            //the common ones again, to keep the mix like a real program's
+            case 16: case 17: case 18: case 19: opcode = 0x6000 | x | randomBelow(256); break;
+            case 20: case 21: case 22: case 23: opcode = 0x7000 | x | randomBelow(256); break;
+            case 24: case 25: opcode = 0xA000 | (0x200 + size + randomBelow(0x1000 - 0x200 - size + 1)) % 0x1000; break;
+            case 26: case 27: opcode = 0xD000 | x | y | randomBelow(16); break;
+            default: opcode = 0x3000 | x | randomBelow(4); break;
+        }
+
+        if(i + 4 >= size - 1)
+            opcode = 0x1200;
+
+        program[i] = opcode >> 8;
+        program[i + 1] = opcode;
+    }
+}
+
+//a random size, now and then all of RAM so a program runs off the end of it
+static int randomSize()
+{
+    return randomBelow(8) == 0 ? MAX_PROGRAM : 2 + 2 * randomBelow(256);
+}
+
+//run() calls the engine tests split a program's cycles into
+static const int RUNS = 8;
+
+//random lengths for RUNS run() calls, so they end in different places in blocks and frames
+static void randomRuns(unsigned long *runs)
+{
+    for(int i = 0; i < RUNS; i++)
+    {
+        runs[i] = 1 + randomBelow(5000);
+    }
+}
+
+//true if a and b are in the same state, cycles included
+static bool sameState(const Chip8 &a, const Chip8 &b)
+{
+    return a.stateHash() == b.stateHash() && a.cycles == b.cycles && a.sameRam(b);
+}
+
+//load program into cpu and run it for each of runs with engine, fusion and profile
+static void runProgram(Chip8 &cpu, const vector<BYTE> &program, Chip8::Engine engine, bool fusion,
+                       const unsigned long *runs, Chip8::Profile profile = Chip8::PROFILE_DEFAULT)
+{
+    cpu.load(&program[0], program.size());
+    cpu.setProfile(profile);
+    cpu.setEngine(engine);
+    cpu.setFusion(fusion);
+
+    for(int i = 0; i < RUNS; i++)
+    {
+        cpu.run(runs[i]);
+    }
+}
+
+//true if the process has any memory mapped writable and executable at once
+static bool writableCode()
+{
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if(maps == NULL)
+        return false;
+
+    char line[512];
+    bool found = false;
+    while(!found && fgets(line, sizeof(line), maps) != NULL)
+    {
+        char permissions[8];
+        found = sscanf(line, "%*s %7s", permissions) == 1 && strncmp(permissions, "rwx", 3) == 0;
+    }
+
+    fclose(maps);
+    return found;
+}
+
+/**
+* Check the rows endFrame() and rowsChangedSince() report: all of them for
+* the first frame, none for a frame that runs without DRW or CLS, exactly
+* the rows a DRW lit(not its blank rows, and wrapped rows at the top), the
+* lit rows a CLS clears, and the rows restore() changes. A since more than
+* DIRTY_HISTORY frames back, or in the future, gives every row.
+*/
+static bool testDirtyRows()
+{
+    static const BYTE COUNT[] =
+    {
+        0x72, 0x01,     //200: ADD V2, 1
+        0x12, 0x00      //202: JP 200
+    };
+
+    Chip8 cpu;
+    cpu.load(COUNT, sizeof(COUNT));
+
+    //a new cpu has nothing on screen yet for a consumer to have copied
+    if(cpu.endFrame() != 0xFFFFFFFF)
+    {
+        printf("first frame didn't mark every row ");
+        return false;
+    }
+
+    cpu.run(Chip8::CYCLES_PER_FRAME);
+    if(cpu.endFrame() != 0 || cpu.rowsChangedSince(cpu.frame - 1) != 0)
+    {
+        printf("frame without DRW or CLS marked rows ");
+        return false;
+    }
+
+    //the 0 digit at y = 3 and at y = 30, which wraps to rows 0 to 2. Then
+    //a sprite with a blank middle row at y = 10
+    unsigned long drawn = cpu.frame;
+    cpu.store(0x300, 0x80);
+    cpu.store(0x301, 0x00);
+    cpu.store(0x302, 0x80);
+    cpu.V[0] = 0;
+    cpu.V[3] = 3;
+    cpu.V[4] = 30;
+    cpu.V[5] = 10;
+    cpu.LDF29(0);
+    cpu.DRW(0, 3, 5);
+    cpu.DRW(0, 4, 5);
+    cpu.I = 0x300;
+    cpu.DRW(0, 5, 3);
+
+    const uint32_t lit = 0xF8 | 0x7 | 0xC0000000 | 1u << 10 | 1u << 12;
+    if(cpu.rowsChangedSince(drawn) != lit || cpu.endFrame() != lit)
+    {
+        printf("DRW marked rows other than the ones it lit ");
+        return false;
+    }
+
+    cpu.CLS();
+    if(cpu.endFrame() != lit || cpu.rowsChangedSince(drawn) != lit)
+    {
+        printf("CLS marked rows other than the lit ones ");
+        return false;
+    }
+
+    //back to a display with row 20 on, from one with rows 20 to 22 on
+    cpu.V[6] = 20;
+    cpu.DRW(0, 6, 1);
+    Chip8::State state;
+    cpu.save(state);
+    cpu.V[6] = 21;
+    cpu.DRW(0, 6, 1);
+    cpu.V[6] = 22;
+    cpu.DRW(0, 6, 1);
+    cpu.endFrame();
+
+    cpu.restore(state);
+    if(cpu.endFrame() != (1u << 21 | 1u << 22))
+    {
+        printf("restore() marked rows it didn't change ");
+        return false;
+    }
+
+    if(cpu.rowsChangedSince(cpu.frame + 1) != 0xFFFFFFFF)
+    {
+        printf("a frame in the future didn't give every row ");
+        return false;
+    }
+
+    for(int f = 0; f < Chip8::DIRTY_HISTORY; f++)
+    {
+        cpu.run(Chip8::CYCLES_PER_FRAME);
+        cpu.endFrame();
+    }
+
+    //DIRTY_HISTORY blank frames are still known, one more back isn't
+    if(cpu.rowsChangedSince(cpu.frame - Chip8::DIRTY_HISTORY) != 0 ||
+       cpu.rowsChangedSince(cpu.frame - Chip8::DIRTY_HISTORY - 1) != 0xFFFFFFFF ||
+       cpu.rowsChangedSince(drawn) != 0xFFFFFFFF)
+    {
+        printf("frames past DIRTY_HISTORY didn't give every row ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Record random programs frame by frame with a VideoRecorder, read each
+* recording back with a VideoReader(what c8vdecode uses) and check every
+* frame is the display the cpu had when it was recorded. A recording cut
+* short or with a bad record tag has to be reported as damaged.
+*/
+static bool testVideo()
+{
+    static const int FRAMES = 600;
+
+    char directory[] = "/tmp/c8testXXXXXX";
+    if(mkdtemp(directory) == NULL)
+    {
+        printf("no temporary directory ");
+        return false;
+    }
+    std::string path = std::string(directory) + "/video.c8v";
+
+    vector<BYTE> program;
+    vector<uint64_t> displays(FRAMES * Chip8::DISPLAY_HEIGHT);
+    bool ok = true;
+
+    for(int p = 0; p < PROGRAMS / 40 && ok; p++)
+    {
+        randomProgram(program, randomSize());
+
+        Chip8 cpu;
+        cpu.load(&program[0], program.size());
+
+        //the frame can be recorded before or after it is ended
+        bool endFirst = p % 2 == 0;
+
+        VideoRecorder recorder;
+        if(!recorder.open(path.c_str()))
+        {
+            printf("can't create a recording ");
+            ok = false;
+            break;
+        }
+
+        for(int f = 0; f < FRAMES; f++)
+        {
+            cpu.run(Chip8::CYCLES_PER_FRAME);
+            if(endFirst)
+                cpu.endFrame();
+            recorder.record(cpu);
+            if(!endFirst)
+                cpu.endFrame();
+
+            memcpy(&displays[f * Chip8::DISPLAY_HEIGHT], cpu.display, sizeof(cpu.display));
+        }
+
+        if(!recorder.close() || recorder.frames != FRAMES)
+        {
+            printf("program %d recording failed ", p);
+            ok = false;
+            break;
+        }
+
+        VideoReader reader;
+        uint64_t display[Chip8::DISPLAY_HEIGHT];
+        if(!reader.open(path.c_str()))
+        {
+            printf("program %d recording can't be read ", p);
+            ok = false;
+            break;
+        }
+
+        for(int f = 0; f < FRAMES && ok; f++)
+        {
+            ok = reader.next(display) && memcmp(display, &displays[f * Chip8::DISPLAY_HEIGHT], sizeof(display)) == 0;
+            if(!ok)
+                printf("program %d frame %d decoded differently ", p, f);
+        }
+
+        if(ok && (reader.next(display) || reader.error != NULL))
+        {
+            printf("program %d decoded past its last frame ", p);
+            ok = false;
+        }
+        reader.close();
+
+        //cut short somewhere after the header: either a record is left
+        //half done, or whole frames are missing
+        long size = recorder.bytes;
+        if(ok && size > 7 && truncate(path.c_str(), 7 + randomBelow(size - 7)) == 0 && reader.open(path.c_str()))
+        {
+            unsigned long frames = 0;
+            while(reader.next(display))
+                ++frames;
+
+            if(reader.error == NULL && frames >= FRAMES)
+            {
+                printf("program %d recording cut short went unnoticed ", p);
+                ok = false;
+            }
+            reader.close();
+        }
+    }
+
+    //a first record with a tag that isn't one
+    FILE *file = ok ? fopen(path.c_str(), "r+b") : NULL;
+    if(file != NULL)
+    {
+        fseek(file, 6, SEEK_SET);
+        fputc(0x7F, file);
+        fclose(file);
+
+        VideoReader reader;
+        uint64_t display[Chip8::DISPLAY_HEIGHT];
+        if(!reader.open(path.c_str()) || reader.next(display) || reader.error == NULL)
+        {
+            printf("bad record tag went unnoticed ");
+            ok = false;
+        }
+    }
+
+    unlink(path.c_str());
+    rmdir(directory);
+    return ok;
+}
+
+/**
+* Run 16 RNDs with cpus given seeds 0 to SEEDS - 1 and check each gives the
+* top bytes of its own generator's values, that a seed gives the same bytes
+* every time and on every engine, and that no two seeds give the same bytes.
+*/
+static bool testSeed()
+{
+    static const int SEEDS = 200;
+
+    //RND V0, FF to RND VF, FF, then a trap
+    BYTE program[2 * 16 + 2] = { 0 };
+    for(int x = 0; x < 16; x++)
+    {
+        program[2 * x] = 0xC0 | x;
+        program[2 * x + 1] = 0xFF;
+    }
+
+    static BYTE streams[SEEDS][16];
+    static const Chip8::Engine ENGINES[] =
+    {
+        Chip8::ENGINE_INTERPRETER, Chip8::ENGINE_BLOCKS, Chip8::ENGINE_JIT, Chip8::ENGINE_THREADED
+    };
+
+    for(int i = 0; i < SEEDS; i++)
+    {
+        Chip8 generator;
+        generator.seed(i);
+
+        for(size_t e = 0; e < sizeof(ENGINES) / sizeof(ENGINES[0]); e++)
+        {
+            Chip8 cpu;
+            cpu.load(program, sizeof(program));
+            cpu.seed(i);
+            cpu.setEngine(ENGINES[e]);
+            cpu.run(100);
+
+            if(e == 0)
+            {
+                for(int x = 0; x < 16; x++)
+                {
+                    streams[i][x] = generator.random() >> 56;
+                }
+            }
+
+            if(cpu.status != Chip8::TRAPPED || memcmp(cpu.V, streams[i], 16) != 0)
+            {
+                printf("seed %d gave other bytes on engine %d ", i, ENGINES[e]);
+                return false;
+            }
+        }
+
+        for(int j = 0; j < i; j++)
+        {
+            if(memcmp(streams[i], streams[j], 16) == 0)
+            {
+                printf("seeds %d and %d gave the same bytes ", j, i);
+                return false;
+            }
+        }
+    }
+
+    //load() goes back to the fixed seed, so two cpus given none agree
+    Chip8 a;
+    Chip8 b;
+    a.seed(5);
+    a.load(program, sizeof(program));
+    b.load(program, sizeof(program));
+    a.run(100);
+    b.run(100);
+    if(memcmp(a.V, b.V, 16) != 0)
+    {
+        printf("load() kept an earlier seed ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Run random programs that set and read DT and ST one cycle at a time next
+* to timers kept the eager way, counted down by 1 whenever cycles reaches a
+* multiple of CYCLES_PER_FRAME. At every frame boundary the timers, and the
+* same program run a frame at a time with run(), have to read back the
+* eager values, and nextTimerExpiry() has to be the cycle the first running
+* one gets to 0. LD Vx, DT has to read the eager value too.
+*/
+static bool testTimers()
+{
+    static const int FRAMES = 300;
+
+    vector<BYTE> program;
+
+    for(int p = 0; p < PROGRAMS / 20; p++)
+    {
+        program.clear();
+        int length = 1 + randomBelow(40);
+        for(int i = 0; i < length; i++)
+        {
+            //a short time mostly, so they run out, now and then a long one
+            BYTE value = randomBelow(4) == 0 ? randomBelow(256) : randomBelow(8);
+            BYTE x = 2 + randomBelow(12);
+
+            switch(randomBelow(4))
+            {
+                case 0:  program.insert(program.end(), { 0x60, value, 0xF0, 0x15 }); break;
+                case 1:  program.insert(program.end(), { 0x61, value, 0xF1, 0x18 }); break;
+                case 2:  program.insert(program.end(), { 0xFF, 0x07 }); break;
+                default: program.insert(program.end(), { (BYTE)(0x70 | x), value }); break;
+            }
+        }
+        program.insert(program.end(), { 0x12, 0x00 });
+
+        Chip8 stepped;
+        Chip8 framed;
+        stepped.load(&program[0], program.size());
+        framed.load(&program[0], program.size());
+
+        int delay = 0;
+        int sound = 0;
+
+        for(int f = 0; f < FRAMES; f++)
+        {
+            framed.run(Chip8::CYCLES_PER_FRAME);
+
+            for(int c = 0; c < Chip8::CYCLES_PER_FRAME; c++)
+            {
+                unsigned short opcode = stepped.read(stepped.PC) << 8 | stepped.read(stepped.PC + 1);
+                int before = delay;
+                stepped.cycle();
+
+                if(opcode == 0xF015)
+                    delay = stepped.V[0];
+                else if(opcode == 0xF118)
+                    sound = stepped.V[1];
+                else if(opcode == 0xFF07 && stepped.V[0xF] != before)
+                {
+                    printf("program %d read DT %d, not %d ", p, stepped.V[0xF], before);
+                    return false;
+                }
+
+                if(stepped.cycles % Chip8::CYCLES_PER_FRAME == 0)
+                {
+                    delay -= delay > 0;
+                    sound -= sound > 0;
+                }
+            }
+
+            unsigned long long expiry = ~0ULL;
+            if(delay > 0)
+                expiry = stepped.cycles + delay * Chip8::CYCLES_PER_FRAME;
+            if(sound > 0 && stepped.cycles + sound * Chip8::CYCLES_PER_FRAME < expiry)
+                expiry = stepped.cycles + sound * Chip8::CYCLES_PER_FRAME;
+
+            if(stepped.currentDelayTimer() != delay || stepped.currentSoundTimer() != sound ||
+               framed.currentDelayTimer() != delay || framed.currentSoundTimer() != sound)
+            {
+                printf("program %d frame %d has DT %d ST %d, not %d %d ",
+                       p, f, stepped.currentDelayTimer(), stepped.currentSoundTimer(), delay, sound);
+                return false;
+            }
+
+            if(stepped.nextTimerExpiry() != expiry || framed.nextTimerExpiry() != expiry)
+            {
+                printf("program %d frame %d expires at %llu, not %llu ", p, f, stepped.nextTimerExpiry(), expiry);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+* Run programs that set DT to a random value and wait for it in a
+*     LD Vx, DT; SE Vx, 0; JP
+* loop, over and over, with run() on every engine in pieces of random
+* length, many of them cutting a fast-forward short, next to a cpu stepped
+* with cycle(), which never fast-forwards. Both have to be in the same
+* state, cycles included, after every piece, and the blocks engine has to
+* have skipped most of the loop passes instead of running them.
+*/
+static bool testDelayLoops()
+{
+    static const Chip8::Engine ENGINES[] =
+    {
+        Chip8::ENGINE_INTERPRETER, Chip8::ENGINE_BLOCKS, Chip8::ENGINE_JIT, Chip8::ENGINE_THREADED
+    };
+
+    for(int p = 0; p < PROGRAMS / 20; p++)
+    {
+        BYTE x = randomBelow(15);
+        BYTE y = randomBelow(15);
+        BYTE mask = randomBelow(2) ? 0xFF : 0x0F;
+        BYTE fill = randomBelow(4);
+
+        //RND Vy, mask; LD DT, Vy; fill ADDs to move the loop around the frame; the loop
+        vector<BYTE> program = { (BYTE)(0xC0 | y), mask, (BYTE)(0xF0 | y), 0x15 };
+        for(int i = 0; i < fill; i++)
+            program.insert(program.end(), { 0x7E, 0x01 });
+
+        unsigned short loop = 0x200 + program.size();
+        program.insert(program.end(), { (BYTE)(0xF0 | x), 0x07, (BYTE)(0x30 | x), 0x00,
+                                        (BYTE)(0x10 | loop >> 8), (BYTE)loop });
+
+        //count the waits in VE and start over
+        program.insert(program.end(), { 0x7E, 0x01, 0x12, 0x00 });
+
+        for(size_t e = 0; e < sizeof(ENGINES) / sizeof(ENGINES[0]); e++)
+        {
+            Chip8 skipped;
+            Chip8 stepped;
+            skipped.load(&program[0], program.size());
+            stepped.load(&program[0], program.size());
+            skipped.setEngine(ENGINES[e]);
+
+            for(int piece = 0; piece < 200; piece++)
+            {
+                unsigned long count = randomBelow(2) ? 1 + randomBelow(20) : 1 + randomBelow(3000);
+
+                unsigned long ran = skipped.run(count);
+                if(ran != count)
+                {
+                    printf("program %d ran %lu cycles of %lu on engine %d ", p, ran, count, ENGINES[e]);
+                    return false;
+                }
+
+                for(unsigned long c = 0; c < count; c++)
+                {
+                    stepped.cycle();
+                }
+
+                if(!sameState(skipped, stepped))
+                {
+                    printf("program %d differs on engine %d after piece %d ", p, ENGINES[e], piece);
+                    return false;
+                }
+            }
+
+            if(ENGINES[e] == Chip8::ENGINE_BLOCKS && skipped.dispatches * 2 > skipped.cycles)
+            {
+                printf("program %d ran %llu records in %llu cycles ", p, skipped.dispatches, skipped.cycles);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+* Run a counting loop with the JIT until it is translated and check the
+* registers it ends with and that no code space is left writable. Then run
+* every random program with the JIT through Jit::runDifferential, which
+* checks it against the interpreter every few cycles.
+*/
+static bool testJit()
+{
+    if(!Jit::supported())
+    {
+        printf("(no JIT on this host) ");
+        return true;
+    }
+
+    static const BYTE LOOP[] =
+    {
+        0x60, 0x00,     //200: LD V0, 0
+        0x61, 0x00,     //202: LD V1, 0
+        0x70, 0x01,     //204: ADD V0, 1
+        0x71, 0x02,     //206: ADD V1, 2
+        0x30, 0x64,     //208: SE V0, 100
+        0x12, 0x04,     //20A: JP 204
+        0x80, 0x14,     //20C: ADD V0, V1
+        0x00, 0x00      //20E: traps
+    };
+
+    Chip8 cpu;
+    cpu.load(LOOP, sizeof(LOOP));
+    cpu.setEngine(Chip8::ENGINE_JIT);
+    cpu.run(1000);
+
+    //100 + 200 wraps to 0x2C with a carry. 2 loads, 100 passes of the loop
+    //the last without its JP, the ADD and the trap
+    if(cpu.V[0] != 0x2C || cpu.V[1] != 200 || cpu.V[0xF] != 1 || cpu.PC != 0x20E || cpu.cycles != 2 + 399 + 1 + 1)
+    {
+        printf("loop ended with V0 %02X V1 %02X VF %X PC %03X after %llu cycles ",
+               cpu.V[0], cpu.V[1], cpu.V[0xF], cpu.PC, cpu.cycles);
+        return false;
+    }
+
+    if(writableCode())
+    {
+        printf("code space left writable and executable ");
+        return false;
+    }
+
+    vector<BYTE> program;
+    for(int p = 0; p < PROGRAMS; p++)
+    {
+        randomProgram(program, randomSize());
+
+        Chip8 jitCpu;
+        Chip8 reference;
+        jitCpu.load(&program[0], program.size());
+        reference.load(&program[0], program.size());
+
+        unsigned long divergedAt;
+        if(!Jit::runDifferential(jitCpu, reference, 20000, 1 + randomBelow(50), divergedAt))
+        {
+            printf("program %d diverged at cycle %lu ", p, divergedAt);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Load one RomImage into several cpus, run a program that writes to one
+* data page and over its own code on one of them, and check only those two
+* pages are copied, the other cpus and cpus loaded later still see the
+* image, and loading again shares every page. Then run random programs on
+* one cpu and check another loaded from the same image never changes.
+*/
+static bool testSharedPages()
+{
+    static const BYTE WRITES[] =
+    {
+        0xA8, 0x00,     //200: LD I, 800
+        0x60, 0x55,     //202: LD V0, 55
+        0x61, 0x66,     //204: LD V1, 66
+        0xF1, 0x55,     //206: LD [I], V1
+        0xA2, 0x10,     //208: LD I, 210
+        0x60, 0x12,     //20A: LD V0, 12
+        0x61, 0x10,     //20C: LD V1, 10
+        0xF1, 0x55,     //20E: LD [I], V1, writing JP 210 over the trap
+        0x00, 0x00      //210: traps
+    };
+
+    std::shared_ptr<const RomImage> image = Chip8::makeImage(WRITES, sizeof(WRITES));
+    Chip8 writer;
+    Chip8 reader;
+    writer.load(image);
+    reader.load(image);
+
+    if(writer.ownedPageCount() != 0 || reader.ownedPageCount() != 0)
+    {
+        printf("loading copied pages ");
+        return false;
+    }
+
+    //it loops on the JP it wrote
+    writer.run(100);
+    if(writer.status != Chip8::RUNNING || writer.PC != 0x210 || writer.read(0x800) != 0x55 ||
+       writer.ownedPageCount() != 2)
+    {
+        printf("writer owns %d pages, PC %03X ", writer.ownedPageCount(), writer.PC);
+        return false;
+    }
+
+    Chip8 later;
+    later.load(image);
+    if(reader.ownedPageCount() != 0 || reader.read(0x800) != 0 || reader.read(0x210) != 0 ||
+       !reader.sameRam(later))
+    {
+        printf("a write reached another cpu ");
+        return false;
+    }
+
+    //the reader still has the trap
+    reader.setEngine(Chip8::ENGINE_INTERPRETER);
+    reader.run(100);
+    later.run(1);
+    if(later.read(0x210) != 0 || later.ownedPageCount() != 0)
+    {
+        printf("a write reached the image ");
+        return false;
+    }
+
+    writer.load(image);
+    if(writer.ownedPageCount() != 0 || !writer.sameRam(later))
+    {
+        printf("loading again kept copied pages ");
+        return false;
+    }
+
+    vector<BYTE> program;
+    for(int p = 0; p < PROGRAMS / 10; p++)
+    {
+        randomProgram(program, randomSize());
+        image = Chip8::makeImage(&program[0], program.size());
+
+        Chip8 copy;
+        Chip8 shared;
+        Chip8 plain;
+        copy.load(image);
+        shared.load(image);
+        plain.load(&program[0], program.size());
+
+        copy.run(1 + randomBelow(20000));
+
+        //every page that differs from the image has to have been copied
+        int differ = 0;
+        for(int page = 0; page < RomImage::NUM_PAGES; page++)
+        {
+            for(int i = 0; i < RomImage::PAGE_SIZE; i++)
+            {
+                if(copy.read(page * RomImage::PAGE_SIZE + i) != image->page(page)[i])
+                {
+                    ++differ;
+                    break;
+                }
+            }
+        }
+
+        if(shared.ownedPageCount() != 0 || !shared.sameRam(plain) || copy.ownedPageCount() < differ)
+        {
+            printf("program %d changed a cpu sharing its image ", p);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//true if cpu's display is rows, with every row not listed blank
+static bool displayIs(const Chip8 &cpu, const uint64_t *rows, const int *at, int count)
+{
+    for(int y = 0; y < Chip8::DISPLAY_HEIGHT; y++)
+    {
+        uint64_t expected = 0;
+        for(int i = 0; i < count; i++)
+        {
+            if(at[i] == y)
+                expected = rows[i];
+        }
+
+        if(cpu.display[y] != expected)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+* Draw sprites with DRW straight onto a blank display and check the pixels
+* and VF against displays worked out by hand: a sprite off the right edge
+* and off the bottom wraps to the other side, drawing over lit pixels sets
+* VF, and drawing a sprite twice erases it.
+*/
+static bool testDraw()
+{
+    Chip8 cpu;
+    cpu.I = 0x300;
+    cpu.store(0x300, 0xFF);
+    cpu.store(0x301, 0x80);
+    cpu.store(0x302, 0x40);
+    cpu.store(0x303, 0x20);
+
+    //8 pixels from x = 60: 60 to 63, then 0 to 3 of the same row
+    cpu.V[0] = 60;
+    cpu.V[1] = 5;
+    cpu.DRW(0, 1, 1);
+    const uint64_t right[] = { 0xF00000000000000FULL };
+    const int rightAt[] = { 5 };
+    if(!displayIs(cpu, right, rightAt, 1) || cpu.V[0xF] != 0)
+    {
+        printf("sprite at the right edge didn't wrap ");
+        return false;
+    }
+
+    //the same again erases it, and every pixel it turns off is a collision
+    cpu.DRW(0, 1, 1);
+    if(!displayIs(cpu, right, rightAt, 0) || cpu.V[0xF] != 1)
+    {
+        printf("drawing a sprite twice didn't erase it ");
+        return false;
+    }
+
+    //3 rows from y = 30: 30, 31, then 0. Coordinates past the edge wrap too, 66 is x = 2
+    cpu.I = 0x301;
+    cpu.V[0] = 66;
+    cpu.V[1] = 30;
+    cpu.DRW(0, 1, 3);
+    const uint64_t bottom[] = { 1ULL << 61, 1ULL << 60, 1ULL << 59 };
+    const int bottomAt[] = { 30, 31, 0 };
+    if(!displayIs(cpu, bottom, bottomAt, 3) || cpu.V[0xF] != 0)
+    {
+        printf("sprite at the bottom edge didn't wrap ");
+        return false;
+    }
+
+    //a row of 8 over the first pixel: one lit pixel turned off is a collision,
+    //the other 7 are turned on
+    cpu.I = 0x300;
+    cpu.V[0] = 2;
+    cpu.V[1] = 30;
+    cpu.DRW(0, 1, 1);
+    const uint64_t overlap[] = { 0x7FULL << 54, 1ULL << 60, 1ULL << 59 };
+    if(!displayIs(cpu, overlap, bottomAt, 3) || cpu.V[0xF] != 1)
+    {
+        printf("collision drew %016llX, VF %d ", (unsigned long long)cpu.display[30], cpu.V[0xF]);
+        return false;
+    }
+
+    //pixels that don't overlap anything lit aren't a collision
+    cpu.I = 0x302;
+    cpu.V[0] = 10;
+    cpu.V[1] = 31;
+    cpu.DRW(0, 1, 1);
+    const uint64_t apart[] = { 0x7FULL << 54, 1ULL << 60 | 1ULL << 52, 1ULL << 59 };
+    if(!displayIs(cpu, apart, bottomAt, 3) || cpu.V[0xF] != 0)
+    {
+        printf("sprite drawn apart set VF ");
+        return false;
+    }
+
+    //the hash DRW keeps up to date has to match one worked out from scratch
+    uint64_t hash = cpu.displayHash;
+    cpu.rehash();
+    if(cpu.displayHash != hash)
+    {
+        printf("display hash drifted ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Run one program on every lane of a Chip8Batch, each lane starting with
+* its number in V0, and check the registers against values worked out by
+* hand: a carry on half the lanes and a skip on one. Then run random
+* programs on every lane, each lane seeded differently, and check every
+* lane ends in the state a plain cpu running the same program ends in.
+* Every other batch gives half the lanes a second program, so lanes with
+* different code are covered too.
+*/
+static bool testBatch()
+{
+    static const BYTE LANES[] =
+    {
+        0x61, 0xF8,     //200: LD V1, F8
+        0x80, 0x14,     //202: ADD V0, V1
+        0x30, 0xFD,     //204: SE V0, FD
+        0x70, 0x80,     //206: ADD V0, 80
+        0x81, 0x03,     //208: XOR V1, V0
+        0xA1, 0x23,     //20A: LD I, 123
+        0x12, 0x0C      //20C: JP 20C
+    };
+
+    Chip8Batch *lanes = new Chip8Batch();
+    for(int i = 0; i < Chip8Batch::LANES; i++)
+    {
+        lanes->lane(i).load(LANES, sizeof(LANES));
+        lanes->lane(i).V[0] = i;
+    }
+    lanes->gather();
+    lanes->run(20);
+
+    bool right = lanes->vectorSteps > 0;
+    if(!right)
+        printf("no vector steps ran ");
+
+    for(int i = 0; i < Chip8Batch::LANES && right; i++)
+    {
+        //i + F8 carries from lane 8 up. Lane 5 makes FD and skips the ADD
+        const Chip8 &lane = lanes->lane(i);
+        BYTE v0 = i == 5 ? 0xFD : (BYTE)(i + 0xF8 + 0x80);
+
+        right = lane.V[0] == v0 && lane.V[1] == (0xF8 ^ v0) && lane.V[0xF] == (i >= 8) &&
+                lane.I == 0x123 && lane.PC == 0x20C && lane.cycles == 20;
+        if(!right)
+            printf("lane %d ended with V0 %02X V1 %02X VF %X ", i, lane.V[0], lane.V[1], lane.V[0xF]);
+    }
+    delete lanes;
+
+    if(!right)
+        return false;
+
+    vector<BYTE> programs[2];
+    unsigned long vectorSteps = 0;
+
+    for(int p = 0; p < PROGRAMS / 10; p++)
+    {
+        randomProgram(programs[0], randomSize());
+        randomProgram(programs[1], randomSize());
+
+        Chip8Batch *batch = new Chip8Batch();
+        Chip8 *reference = new Chip8[Chip8Batch::LANES];
+
+        for(int i = 0; i < Chip8Batch::LANES; i++)
+        {
+            const vector<BYTE> &program = programs[p % 2 == 1 && i % 2 == 1];
+
+            batch->lane(i).load(&program[0], program.size());
+            batch->lane(i).seed(i);
+            reference[i].load(&program[0], program.size());
+            reference[i].seed(i);
+            reference[i].setEngine(Chip8::ENGINE_INTERPRETER);
+        }
+        batch->gather();
+
+        bool same = true;
+        for(int run = 0; run < 5 && same; run++)
+        {
+            unsigned long count = 1 + randomBelow(2000);
+            batch->run(count);
+
+            for(int i = 0; i < Chip8Batch::LANES; i++)
+            {
+                reference[i].run(count);
+
+                const Chip8 &lane = batch->lane(i);
+                if(lane.stateHash() != reference[i].stateHash() || lane.cycles != reference[i].cycles)
+                {
+                    printf("program %d lane %d differs after run %d ", p, i, run);
+                    same = false;
+                    break;
+                }
+            }
+        }
+
+        vectorSteps += batch->vectorSteps;
+        delete batch;
+        delete[] reference;
+
+        if(!same)
+            return false;
+    }
+
+    //the point is the vector ops, make sure some ran
+    if(vectorSteps == 0)
+    {
+        printf("no vector steps ran ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Run random programs on a Farm, each for a random number of cycles that
+* is usually several slices, and check each result against the same
+* program run in one go on a plain cpu. Jobs that park waiting for a key
+* have to match a plain cpu stopped at the same key wait.
+*/
+static bool testFarm()
+{
+    static const int JOBS = 400;
+
+    vector<BYTE> programs[JOBS];
+    unsigned long cycles[JOBS];
+    Chip8 *cpus = new Chip8[JOBS];
+
+    Farm farm(4);
+    for(int i = 0; i < JOBS; i++)
+    {
+        randomProgram(programs[i], randomSize());
+        cycles[i] = 1 + randomBelow(5 * Farm::SLICE);
+
+        cpus[i].load(&programs[i][0], programs[i].size());
+        cpus[i].seed(i);
+        farm.add(&cpus[i], cycles[i]);
+    }
+
+    farm.run();
+
+    bool same = true;
+    for(int i = 0; i < JOBS && same; i++)
+    {
+        Chip8 serial;
+        serial.load(&programs[i][0], programs[i].size());
+        serial.seed(i);
+        unsigned long ran = serial.run(cycles[i]);
+
+        const Farm::Result &result = farm.results()[i];
+        same = result.id == i && result.status == serial.status && result.PC == serial.PC &&
+               result.I == serial.I && memcmp(result.V, serial.V, sizeof(result.V)) == 0 &&
+               result.cycles == ran && result.displayHash == Farm::hashDisplay(serial);
+
+        if(!same)
+            printf("job %d differs ", i);
+    }
+
+    delete[] cpus;
+    return same;
+}
+
+/**
+* Run a program to its LD Vx, K and check run() on the waiting cpu only lets
+* time pass, then that a key press finishes the wait into the right
+* register. Then park many copies of it on a Farm and check pressKey()
+* runs each one to the end with its own key, and refuses a job that isn't
+* waiting.
+*/
+static bool testKeyWait()
+{
+    static const BYTE WAIT[] =
+    {
+        0x65, 0x01,     //200: LD V5, 1
+        0x64, 0x09,     //202: LD V4, 9
+        0xF4, 0x15,     //204: LD DT, V4
+        0xF3, 0x0A,     //206: LD V3, K
+        0x83, 0x54,     //208: ADD V3, V5
+        0x00, 0x00      //20A: traps
+    };
+
+    Chip8 cpu;
+    cpu.load(WAIT, sizeof(WAIT));
+    if(cpu.run(100) != 4 || cpu.status != Chip8::WAITING_KEY || cpu.keyRegister != 3 || cpu.PC != 0x208)
+    {
+        printf("LD V3, K didn't stop the cpu ");
+        return false;
+    }
+
+    //a frame goes by, the timer with it, and nothing else
+    if(cpu.run(Chip8::CYCLES_PER_FRAME) != Chip8::CYCLES_PER_FRAME || cpu.cycles != 4 + Chip8::CYCLES_PER_FRAME ||
+       cpu.PC != 0x208 || cpu.V[3] != 0 || cpu.currentDelayTimer() != 8 || cpu.status != Chip8::WAITING_KEY)
+    {
+        printf("run() while waiting did more than let time pass ");
+        return false;
+    }
+
+    cpu.setKey(0xB, true);
+    if(cpu.status != Chip8::RUNNING || cpu.V[3] != 0xB || cpu.run(100) != 2 || cpu.V[3] != 0xC)
+    {
+        printf("key press didn't finish the wait ");
+        return false;
+    }
+
+    static const int JOBS = 64;
+    Chip8 *cpus = new Chip8[JOBS];
+    Farm farm(4);
+    for(int i = 0; i < JOBS; i++)
+    {
+        cpus[i].load(WAIT, sizeof(WAIT));
+        farm.add(&cpus[i], 1000);
+    }
+
+    farm.run();
+    bool ok = farm.parkedCount() == JOBS;
+    if(!ok)
+        printf("%d of %d jobs parked ", farm.parkedCount(), JOBS);
+
+    for(int i = 0; i < JOBS && ok; i++)
+    {
+        ok = farm.results()[i].status == Chip8::WAITING_KEY && farm.pressKey(i, i % 16) && !farm.pressKey(i, 0);
+        if(!ok)
+            printf("job %d wasn't woken once ", i);
+    }
+
+    if(ok)
+        farm.run();
+
+    for(int i = 0; i < JOBS && ok; i++)
+    {
+        //4 cycles up to the wait, then ADD and the trap
+        const Farm::Result &result = farm.results()[i];
+        ok = result.status == Chip8::TRAPPED && result.V[3] == i % 16 + 1 && result.PC == 0x20A && result.cycles == 6;
+        if(!ok)
+            printf("job %d ended with V3 %02X after %lu cycles ", i, result.V[3], result.cycles);
+    }
+
+    if(ok && (farm.parkedCount() != 0 || farm.pressKey(0, 1)))
+    {
+        printf("finished job still parked ");
+        ok = false;
+    }
+
+    delete[] cpus;
+    return ok;
+}
+
+//wait for a key on loop, storing it in key
+static Chip8Task waitForKey(EventLoop &loop, Chip8 &cpu, int &key)
+{
+    key = co_await loop.keyPress(cpu);
+}
+
+/**
+* Program of random pieces that wait on the delay timer, wait for a key or
+* compute and draw something, then start over.
+*/
+static void waitingProgram(vector<BYTE> &program)
+{
+    program.clear();
+
+    int pieces = 1 + randomBelow(6);
+    for(int i = 0; i < pieces; i++)
+    {
+        BYTE x = randomBelow(15);
+        BYTE y = randomBelow(15);
+        unsigned short loop = 0x200 + program.size() + 4;
+
+        switch(randomBelow(3))
+        {
+            //RND Vy, 1F; LD DT, Vy; the delay loop
+            case 0:
+                program.insert(program.end(), { (BYTE)(0xC0 | y), 0x1F, (BYTE)(0xF0 | y), 0x15,
+                                                (BYTE)(0xF0 | x), 0x07, (BYTE)(0x30 | x), 0x00,
+                                                (BYTE)(0x10 | loop >> 8), (BYTE)loop });
+            break;
+
+            //LD Vx, K
+            case 1:
+                program.insert(program.end(), { (BYTE)(0xF0 | x), 0x0A });
+            break;
+
+            //ADD Vx, Vy; LD F, Vx; DRW Vy, Vx, 5
+            default:
+                program.insert(program.end(), { (BYTE)(0x80 | x), (BYTE)(y << 4 | 4), (BYTE)(0xF0 | x), 0x29,
+                                                (BYTE)(0xD0 | y), (BYTE)(x << 4 | 5) });
+            break;
+        }
+    }
+
+    program.insert(program.end(), { 0x12, 0x00 });
+}
+
+/**
+* Check a task waiting in keyPress() is woken by pressKey() with the key,
+* and not before. Then drive cpus running programs full of key and delay
+* timer waits with EventLoop::runCpu, pressing keys at random, next to
+* copies run a frame at a time by a plain run() loop that gets the same
+* keys on the same frames. Each pair has to end in the same state.
+*/
+static bool testEventLoop()
+{
+    static const BYTE WAIT[] = { 0xF7, 0x0A };
+
+    EventLoop waiting;
+    Chip8 waiter;
+    waiter.load(WAIT, sizeof(WAIT));
+    waiter.run(1);
+
+    int key = -2;
+    waiting.spawn(waitForKey(waiting, waiter, key));
+    waiting.step();
+    waiting.step();
+    if(key != -2 || waiting.live() != 1)
+    {
+        printf("key wait woke without a key ");
+        return false;
+    }
+
+    Chip8 idle;
+    if(waiting.pressKey(idle, 3) || !waiting.pressKey(waiter, 0x1D))
+    {
+        printf("key went to the wrong task ");
+        return false;
+    }
+
+    waiting.step();
+    if(key != 0xD || waiting.live() != 0)
+    {
+        printf("key wait woke with %d ", key);
+        return false;
+    }
+
+    static const int CPUS = 50;
+    static const unsigned long FRAMES = 2000;
+
+    vector<BYTE> programs[CPUS];
+    Chip8 *looped = new Chip8[CPUS];
+    Chip8 *plain = new Chip8[CPUS];
+    EventLoop loop;
+
+    for(int i = 0; i < CPUS; i++)
+    {
+        waitingProgram(programs[i]);
+        looped[i].load(&programs[i][0], programs[i].size());
+        plain[i].load(&programs[i][0], programs[i].size());
+        looped[i].seed(i);
+        plain[i].seed(i);
+        loop.spawn(EventLoop::runCpu(loop, looped[i], FRAMES));
+    }
+
+    //a key pressed before step f is seen by the task at the start of frame f
+    unsigned long presses = 0;
+    for(unsigned long f = 0; f <= FRAMES; f++)
+    {
+        for(int i = 0; i < CPUS; i++)
+        {
+            //a key for every cpu still waiting at the end, so its task finishes
+            int key = randomBelow(16);
+            bool press = (f == FRAMES || randomBelow(20) == 0) && loop.pressKey(looped[i], key);
+
+            if(press)
+            {
+                ++presses;
+                plain[i].setKey(key, true);
+                plain[i].setKey(key, false);
+            }
+
+            if(f == FRAMES)
+                continue;
+
+            unsigned long long frameStart = plain[i].cycles;
+            plain[i].run(Chip8::CYCLES_PER_FRAME);
+            if(plain[i].status == Chip8::WAITING_KEY)
+                plain[i].run(frameStart + Chip8::CYCLES_PER_FRAME - plain[i].cycles);
+        }
+
+        loop.step();
+    }
+
+    //tasks asleep on a timer past the end catch up to it when they wake
+    loop.run(256);
+
+    bool ok = loop.live() == 0;
+    if(!ok)
+        printf("%zu tasks never finished ", loop.live());
+
+    //the waits are the point, make sure tasks slept through frames in them
+    if(ok && (presses == 0 || loop.switches >= CPUS * FRAMES))
+    {
+        printf("%lu keys pressed, %llu switches ", presses, loop.switches);
+        ok = false;
+    }
+
+    for(int i = 0; i < CPUS && ok; i++)
+    {
+        ok = sameState(looped[i], plain[i]);
+        if(!ok)
+            printf("cpu %d ended differently ", i);
+    }
+
+    delete[] looped;
+    delete[] plain;
+    return ok;
+}
+
+/**
+* Push a long run of numbers through an SpscRing from one thread and pop
+* them on another, each side mixing single and bulk calls, and check every
+* number comes out once and in order. Then fill a ring and check it takes
+* SIZE - 1 items and no more.
+*/
+static bool testRing()
+{
+    static const unsigned ITEMS = 1000000;
+    static SpscRing<unsigned, 64> ring;
+
+    std::thread producer([]()
+    {
+        unsigned next = 0;
+        unsigned batch[7];
+
+        while(next < ITEMS)
+        {
+            //a full ring lets the consumer run, even on one core
+            if(next % 3 == 0)
+            {
+                if(ring.push(next))
+                    ++next;
+                else
+                    std::this_thread::yield();
+                continue;
+            }
+
+            unsigned count = 0;
+            while(count < 7 && next + count < ITEMS)
+            {
+                batch[count] = next + count;
+                ++count;
+            }
+
+            count = ring.push(batch, count);
+            if(count == 0)
+                std::this_thread::yield();
+            next += count;
+        }
+    });
+
+    unsigned expected = 0;
+    bool ordered = true;
+    unsigned batch[5];
+
+    while(expected < ITEMS && ordered)
+    {
+        unsigned item;
+        if(expected % 2 == 0)
+        {
+            if(ring.pop(item))
+                ordered = item == expected++;
+            else
+                std::this_thread::yield();
+            continue;
+        }
+
+        size_t count = ring.pop(batch, 5);
+        if(count == 0)
+            std::this_thread::yield();
+        for(size_t i = 0; i < count && ordered; i++)
+        {
+            ordered = batch[i] == expected++;
+        }
+    }
+
+    producer.join();
+
+    if(!ordered)
+    {
+        printf("item %u out of order ", expected - 1);
+        return false;
+    }
+
+    SpscRing<unsigned, 16> full;
+    for(unsigned i = 0; i < 15; i++)
+    {
+        if(!full.push(i))
+        {
+            printf("ring full after %u items ", i);
+            return false;
+        }
+    }
+
+    unsigned item;
+    if(full.push(15) || full.size() != 15 || !full.pop(item) || item != 0)
+    {
+        printf("ring took more than SIZE - 1 items ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Run a program that waits for a key and draws its digit on a Frontend's
+* own thread, press the key through the input ring and wait for the frame
+* with the digit on it to be published.
+*/
+static bool testFrontend()
+{
+    static const BYTE program[] =
+    {
+        0xF5, 0x0A,     //200: LD V5, K
+        0xF5, 0x29,     //202: LD F, V5
+        0xD0, 0x15,     //204: DRW V0, V1, 5
+        0x12, 0x06      //206: JP 206
+    };
+
+    Chip8 cpu;
+    cpu.load(program, sizeof(program));
+
+    Frontend frontend(cpu);
+    frontend.start(false);
+    frontend.pressKey(0xA);
+    frontend.releaseKey(0xA);
+
+    //the top row of the A sprite, in the top left corner
+    const uint64_t top = (uint64_t)0xF0 << 56;
+
+    bool drawn = false;
+    for(int wait = 0; wait < 5000 && !drawn; wait++)
+    {
+        drawn = frontend.latestFrame().display[0] == top;
+        if(!drawn)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    frontend.stop();
+
+    if(!drawn)
+    {
+        printf("key press never reached the published frame ");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Fill a VisitedSet that starts small with random hashes(and 0), so it
+* grows many times, and check every hash is a hit, inserting it again is
+* refused and hashes never inserted are misses, before and after clear().
+*/
+static bool testVisitedSet()
+{
+    static const int HASHES = 200000;
+
+    //xorshift never repeats a value within its period, so these are all different
+    vector<uint64_t> in(HASHES);
+    vector<uint64_t> out(HASHES);
+    for(int i = 0; i < HASHES; i++)
+    {
+        in[i] = i == 0 ? 0 : nextRandom();
+        out[i] = nextRandom();
+    }
+
+    VisitedSet set(16);
+    for(int pass = 0; pass < 2; pass++)
+    {
+        for(int i = 0; i < HASHES; i++)
+        {
+            if(!set.insert(in[i]))
+            {
+                printf("new hash %d refused ", i);
+                return false;
+            }
+        }
+
+        if(set.size() != HASHES || set.size() * 100 > set.capacity() * VisitedSet::MAX_LOAD_PERCENT)
+        {
+            printf("%zu hashes in %zu slots ", set.size(), set.capacity());
+            return false;
+        }
+
+        for(int i = 0; i < HASHES; i++)
+        {
+            if(!set.contains(in[i]) || set.insert(in[i]))
+            {
+                printf("hash %d missed ", i);
+                return false;
+            }
+
+            if(set.contains(out[i]))
+            {
+                printf("hash %d never inserted was hit ", i);
+                return false;
+            }
+        }
+
+        set.clear();
+        if(set.size() != 0 || set.contains(in[1]))
+        {
+            printf("clear() left hashes behind ");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Run random programs a frame at a time, capturing each frame with Rewind
+* and saving it with Chip8::save as well. Rewinding any number of frames
+* has to give exactly the saved state, and running on from there has to
+* give what running on from the saved state gives. A frame limit lower
+* than the frames run has to drop the oldest and refuse to rewind past them.
+*/
+static bool testRewind()
+{
+    static const int FRAMES = 300;
+
+    vector<BYTE> program;
+    vector<Chip8::State> saved(FRAMES);
+
+    for(int p = 0; p < PROGRAMS / 20; p++)
+    {
+        randomProgram(program, randomSize());
+
+        //every other program is kept for fewer frames than it runs
+        bool small = p % 2 == 1;
+        Rewind rewind(1 << 20, small ? FRAMES / 3 : FRAMES);
+
+        Chip8 cpu;
+        cpu.load(&program[0], program.size());
+
+        for(int f = 0; f < FRAMES; f++)
+        {
+            cpu.run(Chip8::CYCLES_PER_FRAME);
+            cpu.endFrame();
+            rewind.capture(cpu);
+            cpu.save(saved[f]);
+        }
+
+        if(rewind.available() > (small ? FRAMES / 3 : FRAMES) || rewind.available() < FRAMES / 3 - Rewind::KEYFRAME_INTERVAL)
+        {
+            printf("program %d kept %d frames ", p, rewind.available());
+            return false;
+        }
+
+        //past what is kept, nothing happens
+        if(rewind.rewind(cpu, rewind.available()))
+        {
+            printf("program %d rewound past the oldest frame ", p);
+            return false;
+        }
+
+        int back = randomBelow(rewind.available());
+        Chip8 expected;
+        expected.load(&program[0], program.size());
+        expected.restore(saved[FRAMES - 1 - back]);
+
+        if(!rewind.rewind(cpu, back) || !sameState(cpu, expected))
+        {
+            printf("program %d rewound %d frames to a different state ", p, back);
+            return false;
+        }
+
+        cpu.run(Chip8::CYCLES_PER_FRAME);
+        expected.run(Chip8::CYCLES_PER_FRAME);
+        if(!sameState(cpu, expected))
+        {
+            printf("program %d ran differently after rewinding ", p);
+            return false;
+        }
+
+        //capturing goes on from the frame rewound to
+        rewind.capture(cpu);
+        expected.restore(saved[FRAMES - 1 - back]);
+        if(!rewind.rewind(cpu, 1) || !sameState(cpu, expected))
+        {
+            printf("program %d lost its place after rewinding ", p);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Run random programs a frame at a time through RunAhead, 1 to 3 frames
+* ahead, with random keys going down and up between frames, next to a cpu
+* that runs plain frames. After every frame the real cpu has to be in the
+* plain cpu's state, and while the keys stay as they are the display
+* presented has to be the one the plain cpu shows that many frames later.
+*/
+static bool testRunAhead()
+{
+    static const int FRAMES = 120;
+    static const int MAX_AHEAD = 3;
+
+    vector<BYTE> program;
+    for(int p = 0; p < PROGRAMS / 20; p++)
+    {
+        randomProgram(program, randomSize());
+        int ahead = 1 + randomBelow(MAX_AHEAD);
+
+        //key events for each frame, key + 1 going down, -(key + 1) going up, 0 for none
+        vector<int> keys(FRAMES + MAX_AHEAD, 0);
+        for(size_t f = 0; f < keys.size(); f++)
+        {
+            if(randomBelow(6) == 0)
+                keys[f] = (randomBelow(2) ? 1 : -1) * (1 + randomBelow(16));
+        }
+
+        Chip8 cpu;
+        Chip8 plain;
+        cpu.load(&program[0], program.size());
+        plain.load(&program[0], program.size());
+        RunAhead runner(cpu, ahead);
+
+        vector<vector<uint64_t> > presented;
+        vector<vector<uint64_t> > displays;
+        for(int f = 0; f < FRAMES + MAX_AHEAD; f++)
+        {
+            if(keys[f] != 0)
+            {
+                cpu.setKey(abs(keys[f]) - 1, keys[f] > 0);
+                plain.setKey(abs(keys[f]) - 1, keys[f] > 0);
+            }
+
+            if(f < FRAMES)
+            {
+                const uint64_t *display = runner.runFrame();
+                presented.push_back(vector<uint64_t>(display, display + Chip8::DISPLAY_HEIGHT));
+            }
+
+            plain.run(Chip8::CYCLES_PER_FRAME);
+            plain.endFrame();
+            displays.push_back(vector<uint64_t>(plain.display, plain.display + Chip8::DISPLAY_HEIGHT));
+
+            if(f < FRAMES && (!sameState(cpu, plain) || cpu.frame != plain.frame))
+            {
+                printf("program %d, %d ahead, left the real cpu off after frame %d ", p, ahead, f);
+                return false;
+            }
+        }
+
+        for(int f = 0; f < FRAMES; f++)
+        {
+            bool held = true;
+            for(int k = f + 1; k <= f + ahead; k++)
+            {
+                if(keys[k] != 0)
+                    held = false;
+            }
+
+            if(held && presented[f] != displays[f + ahead])
+            {
+                printf("program %d, %d ahead, presented the wrong display in frame %d ", p, ahead, f);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/**
+* Write the states of random programs with a CheckpointWriter, read them
+* back with a CheckpointReader and check every cpu comes back exactly as
+* it was. Then check that records with a flipped byte, or with matching
+* CRCs but SP, keyRegister or status out of range, are refused.
+*/
+static bool testCheckpoint()
+{
+    static const int CPUS = 50;
+
+    char directory[] = "/tmp/c8testXXXXXX";
+    if(mkdtemp(directory) == NULL)
+    {
+        printf("no temporary directory ");
+        return false;
+    }
+    std::string path = std::string(directory) + "/set.c8ck";
+
+    vector<BYTE> programs[CPUS];
+    Chip8 *cpus = new Chip8[CPUS];
+    bool ok = true;
+
+    {
+        CheckpointWriter writer(path.c_str());
+
+        //two sets, so the second has to replace the first
+        for(int set = 0; set < 2; set++)
+        {
+            for(int i = 0; i < CPUS; i++)
+            {
+                if(set == 0)
+                {
+                    randomProgram(programs[i], randomSize());
+                    cpus[i].load(&programs[i][0], programs[i].size());
+                }
+
+                cpus[i].run(1 + randomBelow(20000));
+                writer.submit(7 * i, cpus[i]);
+            }
+
+            writer.commit();
+            writer.flush();
+        }
+
+        if(writer.written != 2 || writer.failures != 0)
+        {
+            printf("%lu sets written, %lu failed ", writer.written, writer.failures);
+            ok = false;
+        }
+    }
+
+    CheckpointReader reader;
+    if(ok && (!reader.open(path.c_str()) || reader.count() != CPUS))
+    {
+        printf("written set can't be read back ");
+        ok = false;
+    }
+
+    for(int i = 0; i < CPUS && ok; i++)
+    {
+        Chip8 restored;
+        restored.load(&programs[i][0], programs[i].size());
+        reader.restore(i, restored);
+
+        if(reader.id(i) != (uint32_t)(7 * i) || !sameState(restored, cpus[i]))
+        {
+            printf("cpu %d restored differently ", i);
+            ok = false;
+        }
+    }
+
+    reader.close();
+    unlink(path.c_str());
+    rmdir(directory);
+
+    Chip8::State state;
+    cpus[0].save(state);
+    delete[] cpus;
+
+    if(!ok)
+        return false;
+
+    vector<BYTE> record;
+    Checkpoint::encode(0, state, record);
+    if(Checkpoint::check(&record[0], record.size()) != record.size())
+    {
+        printf("good record refused ");
+        return false;
+    }
+
+    record[Checkpoint::HEADER_SIZE + 3] ^= 0x10;
+    if(Checkpoint::check(&record[0], record.size()) != 0)
+    {
+        printf("record with a flipped byte accepted ");
+        return false;
+    }
+
+    //CRCs that match, over fields that don't make sense
+    for(int field = 0; field < 3; field++)
+    {
+        Chip8::State bad = state;
+        if(field == 0)
+            bad.SP = 17;
+        else if(field == 1)
+            bad.keyRegister = 0x10;
+        else
+            bad.status = (Chip8::Status)(Chip8::BREAK + 1);
+
+        record.clear();
+        Checkpoint::encode(0, bad, record);
+        if(Checkpoint::check(&record[0], record.size()) != 0)
+        {
+            printf("record with an out of range field %d accepted ", field);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//read all of path into data
+static bool readFile(const char *path, vector<BYTE> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if(file == NULL)
+        return false;
+
+    data.clear();
+    BYTE buffer[4096];
+    size_t got;
+    while((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        data.insert(data.end(), buffer, buffer + got);
+
+    fclose(file);
+    return true;
+}
+
+//replace path with size bytes of data
+static bool writeFile(const char *path, const BYTE *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    if(file == NULL)
+        return false;
+
+    bool written = fwrite(data, 1, size, file) == size;
+    return fclose(file) == 0 && written;
+}
+
+//replay the first steps of the trace at path into cpu, loaded with program. Returns the steps read
+static unsigned long replayTrace(const char *path, const vector<BYTE> &program, unsigned long steps,
+                                 Chip8 &cpu)
+{
+    TraceReader reader;
+    cpu.load(&program[0], program.size());
+    if(!reader.open(path))
+        return 0;
+
+    TraceStep step;
+    unsigned long read = 0;
+    while(read < steps && reader.next(step))
+        ++read;
+
+    cpu.restore(reader.state());
+    return read;
+}
+
+/**
+* Trace random programs run in pieces on each engine, with keys and
+* registers changed and PC moved between pieces so the trace has several
+* blocks, next to the same runs without a tracer. Tracing must not change
+* how a program runs, and replaying the trace must give the state it ended
+* in. A trace cut short must keep only whole blocks, replaying exactly as
+* far as the whole trace does, and a block with a damaged checkpoint must
+* end the trace there. A file with the wrong magic must not open at all.
+*/
+static bool testTrace()
+{
+    char directory[] = "/tmp/c8testXXXXXX";
+    if(mkdtemp(directory) == NULL)
+    {
+        printf("no temporary directory ");
+        return false;
+    }
+    std::string path = std::string(directory) + "/trace.c8t";
+
+    vector<BYTE> program;
+    bool ok = true;
+
+    for(int p = 0; p < PROGRAMS / 20 && ok; p++)
+    {
+        randomProgram(program, randomSize());
+        Chip8::Engine engine = (Chip8::Engine)(p % 4);
+        unsigned long runs[RUNS];
+        randomRuns(runs);
+
+        Chip8 cpu;
+        Chip8 plain;
+        cpu.load(&program[0], program.size());
+        plain.load(&program[0], program.size());
+        cpu.setEngine(engine);
+        plain.setEngine(engine);
+
+        Tracer tracer;
+        if(!tracer.start(path.c_str(), cpu))
+        {
+            printf("can't create a trace ");
+            ok = false;
+            break;
+        }
+
+        //changes between runs are only recorded by the step after them, so
+        //none are made to a trapped cpu, which has none
+        for(int i = 0; i < RUNS; i++)
+        {
+            if(cpu.status != Chip8::TRAPPED)
+            {
+                int key = randomBelow(16);
+                bool down = randomBelow(2) == 0;
+                cpu.setKey(key, down);
+                plain.setKey(key, down);
+            }
+
+            if(cpu.status == Chip8::RUNNING && randomBelow(3) == 0)
+            {
+                int x = randomBelow(16);
+                cpu.V[x] = plain.V[x] = randomBelow(256);
+            }
+
+            if(cpu.status == Chip8::RUNNING && i > 0 && randomBelow(2) == 0)
+                cpu.PC = plain.PC = cpu.PC == 0x200 ? 0x202 : 0x200;
+
+            cpu.run(runs[i]);
+            plain.run(runs[i]);
+        }
+
+        unsigned long long steps = tracer.steps;
+        if(!tracer.stop() || !sameState(cpu, plain))
+        {
+            printf("program %d on engine %d ran differently traced ", p, engine);
+            ok = false;
+            break;
+        }
+
+        TraceReader reader;
+        if(!reader.open(path.c_str()) || reader.truncated())
+        {
+            printf("program %d trace can't be read ", p);
+            ok = false;
+            break;
+        }
+        size_t blocks = reader.blockCount();
+        reader.close();
+
+        Chip8 replayed;
+        unsigned long read = replayTrace(path.c_str(), program, steps + 1, replayed);
+
+        //a cpu waiting for a key at the end spent cycles no step records
+        if(cpu.status == Chip8::WAITING_KEY && replayed.cycles <= cpu.cycles)
+            replayed.cycles = cpu.cycles;
+
+        if(read != steps || !sameState(replayed, cpu))
+        {
+            printf("program %d on engine %d replayed differently ", p, engine);
+            ok = false;
+            break;
+        }
+
+        vector<BYTE> trace;
+        if(!readFile(path.c_str(), trace))
+        {
+            printf("program %d trace can't be read back ", p);
+            ok = false;
+            break;
+        }
+
+        //block offsets, from the u32 size each starts with
+        vector<size_t> offsets;
+        for(size_t at = 8; at + 4 <= trace.size(); )
+        {
+            offsets.push_back(at);
+            at += 4 + (trace[at] | trace[at + 1] << 8 | trace[at + 2] << 16 | (size_t)trace[at + 3] << 24);
+        }
+
+        if(offsets.size() != blocks)
+        {
+            printf("program %d trace has %d blocks, not %d ", p, (int)offsets.size(), (int)blocks);
+            ok = false;
+            break;
+        }
+
+        //cut short, only whole blocks are kept and they replay as the whole trace does
+        size_t cut = 8 + randomBelow(trace.size() - 8);
+        size_t whole = 0;
+        while(whole + 1 < blocks && offsets[whole + 1] <= cut)
+            ++whole;
+
+        Chip8 shorter;
+        read = 0;
+        if(writeFile(path.c_str(), &trace[0], cut) && reader.open(path.c_str()))
+        {
+            ok = reader.blockCount() == whole && reader.truncated() == (cut != offsets[whole]);
+            reader.close();
+            read = replayTrace(path.c_str(), program, steps + 1, shorter);
+        }
+        else
+            ok = false;
+
+        writeFile(path.c_str(), &trace[0], trace.size());
+        if(!ok || (read > 0 && (replayTrace(path.c_str(), program, read, replayed) != read ||
+                                !sameState(shorter, replayed))))
+        {
+            printf("program %d trace cut at %d of %d went unnoticed ", p, (int)cut, (int)trace.size());
+            ok = false;
+            break;
+        }
+
+        //a checkpoint with a byte flipped ends the trace at the block before it
+        size_t damaged = randomBelow(blocks);
+        trace[offsets[damaged] + 24 + randomBelow(Checkpoint::HEADER_SIZE)] ^= 1 << randomBelow(8);
+        if(!writeFile(path.c_str(), &trace[0], trace.size()) || !reader.open(path.c_str()) ||
+           !reader.truncated() || reader.blockCount() != damaged)
+        {
+            printf("program %d damaged block %d of %d went unnoticed ", p, (int)damaged, (int)blocks);
+            ok = false;
+            break;
+        }
+        reader.close();
+
+        //not a trace at all
+        trace[0] ^= 0xFF;
+        if(!writeFile(path.c_str(), &trace[0], trace.size()) || reader.open(path.c_str()))
+        {
+            printf("program %d trace with a bad magic opened ", p);
+            ok = false;
+            break;
+        }
+    }
+
+    unlink(path.c_str());
+    rmdir(directory);
+    return ok;
+}
+
+//true if cpu is stopped by debugger for reason at PC after cycles, at address
+static bool stoppedAt(const Chip8 &cpu, const Debugger &debugger, Debugger::Reason reason,
+                      unsigned short PC, unsigned long long cycles, unsigned short address, int engine)
+{
+    if(cpu.status == Chip8::BREAK && debugger.reason == reason && cpu.PC == PC && cpu.cycles == cycles &&
+       debugger.address == address)
+        return true;
+
+    printf("engine %d stopped for %d at %03X after %llu, not for %d at %03X after %llu ", engine,
+           debugger.reason, cpu.PC, (unsigned long long)cpu.cycles, reason, PC, cycles);
+    return false;
+}
+
+/**
+* Run a known program on each engine under a Debugger and check it stops
+* where it has to: at a breakpoint, again at it after resume() steps over
+* it, on a condition each time it turns true, and on reads and writes
+* watched by a range wrapping the end of RAM. detach() has to set a
+* stopped cpu running again. Then debug random programs with random
+* breakpoints, watches and conditions, resuming after every stop and
+* detaching at some of them, and check they end where a run without a
+* debugger does.
+*/
+static bool testDebugger()
+{
+    static const BYTE STOPS[] =
+    {
+        0x60, 0x00,     //200: LD V0, 0
+        0x70, 0x01,     //202: ADD V0, 1
+        0x30, 0x0A,     //204: SE V0, 0A
+        0x12, 0x02,     //206: JP 202
+        0xAF, 0xFF,     //208: LD I, FFF
+        0xF0, 0x65,     //20A: LD V0, [I]
+        0x70, 0x05,     //20C: ADD V0, 5
+        0xA0, 0x01,     //20E: LD I, 001
+        0xF0, 0x55,     //210: LD [I], V0
+        0x00, 0x00      //212: traps
+    };
+
+    static const Chip8::Engine ENGINES[] =
+    {
+        Chip8::ENGINE_INTERPRETER, Chip8::ENGINE_BLOCKS, Chip8::ENGINE_JIT, Chip8::ENGINE_THREADED
+    };
+
+    for(int e = 0; e < 4; e++)
+    {
+        Chip8 cpu;
+        Chip8 plain;
+        cpu.load(STOPS, sizeof(STOPS));
+        plain.load(STOPS, sizeof(STOPS));
+        cpu.setEngine(ENGINES[e]);
+        plain.setEngine(ENGINES[e]);
+        plain.run(1000);
+
+        Debugger debugger;
+        debugger.attach(cpu);
+        debugger.addBreakpoint(0x206);
+        int condition = debugger.breakWhen(0, Debugger::GREATER, 4);
+        int reads = debugger.watch(0xFFE, 4, true, false);
+        int writes = debugger.watch(0xFFE, 4, false, true);
+
+        //before JP 202 runs, the first time round and after stepping over it
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::BREAKPOINT, 0x206, 3, 0x206, e))
+            return false;
+
+        cpu.run(1000);
+        if(cpu.cycles != 3)
+        {
+            printf("engine %d ran while stopped ", e);
+            return false;
+        }
+
+        debugger.resume();
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::BREAKPOINT, 0x206, 6, 0x206, e))
+            return false;
+
+        //after the ADD that makes V0 5, and not again while it stays over 4
+        debugger.removeBreakpoint(0x206);
+        debugger.resume();
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::CONDITION, 0x204, 14, 0x204, e) || debugger.which != condition ||
+           cpu.V[0] != 5)
+            return false;
+
+        //LD V0, [I] reads FFF, in the range that wraps to 001
+        debugger.resume();
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::READ_WATCH, 0x20C, 32, 0xFFF, e) || debugger.which != reads)
+            return false;
+
+        //V0 went back to 0, so the condition can stop the cpu again
+        debugger.resume();
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::CONDITION, 0x20E, 33, 0x20E, e) || debugger.which != condition)
+            return false;
+
+        debugger.resume();
+        cpu.run(1000);
+        if(!stoppedAt(cpu, debugger, Debugger::WRITE_WATCH, 0x212, 35, 0x001, e) || debugger.which != writes ||
+           debugger.stops != 6)
+            return false;
+
+        debugger.detach();
+        if(cpu.status != Chip8::RUNNING)
+        {
+            printf("engine %d detach left it stopped ", e);
+            return false;
+        }
+
+        cpu.run(1000);
+        if(!sameState(cpu, plain) || cpu.status != Chip8::TRAPPED || cpu.cycles != 36)
+        {
+            printf("engine %d ended somewhere else ", e);
+            return false;
+        }
+    }
+
+    vector<BYTE> program;
+    for(int p = 0; p < PROGRAMS / 4; p++)
+    {
+        randomProgram(program, randomSize());
+        Chip8::Engine engine = ENGINES[p % 4];
+        unsigned long cycles = 1 + randomBelow(20000);
+
+        Chip8 cpu;
+        Chip8 plain;
+        cpu.load(&program[0], program.size());
+        plain.load(&program[0], program.size());
+        cpu.setEngine(engine);
+        plain.setEngine(engine);
+        plain.run(cycles);
+
+        Debugger debugger;
+        debugger.attach(cpu);
+        for(int i = randomBelow(4); i > 0; i--)
+        {
+            debugger.addBreakpoint(0x200 + 2 * randomBelow(program.size() / 2 + 1));
+        }
+        for(int i = randomBelow(3); i > 0; i--)
+        {
+            debugger.watch(randomBelow(4096), 1 + randomBelow(512), randomBelow(2) == 0, randomBelow(2) == 0);
+        }
+        for(int i = randomBelow(3); i > 0; i--)
+        {
+            int reg = randomBelow(17);
+            debugger.breakWhen(reg, (Debugger::Compare)randomBelow(4), randomBelow(reg == 16 ? 4096 : 256));
+        }
+
+        //cycles only go up while running, so this ends
+        while(cpu.cycles < cycles)
+        {
+            cpu.run(cycles - cpu.cycles);
+            if(cpu.status != Chip8::BREAK)
+                break;
+
+            if(debugger.attached() && randomBelow(16) == 0)
+                debugger.detach();
+            else
+                debugger.resume();
+        }
+
+        if(!sameState(cpu, plain))
+        {
+            printf("program %d on engine %d ended elsewhere after %lu stops ", p, engine, debugger.stops);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+* Turn about a quarter of the instruction pairs in program into pairs that
+* blocks fuse(see BlockCache::fuse), with random operands.
+*/
+static void fusablePairs(vector<BYTE> &program)
+{
+    for(size_t i = 0; i + 7 < program.size(); i += 2)
+    {
+        if(randomBelow(4) != 0)
+            continue;
+
+        unsigned short x = randomBelow(16) << 8;
+        unsigned short y = randomBelow(16) << 8;
+        unsigned short first;
+        unsigned short second;
+
+        switch(randomBelow(4))
+        {
+            case 0:
+                first = 0xA000 | (0x200 + program.size() + randomBelow(0x100)) % 0x1000;
+                second = 0xD000 | x | randomBelow(256);
+            break;
+            case 1:  first = 0x7000 | x | randomBelow(256); second = 0x3000 | y | randomBelow(4); break;
+            case 2:  first = 0x7000 | x | randomBelow(256); second = 0x4000 | y | randomBelow(4); break;
+            default: first = 0x6000 | x | randomBelow(256); second = 0x6000 | y | randomBelow(256); break;
+        }
+
+        program[i] = first >> 8;
+        program[i + 1] = first;
+        program[i + 2] = second >> 8;
+        program[i + 3] = second;
+        i += 2;
+    }
+}
+
+/**
+* Run a program made of one of each fused pair with blocks fused and
+* unfused and with the JIT fused, and check each ends in the state worked
+* out by hand, with blocks running exactly the records counted by hand.
+* Then run random programs full of fusable pairs the same ways and check
+* they all end where the interpreter does, with fewer records run when
+* fused.
+*/
+static bool testFusion()
+{
+    static const BYTE PAIRS[] =
+    {
+        0x61, 0x05,     //200: LD V1, 5     fused
+        0x62, 0x03,     //202: LD V2, 3
+        0x71, 0x01,     //204: ADD V1, 1    fused
+        0x31, 0x0A,     //206: SE V1, 0A
+        0x12, 0x04,     //208: JP 204
+        0xA2, 0x10,     //20A: LD I, 210    fused
+        0xD1, 0x21,     //20C: DRW V1, V2, 1
+        0x00, 0x00,     //20E: traps
+        0xF0, 0x00      //210: sprite
+    };
+
+    //18 instructions and the trap. Fused, that is 2 records for 200-206,
+    //204-206 and 208 for V1 = 7 to 9, 204-206 again, 20A-20C and the trap
+    static const unsigned long long CYCLES = 19;
+    static const unsigned long long RECORDS[2] = { 19, 12 };
+    const uint64_t sprite[] = { 0xFULL << 50 };
+    const int spriteAt[] = { 3 };
+
+    for(int engine = 0; engine < 3; engine++)
+    {
+        Chip8 cpu;
+        cpu.load(PAIRS, sizeof(PAIRS));
+        cpu.setEngine(engine < 2 ? Chip8::ENGINE_BLOCKS : Chip8::ENGINE_JIT);
+        cpu.setFusion(engine > 0);
+        cpu.run(1000);
+
+        if(cpu.status != Chip8::TRAPPED || cpu.PC != 0x20E || cpu.cycles != CYCLES || cpu.V[1] != 0x0A ||
+           cpu.V[2] != 3 || cpu.V[0xF] != 0 || cpu.I != 0x210 || !displayIs(cpu, sprite, spriteAt, 1))
+        {
+            printf("pairs ended at %03X after %llu cycles, %s ", cpu.PC, (unsigned long long)cpu.cycles,
+                   engine < 2 ? (engine ? "fused" : "unfused") : "JIT");
+            return false;
+        }
+
+        if(engine < 2 && cpu.dispatches != RECORDS[engine])
+        {
+            printf("pairs ran %llu records %s, not %llu ", cpu.dispatches, engine ? "fused" : "unfused",
+                   RECORDS[engine]);
+            return false;
+        }
+    }
+
+    vector<BYTE> program;
+    unsigned long long dispatches[2] = { 0, 0 };
+
+    for(int p = 0; p < PROGRAMS / 4; p++)
+    {
+        randomProgram(program, randomSize());
+        fusablePairs(program);
+
+        unsigned long runs[RUNS];
+        randomRuns(runs);
+
+        Chip8 reference;
+        runProgram(reference, program, Chip8::ENGINE_INTERPRETER, true, runs);
+
+        for(int fused = 0; fused < 2; fused++)
+        {
+            Chip8 cpu;
+            runProgram(cpu, program, Chip8::ENGINE_BLOCKS, fused, runs);
+            dispatches[fused] += cpu.dispatches;
+
+            if(!sameState(cpu, reference))
+            {
+                printf("program %d differs with blocks %s ", p, fused ? "fused" : "unfused");
+                return false;
+            }
+        }
+
+        Chip8 jit;
+        runProgram(jit, program, Chip8::ENGINE_JIT, true, runs);
+        if(!sameState(jit, reference))
+        {
+            printf("program %d differs with the JIT ", p);
+            return false;
+        }
+    }
+
+    if(dispatches[1] >= dispatches[0])
+    {
+        printf("fused blocks ran %llu records, unfused %llu ", dispatches[1], dispatches[0]);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Run a short arithmetic program, and programs that overflow and underflow
+* the stack, on the threaded core and check the registers, RAM, stack and
+* traps against values worked out by hand. Then run random programs and
+* those two on it and check each ends in the interpreter's state with the
+* same trap.
+*/
+static bool testThreaded()
+{
+    static const BYTE OVERFLOW[] = { 0x60, 0x01, 0x22, 0x02 };
+    static const BYTE UNDERFLOW[] = { 0x22, 0x04, 0x00, 0xEE, 0x00, 0xEE };
+    static const BYTE ARITHMETIC[] =
+    {
+        0x60, 0xF0,     //200: LD V0, F0
+        0x61, 0x20,     //202: LD V1, 20
+        0x80, 0x14,     //204: ADD V0, V1   V0 = 10, VF = 1
+        0x82, 0x05,     //206: SUB V2, V0   V2 = F0, VF = 0
+        0xA3, 0x00,     //208: LD I, 300
+        0xF2, 0x33,     //20A: LD B, V2     2, 4, 0
+        0xF2, 0x65,     //20C: LD V2, [I]
+        0x00, 0x00      //20E: traps
+    };
+
+    Chip8 known;
+    known.setEngine(Chip8::ENGINE_THREADED);
+    known.load(ARITHMETIC, sizeof(ARITHMETIC));
+    known.run(100);
+    if(known.status != Chip8::TRAPPED || known.trapOpcode != 0x0000 || known.PC != 0x20E || known.cycles != 8 ||
+       known.V[0] != 2 || known.V[1] != 4 || known.V[2] != 0 || known.V[0xF] != 0 || known.I != 0x300 ||
+       known.read(0x300) != 2 || known.read(0x301) != 4 || known.read(0x302) != 0)
+    {
+        printf("arithmetic ended at %03X with V0-V2 %02X %02X %02X ", known.PC, known.V[0], known.V[1], known.V[2]);
+        return false;
+    }
+
+    //16 CALLs fill the stack with where they were called from, the 17th traps where it is
+    static const int STACK = 16;
+    known.load(OVERFLOW, sizeof(OVERFLOW));
+    known.run(100);
+    bool filled = known.SP == STACK;
+    for(int i = 0; i < STACK; i++)
+    {
+        filled = filled && known.stack[i] == 0x202;
+    }
+
+    if(known.status != Chip8::TRAPPED || known.trapOpcode != 0x2202 || known.PC != 0x202 || known.cycles != 18 ||
+       known.V[0] != 1 || !filled)
+    {
+        printf("overflow ended at %03X, SP %d, trap %04X ", known.PC, known.SP, known.trapOpcode);
+        return false;
+    }
+
+    //CALL 204, RET to 202, then a RET with nothing to return to
+    known.load(UNDERFLOW, sizeof(UNDERFLOW));
+    known.run(100);
+    if(known.status != Chip8::TRAPPED || known.trapOpcode != 0x00EE || known.PC != 0x202 || known.cycles != 3 ||
+       known.SP != 0)
+    {
+        printf("underflow ended at %03X, SP %d, trap %04X ", known.PC, known.SP, known.trapOpcode);
+        return false;
+    }
+
+    vector<BYTE> program;
+    int traps = 0;
+
+    for(int p = 0; p < PROGRAMS / 2 + 2; p++)
+    {
+        if(p == 0)
+            program.assign(OVERFLOW, OVERFLOW + sizeof(OVERFLOW));
+        else if(p == 1)
+            program.assign(UNDERFLOW, UNDERFLOW + sizeof(UNDERFLOW));
+        else
+            randomProgram(program, randomSize());
+
+        unsigned long runs[RUNS];
+        randomRuns(runs);
+
+        Chip8 reference;
+        runProgram(reference, program, Chip8::ENGINE_INTERPRETER, false, runs);
+
+        Chip8 cpu;
+        runProgram(cpu, program, Chip8::ENGINE_THREADED, false, runs);
+
+        if(!sameState(cpu, reference) || cpu.status != reference.status || cpu.trapOpcode != reference.trapOpcode)
+        {
+            printf("program %d differs ", p);
+            return false;
+        }
+
+        if(p < 2 && cpu.status != Chip8::TRAPPED)
+        {
+            printf("stack program %d did not trap ", p);
+            return false;
+        }
+
+        traps += cpu.status == Chip8::TRAPPED;
+    }
+
+    //the random programs have to reach the traps too, not only the two above
+    if(traps <= 2)
+    {
+        printf("only %d programs trapped ", traps);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+* Check every profile's name gives that profile back. Run a program that
+* hits each quirk with every profile on every engine and check the
+* registers, I and where Bxnn jumped against what each profile's quirks
+* give by hand. Then run random programs with every profile on every
+* engine and check each engine ends in the interpreter's state for that
+* profile. Every profile has to change how some program ends, or its
+* quirks weren't applied.
+*/
+static bool testProfiles()
+{
+    static const Chip8::Engine ENGINES[] =
+    {
+        Chip8::ENGINE_BLOCKS, Chip8::ENGINE_JIT, Chip8::ENGINE_THREADED
+    };
+
+    static const BYTE QUIRKS[0x28] =
+    {
+        0x61, 0x05,     //200: LD V1, 5
+        0x62, 0x06,     //202: LD V2, 6
+        0x6F, 0x07,     //204: LD VF, 7
+        0x81, 0x21,     //206: OR V1, V2
+        0x8A, 0xF0,     //208: LD VA, VF
+        0x63, 0x09,     //20A: LD V3, 9
+        0x83, 0x26,     //20C: SHR V3, V2
+        0x8B, 0xF0,     //20E: LD VB, VF
+        0xA3, 0x00,     //210: LD I, 300
+        0xF2, 0x55,     //212: LD [I], V2
+        0xB2, 0x20      //214: JP V0, 220, or to 220 + V2 with Bxnn. Both land on a trap
+    };
+
+    //per profile: VF after OR, V3 and VF after SHR, I after LD [I], where the jump landed
+    static const struct
+    {
+        BYTE logicVF;
+        BYTE shifted;
+        BYTE shiftVF;
+        unsigned short I;
+        unsigned short PC;
+    }
+    EXPECTED[Chip8::NUM_PROFILES] =
+    {
+        { 7, 4, 1, 0x300, 0x220 },  //default
+        { 0, 3, 0, 0x303, 0x220 },  //COSMAC VIP: logic clears VF, shifts Vy, I += x + 1
+        { 7, 4, 1, 0x302, 0x226 },  //CHIP-48: I += x, jumps by Vx
+        { 7, 4, 1, 0x300, 0x226 },  //SCHIP: jumps by Vx
+        { 7, 3, 0, 0x303, 0x220 }   //XO-CHIP: shifts Vy, I += x + 1
+    };
+
+    for(int profile = 0; profile < Chip8::NUM_PROFILES; profile++)
+    {
+        Chip8::Profile named;
+        if(!Chip8::profileNamed(Chip8::profileName((Chip8::Profile)profile), named) || named != profile)
+        {
+            printf("profile %d is named %s ", profile, Chip8::profileName((Chip8::Profile)profile));
+            return false;
+        }
+
+        for(int e = -1; e < (int)(sizeof(ENGINES) / sizeof(ENGINES[0])); e++)
+        {
+            Chip8 cpu;
+            cpu.load(QUIRKS, sizeof(QUIRKS));
+            cpu.setProfile((Chip8::Profile)profile);
+            cpu.setEngine(e < 0 ? Chip8::ENGINE_INTERPRETER : ENGINES[e]);
+            cpu.run(100);
+
+            if(cpu.status != Chip8::TRAPPED || cpu.cycles != 12 || cpu.PC != EXPECTED[profile].PC ||
+               cpu.V[0xA] != EXPECTED[profile].logicVF || cpu.V[3] != EXPECTED[profile].shifted ||
+               cpu.V[0xB] != EXPECTED[profile].shiftVF || cpu.I != EXPECTED[profile].I || cpu.V[1] != 7 ||
+               cpu.read(0x300) != 0 || cpu.read(0x301) != 7 || cpu.read(0x302) != 6)
+            {
+                printf("quirks with %s on engine %d ended at %03X, VF %d, V3 %d, VF %d, I %03X ",
+                       Chip8::profileName((Chip8::Profile)profile), e < 0 ? Chip8::ENGINE_INTERPRETER : ENGINES[e],
+                       cpu.PC, cpu.V[0xA], cpu.V[3], cpu.V[0xB], cpu.I);
+                return false;
+            }
+        }
+    }
+
+    vector<BYTE> program;
+    bool changed[Chip8::NUM_PROFILES] = { false };
+
+    for(int p = 0; p < PROGRAMS / 4; p++)
+    {
+        randomProgram(program, randomSize());
+
+        unsigned long runs[RUNS];
+        randomRuns(runs);
+
+        Chip8 standard;
+        runProgram(standard, program, Chip8::ENGINE_INTERPRETER, false, runs);
+
+        for(int profile = 0; profile < Chip8::NUM_PROFILES; profile++)
+        {
+            Chip8 reference;
+            runProgram(reference, program, Chip8::ENGINE_INTERPRETER, false, runs, (Chip8::Profile)profile);
+            changed[profile] = changed[profile] || !sameState(reference, standard);
+
+            for(size_t e = 0; e < sizeof(ENGINES) / sizeof(ENGINES[0]); e++)
+            {
+                Chip8 cpu;
+                runProgram(cpu, program, ENGINES[e], true, runs, (Chip8::Profile)profile);
+
+                if(!sameState(cpu, reference))
+                {
+                    printf("program %d differs with profile %d on engine %d ", p, profile, ENGINES[e]);
+                    return false;
+                }
+            }
+        }
+    }
+
+    for(int profile = Chip8::PROFILE_DEFAULT + 1; profile < Chip8::NUM_PROFILES; profile++)
+    {
+        if(!changed[profile])
+        {
+            printf("profile %d ran every program like the default ", profile);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct Test
+{
+    const char *name;
+    bool (*run)();
+};
+
+static const Test TESTS[] =
+{
+    { "draw", testDraw },
+    { "dirty rows", testDirtyRows },
+    { "video", testVideo },
+    { "seed", testSeed },
+    { "timers", testTimers },
+    { "delay loops", testDelayLoops },
+    { "jit", testJit },
+    { "batch", testBatch },
+    { "farm", testFarm },
+    { "key wait", testKeyWait },
+    { "event loop", testEventLoop },
+    { "ring", testRing },
+    { "frontend", testFrontend },
+    { "visited set", testVisitedSet },
+    { "shared pages", testSharedPages },
+    { "rewind", testRewind },
+    { "run-ahead", testRunAhead },
+    { "checkpoint", testCheckpoint },
+    { "trace", testTrace },
+    { "debugger", testDebugger },
+    { "fusion", testFusion },
+    { "threaded", testThreaded },
+    { "profiles", testProfiles }
+};
+
+int main(int argc, const char *argv[])
+{
+    uint64_t start = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    int failed = 0;
+
+    for(size_t i = 0; i < sizeof(TESTS) / sizeof(TESTS[0]); i++)
+    {
+        //every test gets the same programs whatever ran before it
+        seed = start != 0 ? start : 1;
+
+        printf("%-24s ", TESTS[i].name);
+        fflush(stdout);
+
+        if(TESTS[i].run())
+        {
+            printf("ok\n");
+        }
+        else
+        {
+            printf("FAIL(seed %llu)\n", (unsigned long long)start);
+            ++failed;
+        }
+    }
+
+    return failed > 0 ? 1 : 0;
+}